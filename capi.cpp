@@ -0,0 +1,165 @@
+/**
+ * capi.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides C interface of the library to embed it into applications written in C and other languages.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sleeksurface.h"
+#include "surface.h"
+#include <cmath>
+#include <cstdlib>
+
+
+using namespace SleekSurface;
+
+namespace
+{
+    const int POSITIONS_ALLOCATED = 1;
+    const int NORMALS_ALLOCATED = 2;
+    const int INDICES_ALLOCATED = 4;
+
+    template <typename T>
+    bool allocate(T *&buffer, size_t count, size_t capacity, int flag, int owned, int &allocated)
+    {
+        // The caller's buffers are trusted to be large enough, the library ones are grown when they are not.
+        bool own = (owned & flag) != 0;
+        if (buffer && (!own || count <= capacity))
+            return true;
+
+        T *grown = (T *)realloc(own ? buffer : 0, count * sizeof(T));
+        if (!grown)
+            return false;
+        buffer = grown;
+        if (!own)
+            allocated |= flag;
+        return true;
+    }
+}
+
+void sleek_surface_heights_init(SleekSurfaceHeights *heights, const double *data, int width, int height)
+{
+    heights->type = SLEEK_SURFACE_FLOAT64;
+    heights->data = data;
+    heights->width = width;
+    heights->height = height;
+    heights->stride = width * sizeof(double);
+    heights->originX = heights->originZ = 0.0;
+    heights->stepX = heights->stepZ = 1.0;
+    heights->heightScale = 1.0;
+    heights->heightOffset = 0.0;
+}
+
+void sleek_surface_mesh_init(SleekSurfaceMesh *mesh)
+{
+    mesh->width = mesh->height = 0;
+    mesh->positions = mesh->normals = 0;
+    mesh->indices = 0;
+    mesh->vertexCount = mesh->indexCount = 0;
+    mesh->allocated = 0;
+}
+
+int sleek_surface_output_size(int inWidth, int inHeight, int resolution, size_t *vertexCount, size_t *indexCount)
+{
+    if (inWidth < 2 || inHeight < 2 || resolution < 2)
+        return 0;
+
+    int w, h;
+    SurfaceBuilder::getOutputSize(inWidth, inHeight, resolution, w, h);
+    *vertexCount = (size_t)w * h;
+    *indexCount = (size_t)(w - 1) * (h - 1) * 6;
+    return 1;
+}
+
+int sleek_surface_build(const SleekSurfaceHeights *heights, const SleekSurfaceParams *params, SleekSurfaceMesh *mesh)
+{
+    static const HeightField::Type types[] = {HeightField::FLOAT32, HeightField::FLOAT64, HeightField::INT16};
+
+    size_t vertexCount, indexCount;
+    if (!heights || !params || !mesh || !heights->data || heights->type < SLEEK_SURFACE_FLOAT32 ||
+        heights->type > SLEEK_SURFACE_INT16 || params->kernelRadius < 0 ||
+        !sleek_surface_output_size(heights->width, heights->height, params->resolution, &vertexCount, &indexCount) ||
+        heights->stride < heights->width * HeightField::elementSize(types[heights->type]) ||
+        !isfinite(heights->stepX) || !isfinite(heights->stepZ) || heights->stepX == 0.0 || heights->stepZ == 0.0)
+        return 0;
+
+    int allocated = 0;
+    // No exception may cross the C boundary, allocation failures inside the library included.
+    try
+    {
+        HeightField field(types[heights->type], heights->data, heights->width, heights->height, heights->stride,
+                          heights->originX, heights->originZ, heights->stepX, heights->stepZ);
+        field.setHeightTransform(heights->heightScale, heights->heightOffset);
+
+        // The surface is written tile by tile directly to the output buffers.
+        int w, h;
+        SurfaceBuilder::getOutputSize(heights->width, heights->height, params->resolution, w, h);
+        if (allocate(mesh->positions, vertexCount * 3, mesh->vertexCount * 3, POSITIONS_ALLOCATED, mesh->allocated, allocated) &&
+            allocate(mesh->normals, vertexCount * 3, mesh->vertexCount * 3, NORMALS_ALLOCATED, mesh->allocated, allocated) &&
+            allocate(mesh->indices, indexCount, mesh->indexCount, INDICES_ALLOCATED, mesh->allocated, allocated) &&
+            SurfaceBuilder::buildFused(field, params->resolution, params->c, params->kernelRadius, 0,
+                                       mesh->positions, mesh->normals))
+        {
+            SurfaceBuilder::triangulateGrid(w, h, mesh->indices);
+            mesh->width = w;
+            mesh->height = h;
+            mesh->vertexCount = vertexCount;
+            mesh->indexCount = indexCount;
+            mesh->allocated |= allocated;
+            return 1;
+        }
+    }
+    catch (...)
+    {
+    }
+
+    // Release only the buffers allocated by this call.
+    int previous = mesh->allocated;
+    mesh->allocated = allocated;
+    sleek_surface_free(mesh);
+    mesh->allocated = previous;
+    return 0;
+}
+
+void sleek_surface_free(SleekSurfaceMesh *mesh)
+{
+    if (!mesh)
+        return;
+
+    if (mesh->allocated & POSITIONS_ALLOCATED)
+    {
+        free(mesh->positions);
+        mesh->positions = 0;
+    }
+    if (mesh->allocated & NORMALS_ALLOCATED)
+    {
+        free(mesh->normals);
+        mesh->normals = 0;
+    }
+    if (mesh->allocated & INDICES_ALLOCATED)
+    {
+        free(mesh->indices);
+        mesh->indices = 0;
+    }
+    mesh->allocated = 0;
+}
@@ -0,0 +1,403 @@
+/**
+ * codec.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides compact binary format of sleek surfaces.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "codec.h"
+#include <cstring>
+#include <limits>
+
+
+using namespace SleekSurface;
+
+const uint32_t SurfaceCodec::MAGIC;
+const int SurfaceCodec::ESCAPE;
+
+class SurfaceCodec::BitWriter
+{
+    vector<unsigned char> &out;
+    uint64_t acc;
+    int count;
+
+public:
+    BitWriter(vector<unsigned char> &_out) : out(_out), acc(0), count(0) {};
+
+    void write(uint64_t value, int bits)
+    {
+        // Bits are packed starting from the least significant one, at most 32 at once.
+        if (bits > 32)
+        {
+            write(value & 0xFFFFFFFFull, 32);
+            value >>= 32;
+            bits -= 32;
+        }
+        acc |= value << count;
+        count += bits;
+        if (count >= 32)
+        {
+            putBytes(out, acc, 4);
+            acc >>= 32;
+            count -= 32;
+        }
+    }
+
+    void flush()
+    {
+        for (; count > 0; count -= 8, acc >>= 8)
+            out.push_back(acc & 0xFF);
+        acc = 0;
+        count = 0;
+    }
+};
+
+class SurfaceCodec::BitReader
+{
+    const unsigned char *in;
+    const unsigned char *end;
+    uint64_t acc;
+    int count;
+
+    void refill()
+    {
+        // Reading past the end gives zeros, the caller checks the data size.
+        for (; count <= 56; count += 8)
+            acc |= (uint64_t)(in < end ? *in++ : 0) << count;
+    }
+
+public:
+    BitReader(const unsigned char *_in, const unsigned char *_end) : in(_in), end(_end), acc(0), count(0) {};
+
+    uint64_t read(int bits)
+    {
+        if (bits > 32)
+        {
+            uint64_t low = read(32);
+            return low | read(bits - 32) << 32;
+        }
+        if (count < bits)
+            refill();
+        uint64_t value = acc & ((1ull << bits) - 1);
+        acc >>= bits;
+        count -= bits;
+        return value;
+    }
+
+    int readUnary(int limit)
+    {
+        if (count <= limit)
+            refill();
+        // Unary code is terminated by zero bit, except the longest one.
+        int n = ~acc ? __builtin_ctzll(~acc) : 64;
+        int bits = n < limit ? n + 1 : limit;
+        acc >>= bits;
+        count -= bits;
+        return min(n, limit);
+    }
+};
+
+void SurfaceCodec::putBytes(vector<unsigned char> &out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i, value >>= 8)
+        out.push_back(value & 0xFF);
+}
+
+uint64_t SurfaceCodec::getBytes(const unsigned char *in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i)
+        value |= (uint64_t)in[i] << (8 * i);
+    return value;
+}
+
+void SurfaceCodec::encodeChannel(const int64_t *values, int width, int height, BitWriter &writer)
+{
+    // Residuals of the Lorenzo predictor are zigzag mapped to unsigned values
+    // and Rice coded with the parameter fitted to their mean.
+    size_t n = (size_t)width * height;
+    vector<uint64_t> residuals(n);
+    // The sum is accumulated in double, as the clamped residuals of a large tile overflow 64 bits.
+    double sum = 0.0;
+    for (size_t z = 0, i = 0; z < (size_t)height; ++z)
+    {
+        for (int x = 0; x < width; ++x, ++i)
+        {
+            int64_t prediction = x > 0 && z > 0 ? values[i - 1] + values[i - width] - values[i - width - 1] :
+                                 x > 0 ? values[i - 1] : z > 0 ? values[i - width] : 0;
+            int64_t r = values[i] - prediction;
+            residuals[i] = ((uint64_t)r << 1) ^ (uint64_t)(r >> 63);
+            sum += (double)min(residuals[i], (uint64_t)1 << 40);
+        }
+    }
+    double mean = sum / n;
+    int k = mean >= 1.0 ? ilogb(mean) : 0;
+    writer.write(k, 6);
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t q = residuals[i] >> k;
+        if (q < (uint64_t)ESCAPE)
+        {
+            writer.write((1ull << q) - 1, q + 1);
+            writer.write(residuals[i] & ((1ull << k) - 1), k);
+        }
+        else
+        {
+            writer.write((1ull << ESCAPE) - 1, ESCAPE);
+            writer.write(residuals[i], 64);
+        }
+    }
+}
+
+void SurfaceCodec::decodeChannel(BitReader &reader, int width, int height, int64_t *values)
+{
+    int k = reader.read(6);
+    for (size_t z = 0, i = 0; z < (size_t)height; ++z)
+    {
+        for (int x = 0; x < width; ++x, ++i)
+        {
+            int q = reader.readUnary(ESCAPE);
+            uint64_t u = q < ESCAPE ? (uint64_t)q << k | reader.read(k) : reader.read(64);
+            int64_t r = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+            int64_t prediction = x > 0 && z > 0 ? values[i - 1] + values[i - width] - values[i - width - 1] :
+                                 x > 0 ? values[i - 1] : z > 0 ? values[i - width] : 0;
+            values[i] = prediction + r;
+        }
+    }
+}
+
+void SurfaceCodec::encodeNormal(const Vec3 &normal, int bits, int64_t &u, int64_t &v)
+{
+    // Octahedral encoding with y as the main axis, so the upper hemisphere is not folded.
+    double l = abs(normal.x) + abs(normal.y) + abs(normal.z);
+    double nu = l > 0.0 ? normal.x / l : 0.0;
+    double nv = l > 0.0 ? normal.z / l : 0.0;
+    if (normal.y < 0.0)
+    {
+        double fu = (1.0 - abs(nv)) * (nu >= 0.0 ? 1.0 : -1.0);
+        double fv = (1.0 - abs(nu)) * (nv >= 0.0 ? 1.0 : -1.0);
+        nu = fu;
+        nv = fv;
+    }
+    double scale = (double)((1 << bits) - 1);
+    u = (int64_t)floor((nu + 1.0) * 0.5 * scale + 0.5);
+    v = (int64_t)floor((nv + 1.0) * 0.5 * scale + 0.5);
+}
+
+Vec3 SurfaceCodec::decodeNormal(int64_t u, int64_t v, int bits)
+{
+    double scale = (double)((1 << bits) - 1);
+    double nu = (double)u / scale * 2.0 - 1.0;
+    double nv = (double)v / scale * 2.0 - 1.0;
+    double ny = 1.0 - abs(nu) - abs(nv);
+    if (ny < 0.0)
+    {
+        double fu = (1.0 - abs(nv)) * (nu >= 0.0 ? 1.0 : -1.0);
+        double fv = (1.0 - abs(nu)) * (nv >= 0.0 ? 1.0 : -1.0);
+        nu = fu;
+        nv = fv;
+    }
+    Vec3 normal(nu, ny, nv);
+    normal.normalize();
+    return normal;
+}
+
+bool SurfaceCodec::encode(const vector<Vertex> &points, int width, int height, double maxError, int normalBits,
+                          int tileSize, vector<unsigned char> &out)
+{
+    if (width < 1 || height < 1 || points.size() != (size_t)width * height || !(maxError > 0.0) ||
+        (normalBits != 0 && (normalBits < 2 || normalBits > 30)) || tileSize < 1)
+        return false;
+
+    // x and z coordinates are implicit, so the grid has to be rectilinear.
+    for (int z = 0; z < height; ++z)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            const Vec3 &p = points[z * width + x].position;
+            if (p.x != points[x].position.x || p.z != points[z * width].position.z)
+                return false;
+        }
+    }
+
+    double step = 2.0 * maxError;
+    int tilesX = (width - 1) / tileSize + 1;
+    int tilesZ = (height - 1) / tileSize + 1;
+    int tiles = tilesX * tilesZ;
+    vector<vector<unsigned char> > encoded(tiles);
+    bool valid = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&&:valid)
+    for (int i = 0; i < tiles; ++i)
+    {
+        int x0 = i % tilesX * tileSize;
+        int z0 = i / tilesX * tileSize;
+        int w = min(tileSize, width - x0);
+        int h = min(tileSize, height - z0);
+        size_t samples = (size_t)w * h;
+        vector<int64_t> values(samples * (normalBits > 0 ? 3 : 1));
+        int64_t *u = values.data() + samples;
+        int64_t *v = u + samples;
+        size_t j = 0;
+        for (int z = 0; z < h; ++z)
+        {
+            for (int x = 0; x < w; ++x, ++j)
+            {
+                const Vertex &vertex = points[(size_t)(z0 + z) * width + x0 + x];
+                double q = vertex.position.y / step;
+                if (!(abs(q) < 4.0e15))
+                    valid = false;
+                values[j] = valid ? (int64_t)floor(q + 0.5) : 0;
+                if (normalBits > 0)
+                    encodeNormal(vertex.normal, normalBits, u[j], v[j]);
+            }
+        }
+        BitWriter writer(encoded[i]);
+        encodeChannel(values.data(), w, h, writer);
+        if (normalBits > 0)
+        {
+            encodeChannel(u, w, h, writer);
+            encodeChannel(v, w, h, writer);
+        }
+        writer.flush();
+    }
+    if (!valid)
+        return false;
+
+    // Header, coordinates of columns and rows, offsets of tiles and tiles themselves.
+    out.clear();
+    putBytes(out, MAGIC, 4);
+    putBytes(out, width, 4);
+    putBytes(out, height, 4);
+    putBytes(out, tileSize, 4);
+    putBytes(out, normalBits, 4);
+    uint64_t bits;
+    memcpy(&bits, &step, 8);
+    putBytes(out, bits, 8);
+    for (int x = 0; x < width; ++x)
+    {
+        memcpy(&bits, &points[x].position.x, 8);
+        putBytes(out, bits, 8);
+    }
+    for (int z = 0; z < height; ++z)
+    {
+        memcpy(&bits, &points[z * width].position.z, 8);
+        putBytes(out, bits, 8);
+    }
+    uint64_t offset = 0;
+    for (int i = 0; i < tiles; ++i)
+    {
+        putBytes(out, offset, 8);
+        offset += encoded[i].size();
+    }
+    putBytes(out, offset, 8);
+    for (int i = 0; i < tiles; ++i)
+        out.insert(out.end(), encoded[i].begin(), encoded[i].end());
+
+    return true;
+}
+
+bool SurfaceCodec::decode(const vector<unsigned char> &in, vector<Vertex> &points, int &width, int &height)
+{
+    const size_t HEADER = 28;
+    if (in.size() < HEADER || getBytes(in.data(), 4) != MAGIC)
+        return false;
+
+    int w = (int32_t)getBytes(in.data() + 4, 4);
+    int h = (int32_t)getBytes(in.data() + 8, 4);
+    int tileSize = (int32_t)getBytes(in.data() + 12, 4);
+    int normalBits = (int32_t)getBytes(in.data() + 16, 4);
+    uint64_t bits = getBytes(in.data() + 20, 8);
+    double step;
+    memcpy(&step, &bits, 8);
+    if (w < 1 || h < 1 || tileSize < 1 || (normalBits != 0 && (normalBits < 2 || normalBits > 30)))
+        return false;
+
+    // The header is not trusted, so the table sizes are checked against the input size before allocation.
+    int tilesX = (w - 1) / tileSize + 1;
+    int tilesZ = (h - 1) / tileSize + 1;
+    uint64_t tileCount = (uint64_t)tilesX * tilesZ;
+    if (tileCount >= (uint64_t)numeric_limits<int>::max() || ((uint64_t)w + h + tileCount + 1) * 8 > in.size() - HEADER)
+        return false;
+    int tiles = tileCount;
+    size_t payload = HEADER + ((size_t)w + h + tiles + 1) * 8;
+
+    vector<double> xs(w), zs(h);
+    vector<uint64_t> offsets(tiles + 1);
+    const unsigned char *p = in.data() + HEADER;
+    for (int x = 0; x < w; ++x, p += 8)
+    {
+        bits = getBytes(p, 8);
+        memcpy(&xs[x], &bits, 8);
+    }
+    for (int z = 0; z < h; ++z, p += 8)
+    {
+        bits = getBytes(p, 8);
+        memcpy(&zs[z], &bits, 8);
+    }
+    for (int i = 0; i <= tiles; ++i, p += 8)
+    {
+        offsets[i] = getBytes(p, 8);
+        if ((i > 0 && offsets[i] < offsets[i - 1]) || offsets[i] > in.size() - payload)
+            return false;
+    }
+
+    // Each sample takes at least one bit.
+    if (offsets[tiles] * 8 < (uint64_t)w * h)
+        return false;
+
+    points.resize((size_t)w * h);
+    const unsigned char *data = in.data() + payload;
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < tiles; ++i)
+    {
+        int x0 = i % tilesX * tileSize;
+        int z0 = i / tilesX * tileSize;
+        int tw = min(tileSize, w - x0);
+        int th = min(tileSize, h - z0);
+        size_t samples = (size_t)tw * th;
+        vector<int64_t> values(samples * (normalBits > 0 ? 3 : 1));
+        int64_t *u = values.data() + samples;
+        int64_t *v = u + samples;
+        BitReader reader(data + offsets[i], data + offsets[i + 1]);
+        decodeChannel(reader, tw, th, values.data());
+        if (normalBits > 0)
+        {
+            decodeChannel(reader, tw, th, u);
+            decodeChannel(reader, tw, th, v);
+        }
+        size_t j = 0;
+        for (int z = 0; z < th; ++z)
+        {
+            for (int x = 0; x < tw; ++x, ++j)
+            {
+                Vertex &vertex = points[(size_t)(z0 + z) * w + x0 + x];
+                vertex.position = Vec3(xs[x0 + x], (double)values[j] * step, zs[z0 + z]);
+                vertex.normal = normalBits > 0 ? decodeNormal(u[j], v[j], normalBits) : Vec3();
+            }
+        }
+    }
+
+    width = w;
+    height = h;
+    return true;
+}
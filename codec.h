@@ -0,0 +1,89 @@
+/**
+ * codec.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides compact binary format of sleek surfaces.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_CODEC_H__
+#define __SLEEKSURFACE_CODEC_H__
+
+#include "common.h"
+#include <cstdint>
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The SurfaceCodec static class compresses regular output grids of sleek surfaces.
+     * x and z coordinates of the grid are stored once per column and row. Heights are quantized with the given
+     * error bound, predicted from the three neighbours already decoded (Lorenzo predictor) and the residuals are
+     * Rice coded. Normals are stored in octahedral encoding coded the same way. The grid is split into square tiles
+     * coded independently, so tiles are encoded and decoded in parallel. Triangles are not stored: the grid is
+     * triangulated by <code>SurfaceBuilder::triangulateGrid</code>, so the topology is restored exactly.
+     */
+    class SurfaceCodec
+    {
+        static const uint32_t MAGIC = 0x31435353; // "SSC1".
+        static const int ESCAPE = 24;
+
+        class BitWriter;
+        class BitReader;
+
+        static void putBytes(vector<unsigned char> &out, uint64_t value, int bytes);
+        static uint64_t getBytes(const unsigned char *in, int bytes);
+        static void encodeChannel(const int64_t *values, int width, int height, BitWriter &writer);
+        static void decodeChannel(BitReader &reader, int width, int height, int64_t *values);
+        static void encodeNormal(const Vec3 &normal, int bits, int64_t &u, int64_t &v);
+        static Vec3 decodeNormal(int64_t u, int64_t v, int bits);
+
+    public:
+        /**
+         * Encode a surface.
+         *
+         * @param points - regular grid of 3D points, x coordinates have to be the same in each column
+         * and z coordinates have to be the same in each row.
+         * @param width, height - resolution of the grid.
+         * @param maxError - maximum absolute error of the decoded heights, has to be positive.
+         * @param normalBits - bits per component of octahedral encoded normals in [2; 30], or 0 to skip normals.
+         * @param tileSize - size of the independently coded tiles in points.
+         * @param out - output encoded data.
+         * @return true if the surface is encoded, false if the parameters or the grid are not supported.
+         */
+        static bool encode(const vector<Vertex> &points, int width, int height, double maxError, int normalBits,
+                           int tileSize, vector<unsigned char> &out);
+        /**
+         * Decode a surface. Tiles are decoded in parallel.
+         *
+         * @param in - data encoded by <code>encode</code>.
+         * @param points - output regular grid of 3D points. Normals are zero if they were not encoded.
+         * @param width, height - output resolution of the grid.
+         * @return true if the surface is decoded, false if the data is malformed.
+         */
+        static bool decode(const vector<unsigned char> &in, vector<Vertex> &points, int &width, int &height);
+    };
+}
+
+#endif // __SLEEKSURFACE_CODEC_H__
@@ -26,6 +26,7 @@
  */
 
 #include "common.h"
+#include <sys/mman.h>
 
 
 using namespace SleekSurface;
@@ -50,24 +51,6 @@ void Math::bicubicMatrix(double *p, double *a)
     a[15] = 0.25 * p[0] - 0.75 * p[1] + 0.75 * p[2] - 0.25 * p[3] - 0.75 * p[4] + 2.25 * p[5] - 2.25 * p[6] + 0.75 * p[7] + 0.75 * p[8] - 2.25 * p[9] + 2.25 * p[10] - 0.75 * p[11] - 0.25 * p[12] + 0.75 * p[13] - 0.75 * p[14] + 0.25 * p[15];
 }
 
-double Math::cubicInterpolate(double p0, double p1, double p2, double p3, double u)
-{
-    return p1 + 0.5 * u * (p2 - p0 + u * (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3 + u * (3.0 * (p1 - p2) + p3 - p0)));
-}
-
-double Math::bicubicInterpolate(double *a, double u, double v)
-{
-    double u2 = u * u;
-    double u3 = u2 * u;
-    double v2 = v * v;
-    double v3 = v2 * v;
-
-    return ((a[0] + a[1] * v + a[2] * v2 + a[3] * v3) +
-            (a[4] + a[5] * v + a[6] * v2 + a[7] * v3) * u +
-            (a[8] + a[9] * v + a[10] * v2 + a[11] * v3) * u2 +
-            (a[12] + a[13] * v + a[14] * v2 + a[15] * v3) * u3);
-}
-
 int Math::solveCubicEq(double a, double b, double c, double d, double *roots)
 {
     if (abs(a) > EPSILON)
@@ -186,7 +169,82 @@ void Math::calcGaussianKernel(int radius, bool shouldNormalize, vector<float> &k
     }
 }
 
+void Math::calcGaussLegendre(int n, vector<double> &nodes, vector<double> &weights)
+{
+    nodes.resize(n);
+    weights.resize(n);
+    for (int i = 0; i < (n + 1) / 2; ++i)
+    {
+        // Newton iterations for the root of Legendre polynomial on [-1; 1], starting from its asymptotic estimate.
+        double x = cos(M_PI * (i + 0.75) / (n + 0.5));
+        double dp = 1.0;
+        for (int iter = 0; iter < 100; ++iter)
+        {
+            double p0 = 1.0, p1 = x;
+            for (int k = 2; k <= n; ++k)
+            {
+                double p2 = ((2 * k - 1) * x * p1 - (k - 1) * p0) / k;
+                p0 = p1;
+                p1 = p2;
+            }
+            dp = n * (x * p1 - p0) / (x * x - 1.0);
+            double dx = p1 / dp;
+            x -= dx;
+            if (abs(dx) < 1.0e-15)
+                break;
+        }
+        double w = 1.0 / ((1.0 - x * x) * dp * dp);
+        nodes[i] = 0.5 - 0.5 * x;
+        nodes[n - 1 - i] = 0.5 + 0.5 * x;
+        weights[i] = weights[n - 1 - i] = w;
+    }
+}
+
 Vec3 Math::normal(const Vec3 &a, const Vec3 &b, const Vec3 &c)
 {
     return Vec3::cross(b - a, c - a);
 }
+
+bool GridBuffer::allocate(int _w, int _h)
+{
+    release();
+    if (_w < 1 || _h < 1)
+        return false;
+
+    // Anonymous mapping is not touched here, pages are allocated when they are written first.
+    size_t size = (size_t)_w * _h * sizeof(Vertex);
+    void *memory = MAP_FAILED;
+    if (pages == EXPLICIT_HUGE_PAGES)
+    {
+        const size_t HUGE_PAGE = 2 * 1024 * 1024;
+        size_t hugeSize = (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        memory = mmap(0, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED)
+            size = hugeSize;
+        else
+            pages = TRANSPARENT_HUGE_PAGES;
+    }
+    if (memory == MAP_FAILED)
+    {
+        memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return false;
+        if (pages == TRANSPARENT_HUGE_PAGES)
+            madvise(memory, size, MADV_HUGEPAGE);
+    }
+
+    vertices = (Vertex *)memory;
+    bytes = size;
+    w = _w;
+    h = _h;
+    return true;
+}
+
+void GridBuffer::release()
+{
+    if (vertices)
+        munmap(vertices, bytes);
+    vertices = 0;
+    bytes = 0;
+    w = h = 0;
+}
@@ -32,6 +32,16 @@
 #include <iostream>
 #include <cmath>
 
+/**
+ * Marks the hot kernels to be compiled for several instruction sets and selected at runtime according to
+ * the features of the CPU, so the portable binary runs their SIMD loops with AVX2 and AVX-512 where available.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define SLEEKSURFACE_DISPATCH __attribute__((target_clones("default", "avx2", "avx512f")))
+#else
+#define SLEEKSURFACE_DISPATCH
+#endif
+
 
 namespace SleekSurface
 {
@@ -86,7 +96,7 @@ namespace SleekSurface
          * @param u - interpolation quotient.
          * @return interpolation result.
          */
-        static double cubicInterpolate(double p0, double p1, double p2, double p3, double u);
+        inline static double cubicInterpolate(double p0, double p1, double p2, double p3, double u);
 
         /**
          * Bicubic interpolation.
@@ -96,7 +106,35 @@ namespace SleekSurface
          * @param v - vertical interpolation quotient.
          * @return interpolation result.
          */
-        static double bicubicInterpolate(double *a, double u, double v); 
+        inline static double bicubicInterpolate(double *a, double u, double v);
+
+        /**
+         * First derivative of cubic interpolation by interpolation quotient.
+         *
+         * @param p0, p1, p2, p3 - points to interpolate.
+         * @param u - interpolation quotient.
+         * @return derivative of <code>cubicInterpolate</code> result.
+         */
+        inline static double cubicDerivative(double p0, double p1, double p2, double p3, double u);
+
+        /**
+         * Second derivative of cubic interpolation by interpolation quotient.
+         *
+         * @param p0, p1, p2, p3 - points to interpolate.
+         * @param u - interpolation quotient.
+         * @return second derivative of <code>cubicInterpolate</code> result.
+         */
+        inline static double cubicSecondDerivative(double p0, double p1, double p2, double p3, double u);
+
+        /**
+         * Derivatives of bicubic interpolation.
+         *
+         * @param a - bicubic interpolation matrix created by <code>bicubicMatrix</code> call.
+         * @param u - horizontal interpolation quotient.
+         * @param v - vertical interpolation quotient.
+         * @param d - output derivatives by u, v, uu, uv and vv, 5 components.
+         */
+        inline static void bicubicDerivatives(double *a, double u, double v, double *d);
 
         /**
          * Solve in real numbers cubic equation in the form
@@ -132,6 +170,16 @@ namespace SleekSurface
          * @param kernel - array to store the kernel.
          */
         static void calcGaussianKernel(int radius, bool shouldNormalize, vector<float> &kernel);
+
+        /**
+         * Compute nodes and weights of Gauss-Legendre quadrature on [0; 1]. The quadrature of n nodes integrates
+         * polynomials of degree up to 2n - 1 exactly.
+         *
+         * @param n - number of nodes.
+         * @param nodes - output nodes in ascending order.
+         * @param weights - output weights, their sum is 1.
+         */
+        static void calcGaussLegendre(int n, vector<double> &nodes, vector<double> &weights);
         /**
          * Calculate plane normal for given unequal 3 points.
          * 
@@ -324,6 +372,301 @@ namespace SleekSurface
          */
         Vertex(const Vec3 &pos) : position(pos) {};
     };
+
+    /**
+     * The HeightField class provides read-only view of the regular grid of 3D points.
+     * The grid can be either the array of Vec3 points or the raster of heights in caller's memory.
+     * In the latter case x and z coordinates are computed from grid origin and spacing, so no copy is needed.
+     */
+    class HeightField
+    {
+    public:
+        /**
+         * Types of grid elements.
+         */
+        enum Type
+        {
+            POINTS,  // Vec3 points.
+            FLOAT32, // float heights.
+            FLOAT64, // double heights.
+            INT16    // 16-bit signed integer heights, scaled by height scale and offset.
+        };
+
+    private:
+        Type type;
+        const unsigned char *data;
+        int w, h;
+        int firstRow;
+        size_t stride;
+        double originX, originZ;
+        double stepX, stepZ;
+        double heightScale, heightOffset;
+
+        const unsigned char *element(int x, int z) const { return data + z * stride + x * elementSize(type); };
+
+    public:
+        /**
+         * HeightField constructor. Creates empty grid.
+         */
+        HeightField() : type(POINTS), data(0), w(0), h(0), firstRow(0), stride(0), originX(0.0), originZ(0.0), stepX(1.0), stepZ(1.0),
+            heightScale(1.0), heightOffset(0.0) {};
+        /**
+         * HeightField constructor.
+         *
+         * @param _type - type of grid elements.
+         * @param _data - pointer to the first element of the grid.
+         * @param _w, _h - resolution of the grid.
+         * @param _stride - distance in bytes between the starts of two neighbouring rows.
+         * @param _originX, _originZ - coordinates of the first grid element (ignored for POINTS).
+         * @param _stepX, _stepZ - distance between neighbouring grid elements (ignored for POINTS).
+         */
+        HeightField(Type _type, const void *_data, int _w, int _h, size_t _stride,
+                    double _originX = 0.0, double _originZ = 0.0, double _stepX = 1.0, double _stepZ = 1.0) :
+            type(_type), data((const unsigned char *)_data), w(_w), h(_h), firstRow(0), stride(_stride),
+            originX(_originX), originZ(_originZ), stepX(_stepX), stepZ(_stepZ), heightScale(1.0), heightOffset(0.0) {};
+
+        /**
+         * Set transformation of stored integer values to heights: y = offset + scale * value.
+         * It is applied only to INT16 grids.
+         *
+         * @param scale, offset - transformation parameters.
+         */
+        void setHeightTransform(double scale, double offset)
+        {
+            heightScale = scale;
+            heightOffset = offset;
+        };
+
+        /**
+         * Create view of the densely packed array of points.
+         *
+         * @param points - regular grid of 3D points.
+         * @param _w, _h - resolution of the grid.
+         * @return grid view.
+         */
+        static HeightField fromPoints(const Vec3 *points, int _w, int _h)
+        {
+            return HeightField(POINTS, points, _w, _h, _w * sizeof(Vec3));
+        };
+
+        /**
+         * Create view of the range of grid rows. Coordinates of its elements are exactly the same as of the
+         * corresponding elements of the whole grid.
+         *
+         * @param z0, z1 - range of rows [z0; z1).
+         * @return grid view, its row 0 is the row z0 of the grid.
+         */
+        HeightField rows(int z0, int z1) const
+        {
+            HeightField view(*this);
+            view.data = element(0, z0);
+            view.h = z1 - z0;
+            view.firstRow = firstRow + z0;
+            return view;
+        };
+
+        /**
+         * Get size of grid element.
+         *
+         * @param t - type of element.
+         * @return size of element in bytes.
+         */
+        static size_t elementSize(Type t)
+        {
+            switch (t)
+            {
+            case FLOAT32: return sizeof(float);
+            case FLOAT64: return sizeof(double);
+            case INT16: return sizeof(short);
+            default: return sizeof(Vec3);
+            }
+        };
+
+        /**
+         * Get grid resolution.
+         */
+        int width() const { return w; };
+        int height() const { return h; };
+
+        /**
+         * Get x coordinate of the grid element.
+         *
+         * @param x, z - element indices.
+         * @return x coordinate.
+         */
+        double x(int x, int z) const
+        {
+            return type == POINTS ? ((const Vec3 *)element(x, z))->x : originX + x * stepX;
+        };
+        /**
+         * Get height of the grid element.
+         *
+         * @param x, z - element indices.
+         * @return y coordinate.
+         */
+        double y(int x, int z) const
+        {
+            switch (type)
+            {
+            case FLOAT32: return *(const float *)element(x, z);
+            case FLOAT64: return *(const double *)element(x, z);
+            case INT16: return heightOffset + heightScale * *(const short *)element(x, z);
+            default: return ((const Vec3 *)element(x, z))->y;
+            }
+        };
+        /**
+         * Get z coordinate of the grid element.
+         *
+         * @param x, z - element indices.
+         * @return z coordinate.
+         */
+        double z(int x, int z) const
+        {
+            return type == POINTS ? ((const Vec3 *)element(x, z))->z : originZ + (firstRow + z) * stepZ;
+        };
+        /**
+         * Get grid element as 3D point.
+         *
+         * @param x, z - element indices.
+         * @return point.
+         */
+        Vec3 point(int x, int z) const
+        {
+            if (type == POINTS)
+                return *(const Vec3 *)element(x, z);
+            return Vec3(originX + x * stepX, y(x, z), originZ + (firstRow + z) * stepZ);
+        };
+    };
+
+    /**
+     * The GridBuffer class stores regular grid of vertices in memory which is not initialized on allocation.
+     * Memory pages are placed on the NUMA node of the thread touching them first, so the grid built in parallel
+     * is spread between the nodes of the threads building its rows. Optionally, the grid is stored in huge pages.
+     */
+    class GridBuffer
+    {
+    public:
+        /**
+         * Types of memory pages.
+         */
+        enum Pages {SMALL_PAGES, TRANSPARENT_HUGE_PAGES, EXPLICIT_HUGE_PAGES};
+
+    private:
+        Pages pages;
+        Vertex *vertices;
+        size_t bytes;
+        int w, h;
+
+        GridBuffer(const GridBuffer &);
+        GridBuffer &operator=(const GridBuffer &);
+
+    public:
+        /**
+         * GridBuffer constructor. Creates empty buffer.
+         *
+         * @param _pages - type of memory pages to allocate.
+         */
+        explicit GridBuffer(Pages _pages = SMALL_PAGES) : pages(_pages), vertices(0), bytes(0), w(0), h(0) {};
+        /**
+         * GridBuffer destructor.
+         */
+        ~GridBuffer() { release(); };
+
+        /**
+         * Allocate memory for the grid without initializing it. Explicit huge pages fall back to transparent ones
+         * if the system has no free huge pages reserved.
+         *
+         * @param _w, _h - resolution of the grid.
+         * @return true if memory is allocated, false if not.
+         */
+        bool allocate(int _w, int _h);
+        /**
+         * Release the memory.
+         */
+        void release();
+
+        /**
+         * Get type of memory pages.
+         *
+         * @return type of pages requested in constructor, or the actual type after allocation.
+         */
+        Pages getPages() const { return pages; };
+        /**
+         * Get vertices of the grid.
+         *
+         * @return pointer to the first vertex of the first row.
+         */
+        Vertex *data() { return vertices; };
+        /**
+         * Get vertices of the grid.
+         *
+         * @return pointer to the first vertex of the first row.
+         */
+        const Vertex *data() const { return vertices; };
+        /**
+         * Get grid width.
+         *
+         * @return number of vertices in the grid row.
+         */
+        int width() const { return w; };
+        /**
+         * Get grid height.
+         *
+         * @return number of vertices in the grid column.
+         */
+        int height() const { return h; };
+    };
+
+    double Math::cubicInterpolate(double p0, double p1, double p2, double p3, double u)
+    {
+        return p1 + 0.5 * u * (p2 - p0 + u * (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3 + u * (3.0 * (p1 - p2) + p3 - p0)));
+    }
+
+    double Math::bicubicInterpolate(double *a, double u, double v)
+    {
+        double u2 = u * u;
+        double u3 = u2 * u;
+        double v2 = v * v;
+        double v3 = v2 * v;
+
+        return ((a[0] + a[1] * v + a[2] * v2 + a[3] * v3) +
+                (a[4] + a[5] * v + a[6] * v2 + a[7] * v3) * u +
+                (a[8] + a[9] * v + a[10] * v2 + a[11] * v3) * u2 +
+                (a[12] + a[13] * v + a[14] * v2 + a[15] * v3) * u3);
+    }
+
+    double Math::cubicDerivative(double p0, double p1, double p2, double p3, double u)
+    {
+        return 0.5 * (p2 - p0 + u * (2.0 * (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3) + u * 3.0 * (3.0 * (p1 - p2) + p3 - p0)));
+    }
+
+    double Math::cubicSecondDerivative(double p0, double p1, double p2, double p3, double u)
+    {
+        return 2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3 + u * 3.0 * (3.0 * (p1 - p2) + p3 - p0);
+    }
+
+    void Math::bicubicDerivatives(double *a, double u, double v, double *d)
+    {
+        double u2 = u * u;
+        double v2 = v * v;
+        double v3 = v2 * v;
+
+        // Polynomials by v for each power of u and their derivatives.
+        double b[4], db[4], ddb[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            const double *r = a + i * 4;
+            b[i] = r[0] + r[1] * v + r[2] * v2 + r[3] * v3;
+            db[i] = r[1] + 2.0 * r[2] * v + 3.0 * r[3] * v2;
+            ddb[i] = 2.0 * r[2] + 6.0 * r[3] * v;
+        }
+
+        d[0] = b[1] + 2.0 * b[2] * u + 3.0 * b[3] * u2;
+        d[1] = db[0] + db[1] * u + db[2] * u2 + db[3] * u2 * u;
+        d[2] = 2.0 * b[2] + 6.0 * b[3] * u;
+        d[3] = db[1] + 2.0 * db[2] * u + 3.0 * db[3] * u2;
+        d[4] = ddb[0] + ddb[1] * u + ddb[2] * u2 + ddb[3] * u2 * u;
+    }
 }
 
 #endif // __SLEEKSURFACE_COMMON_H__
@@ -0,0 +1,833 @@
+/**
+ * conformance.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides the harness comparing all evaluation modes with the reference build on adversarial grids.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "codec.h"
+#include "partition.h"
+#include "pipeline.h"
+#include "tiles.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+
+using namespace SleekSurface;
+using namespace std;
+
+/**
+ * Adversarial input grid with uniform spacing.
+ */
+struct Dataset
+{
+    string name;
+    int width, height;
+    vector<double> heights;
+};
+
+/**
+ * Output of an evaluation mode.
+ */
+struct Output
+{
+    vector<Vertex> points;
+    int width, height;
+    bool hasNormals;
+};
+
+/**
+ * Deviation of an evaluation mode from the reference.
+ */
+struct Deviation
+{
+    double maxHeight, rmsHeight, maxNormal;
+};
+
+const double C = 2.0;
+const int LEVELS = 4;
+const int RESOLUTION = (1 << LEVELS) + 1;
+const int KERNEL_RADIUS = 2;
+// Slopes of the channels are compared sampling the patches with the resolution giving fine enough step.
+const int SLOPE_RESOLUTION = (1 << 14) + 1;
+const double SLOPE_TOLERANCE = 1.0e-2;
+// Maximum share of the output grid points where the finite differences of a derivative may not converge.
+const double MAX_UNRESOLVED = 1.0e-3;
+const int DERIVATIVE_COUNT = 5;
+const int FD_STEPS = 4;
+const int FD_OFFSETS = 10;
+// Offsets of the finite difference samples in steps h, and their indices for 0, h, 2h, 3h with the steps h, 2h, 4h, 8h.
+const int FD_OFFSET[FD_OFFSETS] = {0, 1, 2, 3, 4, 6, 8, 12, 16, 24};
+const int FD_STENCIL[FD_STEPS][4] = {{0, 1, 2, 3}, {0, 2, 4, 5}, {0, 4, 6, 7}, {0, 6, 8, 9}};
+
+Dataset makeDataset(const string &name, int w, int h, const function<double(int, int)> &f)
+{
+    Dataset d;
+    d.name = name;
+    d.width = w;
+    d.height = h;
+    d.heights.resize(w * h);
+    for (int z = 0; z < h; ++z)
+    {
+        for (int x = 0; x < w; ++x)
+            d.heights[z * w + x] = f(x, z);
+    }
+    return d;
+}
+
+void makeDatasets(vector<Dataset> &datasets)
+{
+    const int w = 97;
+    const int h = 81;
+    srand(12345);
+    vector<double> noise(w * h);
+    for (int i = 0; i < w * h; ++i)
+        noise[i] = (double)rand() / RAND_MAX;
+
+    // Wide flat areas with a raised plateau: all the tangents inside are zero.
+    datasets.push_back(makeDataset("plateaus", w, h, [](int x, int z)
+    {
+        return (x > 20 && x < 60 && z > 15 && z < 50) ? 3.0 : ((x / 8 + z / 8) % 3 == 0 ? 1.0 : 0.0);
+    }));
+    // Terraces with sharp steps between them.
+    datasets.push_back(makeDataset("steps", w, h, [](int x, int z)
+    {
+        return (double)((x + 2 * z) / 7) * 0.75;
+    }));
+    // Differences near Math::EPSILON, so the tangents are on the edge of being considered zero.
+    datasets.push_back(makeDataset("near-zero tangents", w, h, [&noise, w](int x, int z)
+    {
+        return (x + z) * 1.0e-5 + noise[z * w + x] * 2.0e-5;
+    }));
+    // Long collinear runs with kinks, some of them rising and some falling.
+    datasets.push_back(makeDataset("collinear runs", w, h, [](int x, int z)
+    {
+        return abs((x % 24) - 12) * 0.5 + (z % 16 < 8 ? z * 0.25 : 4.0 - z * 0.25);
+    }));
+    // Isolated spikes and pits over noise.
+    datasets.push_back(makeDataset("spikes", w, h, [&noise, w](int x, int z)
+    {
+        double spike = (x * 7 + z * 13) % 29 == 0 ? 10.0 : ((x * 11 + z * 5) % 31 == 0 ? -10.0 : 0.0);
+        return spike + noise[z * w + x];
+    }));
+}
+
+double seconds(const chrono::steady_clock::time_point &start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void addNormals(Output &out)
+{
+    vector<float> kernel;
+    vector<Vertex> smoothed;
+    SurfaceBuilder::computeGridNormals(out.points, out.width, out.height);
+    Math::calcGaussianKernel(KERNEL_RADIUS, false, kernel);
+    SurfaceBuilder::smoothNormalsWithKernel(out.points, out.width, out.height, kernel, KERNEL_RADIUS, smoothed);
+    out.points.swap(smoothed);
+    out.hasNormals = true;
+}
+
+Deviation compare(const Output &reference, const Output &out)
+{
+    Deviation d = {0.0, 0.0, 0.0};
+    if (reference.width != out.width || reference.height != out.height)
+    {
+        d.maxHeight = d.rmsHeight = d.maxNormal = 1.0e300;
+        return d;
+    }
+
+    double sum = 0.0;
+    for (int i = 0, n = out.points.size(); i < n; ++i)
+    {
+        const Vec3 &a = reference.points[i].position;
+        const Vec3 &b = out.points[i].position;
+        double e = abs(a.y - b.y);
+        if (a.x != b.x || a.z != b.z || e != e)
+            e = 1.0e300;
+        d.maxHeight = max(d.maxHeight, e);
+        sum += e * e;
+        if (reference.hasNormals && out.hasNormals)
+        {
+            const Vec3 &na = reference.points[i].normal;
+            const Vec3 &nb = out.points[i].normal;
+            Vec3 cross = Vec3::cross(na, nb);
+            double sine = sqrt(cross.x * cross.x + cross.y * cross.y + cross.z * cross.z);
+            d.maxNormal = max(d.maxNormal, atan2(sine, na.x * nb.x + na.y * nb.y + na.z * nb.z));
+        }
+    }
+    d.rmsHeight = sqrt(sum / out.points.size());
+    return d;
+}
+
+/**
+ * Check that the surface has no misplaced extremes: along the row and column curves passing through
+ * the input points, the surface between two neighbouring input points stays within their heights.
+ */
+int countMisplacedExtremes(const Dataset &d, const Output &out, double tolerance, double &overshoot)
+{
+    int r = RESOLUTION - 1;
+    int count = 0;
+    overshoot = 0.0;
+    for (int z = 0; z < d.height; ++z)
+    {
+        for (int x = 0; x < d.width; ++x)
+        {
+            double y = d.heights[z * d.width + x];
+            if (x + 1 < d.width)
+            {
+                double y1 = d.heights[z * d.width + x + 1];
+                for (int i = 1; i < r; ++i)
+                {
+                    double v = out.points[z * r * out.width + x * r + i].position.y;
+                    overshoot = max(overshoot, max(min(y, y1) - v, v - max(y, y1)));
+                    if (v < min(y, y1) - tolerance || v > max(y, y1) + tolerance)
+                        ++count;
+                }
+            }
+            if (z + 1 < d.height)
+            {
+                double y1 = d.heights[(z + 1) * d.width + x];
+                for (int i = 1; i < r; ++i)
+                {
+                    double v = out.points[(z * r + i) * out.width + x * r].position.y;
+                    overshoot = max(overshoot, max(min(y, y1) - v, v - max(y, y1)));
+                    if (v < min(y, y1) - tolerance || v > max(y, y1) + tolerance)
+                        ++count;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+bool runMode(const Dataset &d, const Output &reference, double referenceTime, const char *mode, double tolerance,
+             const function<bool(Output &out)> &build)
+{
+    Output out;
+    out.hasNormals = false;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool built = build(out);
+    double time = seconds(start);
+
+    // Misplaced extremes are checked with the tolerance of the mode, as the input is the same for all the modes.
+    double range = 0.0;
+    for (int i = 0, n = d.heights.size(); i < n; ++i)
+        range = max(range, abs(d.heights[i]));
+    Deviation dev = built ? compare(reference, out) : Deviation();
+    // Tangents shorter than Math::EPSILON are not distinguished from zero ones by the curve builder,
+    // so the curves may overshoot by a fraction of it, which is not considered an extreme.
+    double slack = range * 1.0e-12;
+    double overshoot = 0.0;
+    int extremes = built ? countMisplacedExtremes(d, out, tolerance + slack + Math::EPSILON, overshoot) : 0;
+    bool passed = built && dev.maxHeight <= tolerance + slack && extremes == 0 &&
+                  (!reference.hasNormals || !out.hasNormals || dev.maxNormal <= 1.0e-3 + tolerance);
+    if (built)
+    {
+        printf("  %-18s max %-9.3g rms %-9.3g normal %-9.3g overshoot %-9.3g extremes %-5d speedup %-6.2f %s\n",
+               mode, dev.maxHeight, dev.rmsHeight, dev.maxNormal, max(overshoot, 0.0), extremes, referenceTime / time,
+               passed ? "ok" : "FAIL");
+    }
+    else
+        printf("  %-18s build failed FAIL\n", mode);
+    return passed;
+}
+
+/**
+ * Compute and smooth the normals vertex by vertex over the vertices in AoS layout, the same way as
+ * <code>addNormals</code> does in SIMD lanes.
+ */
+void addScalarNormals(Output &out)
+{
+    int w = out.width, h = out.height;
+    vector<Vertex> &v = out.points;
+    for (int z = 0; z < h; ++z)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            const Vec3 &p = v[z * w + x].position;
+            Vec3 normal;
+            if (x > 0 && z > 0)
+                normal = normal + Math::normal(v[z * w + x - 1].position, p, v[(z - 1) * w + x].position);
+            if (x < w - 1 && z > 0)
+            {
+                normal = normal + Math::normal(v[(z - 1) * w + x + 1].position, v[(z - 1) * w + x].position, p);
+                normal = normal + Math::normal(p, v[z * w + x + 1].position, v[(z - 1) * w + x + 1].position);
+            }
+            if (x > 0 && z < h - 1)
+            {
+                normal = normal + Math::normal(p, v[z * w + x - 1].position, v[(z + 1) * w + x - 1].position);
+                normal = normal + Math::normal(v[(z + 1) * w + x - 1].position, v[(z + 1) * w + x].position, p);
+            }
+            if (x < w - 1 && z < h - 1)
+                normal = normal + Math::normal(v[z * w + x + 1].position, p, v[(z + 1) * w + x].position);
+            normal.normalize();
+            v[z * w + x].normal = normal;
+        }
+    }
+
+    vector<float> kernel;
+    Math::calcGaussianKernel(KERNEL_RADIUS, false, kernel);
+    int n = KERNEL_RADIUS * 2 + 1;
+    vector<Vertex> smoothed(v.size());
+    for (int z = 0; z < h; ++z)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            Vec3 normal;
+            for (int i = -KERNEL_RADIUS; i < KERNEL_RADIUS; ++i)
+            {
+                for (int j = -KERNEL_RADIUS; j < KERNEL_RADIUS; ++j)
+                {
+                    if (x + j >= 0 && x + j < w && z + i >= 0 && z + i < h)
+                        normal = normal + v[(z + i) * w + x + j].normal *
+                                 (double)kernel[(i + KERNEL_RADIUS) * n + j + KERNEL_RADIUS];
+                }
+            }
+            normal.normalize();
+            smoothed[z * w + x].position = v[z * w + x].position;
+            smoothed[z * w + x].normal = normal;
+        }
+    }
+    v.swap(smoothed);
+    out.hasNormals = true;
+}
+
+/**
+ * Check that the normals computed in SIMD lanes are bit-identical to the scalar ones and report the speedup
+ * of the SIMD kernels over the scalar code.
+ */
+bool runNormals(const Output &reference)
+{
+    Output scalar = reference, lanes = reference;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    addScalarNormals(scalar);
+    double scalarTime = seconds(start);
+    start = chrono::steady_clock::now();
+    addNormals(lanes);
+    double time = seconds(start);
+
+    int mismatches = 0;
+    for (int i = 0, n = scalar.points.size(); i < n; ++i)
+    {
+        const Vec3 &a = scalar.points[i].normal;
+        const Vec3 &b = lanes.points[i].normal;
+        if (memcmp(&a, &b, sizeof(Vec3)) != 0)
+            ++mismatches;
+    }
+    bool passed = mismatches == 0;
+    printf("  %-18s mismatches %-5d speedup %-6.2f %s\n", "simd normals", mismatches, scalarTime / time,
+           passed ? "ok" : "FAIL");
+    return passed;
+}
+
+double segmentDeviation(const Segment &reference, const Segment &segment, int &extremes)
+{
+    double deviation = 0.0;
+    for (int i = 0; i < 4; ++i)
+        deviation = max(deviation, max(abs(reference.points[i].x - segment.points[i].x), abs(reference.points[i].y - segment.points[i].y)));
+
+    double y0 = min(reference.points[0].y, reference.points[3].y);
+    double y1 = max(reference.points[0].y, reference.points[3].y);
+    for (int i = 1; i < 64; ++i)
+    {
+        double y = reference.calc(i / 64.0, true).y;
+        if (y < y0 - Math::EPSILON || y > y1 + Math::EPSILON)
+            ++extremes;
+    }
+    return deviation;
+}
+
+bool runCurves(const Dataset &d)
+{
+    // Reference curves by CurveBuilder::build against the streaming builder, row by row.
+    double maxDeviation = 0.0;
+    int extremes = 0;
+    vector<Vec2> values(d.width);
+    vector<Segment> reference(d.width - 1);
+    for (int z = 0; z < d.height; ++z)
+    {
+        for (int x = 0; x < d.width; ++x)
+            values[x] = Vec2(x, d.heights[z * d.width + x]);
+        if (!CurveBuilder::build(values, reference.data(), C))
+            return false;
+
+        StreamingCurveBuilder streaming(C);
+        Segment segment;
+        int n = 0;
+        for (int x = 0; x < d.width; ++x)
+        {
+            if (streaming.push(values[x], segment))
+                maxDeviation = max(maxDeviation, segmentDeviation(reference[n++], segment, extremes));
+        }
+        if (streaming.finish(segment))
+            maxDeviation = max(maxDeviation, segmentDeviation(reference[n++], segment, extremes));
+    }
+    bool passed = maxDeviation == 0.0 && extremes == 0;
+    printf("  %-18s max %-9.3g extremes %-5d %s\n", "streaming curves", maxDeviation, extremes, passed ? "ok" : "FAIL");
+    return passed;
+}
+
+/**
+ * Calculate one-sided finite differences of the second order of dx, dz, dxx, dxz, dzz with the steps h, 2h, 4h, 8h.
+ *
+ * @param y - heights sampled at the offsets FD_OFFSET along x (consecutive) and along z (by the stride).
+ * @param stride - distance between the samples along z.
+ * @param hx, hz - signed steps h along x and z.
+ * @param fd - output differences.
+ */
+void calcDifferences(const double *y, int stride, double hx, double hz, double fd[DERIVATIVE_COUNT][FD_STEPS])
+{
+    for (int k = 0; k < FD_STEPS; ++k)
+    {
+        const int *o = FD_STENCIL[k];
+        double mx = hx * FD_OFFSET[o[1]];
+        double mz = hz * FD_OFFSET[o[1]];
+        double dz[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            const double *c = y + o[a];
+            dz[a] = (-1.5 * c[0] + 2.0 * c[o[1] * stride] - 0.5 * c[o[2] * stride]) / mz;
+        }
+        fd[0][k] = (-1.5 * y[0] + 2.0 * y[o[1]] - 0.5 * y[o[2]]) / mx;
+        fd[1][k] = dz[0];
+        fd[2][k] = (2.0 * y[0] - 5.0 * y[o[1]] + 4.0 * y[o[2]] - y[o[3]]) / (mx * mx);
+        fd[3][k] = (-1.5 * dz[0] + 2.0 * dz[1] - 0.5 * dz[2]) / mx;
+        fd[4][k] = (2.0 * y[0] - 5.0 * y[o[1] * stride] + 4.0 * y[o[2] * stride] - y[o[3] * stride]) / (mz * mz);
+    }
+}
+
+/**
+ * Test if the analytic derivative agrees with its finite differences: the deviation from the difference with
+ * the step h must be within four times its difference from the one with the step 2h, plus the relative allowance
+ * of Math::EPSILON, as the heights are found by the cubic solver dropping terms below it.
+ * The bound only holds where the differences are in their asymptotic range, i.e. each halving of the step
+ * divides the difference between the successive ones by about four.
+ *
+ * @param value - analytic derivative.
+ * @param fd - differences with the steps h, 2h, 4h, 8h.
+ * @param deviation - output deviation from the difference with the step h.
+ * @param converged - output flag determining if the differences are in their asymptotic range (true) or not (false).
+ * @return true if the derivative agrees, false if not.
+ */
+bool checkDerivative(double value, const double *fd, double &deviation, bool &converged)
+{
+    double e1 = fd[0] - fd[1];
+    double e2 = fd[1] - fd[2];
+    double e3 = fd[2] - fd[3];
+    double r1 = e2 / e1, r2 = e3 / e2;
+    converged = r1 >= 3.0 && r1 <= 5.5 && r2 >= 3.0 && r2 <= 5.5;
+    deviation = abs(value - fd[0]);
+    return deviation <= Math::EPSILON * (1.0 + abs(fd[0])) + 4.0 * abs(e1);
+}
+
+/**
+ * Check the analytic derivatives against finite differences of the reference surface. The output grid step is
+ * too coarse for the adversarial surfaces, so the patches are sampled around each grid point with a finer step,
+ * one-sided within the patch owning the point: points on the seams belong to the patch to the right and below,
+ * the last row and column to the patch to the left and above.
+ * The derivative fails if it does not agree with the differences in their asymptotic range. Around the end points
+ * of curves with short or zero-length handles the surface changes faster than the step can resolve (it grows as
+ * a power 3/2 of the distance for zero-length handles, so the second derivatives are unbounded), and the cubic
+ * solver does not allow smaller steps, so the points where the differences do not converge are only counted,
+ * and the derivative fails if they are more than MAX_UNRESOLVED of the grid. The reported deviation is the maximum
+ * over all the points, relative to the magnitude of the derivative, so it includes the unresolved ones too.
+ */
+bool runDerivatives(const HeightField &field, const Output &reference, const SurfaceDerivatives &derivatives)
+{
+    const double STEP = 1.0e-4;
+    const int n = RESOLUTION - 1;
+    const char *names[DERIVATIVE_COUNT] = {"dx", "dz", "dxx", "dxz", "dzz"};
+    const vector<double> *values[DERIVATIVE_COUNT] =
+    {
+        &derivatives.dx, &derivatives.dz, &derivatives.dxx, &derivatives.dxz, &derivatives.dzz
+    };
+    SurfaceModel model;
+    if (!SurfaceBuilder::prepare(field, C, model))
+        return false;
+
+    double maxDeviation[DERIVATIVE_COUNT] = {0.0};
+    int failures[DERIVATIVE_COUNT] = {0};
+    int unresolved[DERIVATIVE_COUNT] = {0};
+    vector<double> t, q, y;
+    for (int cz = 0; cz < field.height() - 1; ++cz)
+    {
+        for (int cx = 0; cx < field.width() - 1; ++cx)
+        {
+            int nx = cx == field.width() - 2 ? n + 1 : n;
+            int nz = cz == field.height() - 2 ? n + 1 : n;
+            t.resize(nx * FD_OFFSETS);
+            q.resize(nz * FD_OFFSETS);
+            for (int i = 0; i < nx; ++i)
+            {
+                for (int k = 0; k < FD_OFFSETS; ++k)
+                    t[i * FD_OFFSETS + k] = (double)i / n + (i == n ? -1 : 1) * FD_OFFSET[k] * STEP;
+            }
+            for (int j = 0; j < nz; ++j)
+            {
+                for (int k = 0; k < FD_OFFSETS; ++k)
+                    q[j * FD_OFFSETS + k] = (double)j / n + (j == n ? -1 : 1) * FD_OFFSET[k] * STEP;
+            }
+            y.resize(t.size() * q.size());
+            SurfaceBuilder::evaluateHeights(model, cx, cz, t.data(), t.size(), q.data(), q.size(), y.data());
+
+            double sx = field.x(cx + 1, cz) - field.x(cx, cz);
+            double sz = field.z(cx, cz + 1) - field.z(cx, cz);
+            for (int j = 0; j < nz; ++j)
+            {
+                for (int i = 0; i < nx; ++i)
+                {
+                    double hx = (i == n ? -STEP : STEP) * sx;
+                    double hz = (j == n ? -STEP : STEP) * sz;
+                    double fd[DERIVATIVE_COUNT][FD_STEPS];
+                    calcDifferences(&y[j * FD_OFFSETS * t.size() + i * FD_OFFSETS], t.size(), hx, hz, fd);
+                    int index = (cz * n + j) * reference.width + cx * n + i;
+                    for (int d = 0; d < DERIVATIVE_COUNT; ++d)
+                    {
+                        double deviation;
+                        bool converged;
+                        bool agrees = checkDerivative((*values[d])[index], fd[d], deviation, converged);
+                        maxDeviation[d] = max(maxDeviation[d], deviation / (1.0 + abs(fd[d][0])));
+                        if (agrees)
+                            continue;
+                        if (converged)
+                            ++failures[d];
+                        else
+                            ++unresolved[d];
+                    }
+                }
+            }
+        }
+    }
+
+    bool passed = true;
+    int maxUnresolved = (int)(MAX_UNRESOLVED * reference.width * reference.height);
+    for (int d = 0; d < DERIVATIVE_COUNT; ++d)
+    {
+        bool ok = failures[d] == 0 && unresolved[d] <= maxUnresolved;
+        printf("  %-18s max %-9.3g unresolved %-5d failures %-5d %s\n", (string("derivative ") + names[d]).c_str(),
+               maxDeviation[d], unresolved[d], failures[d], ok ? "ok" : "FAIL");
+        passed = passed && ok;
+    }
+    return passed;
+}
+
+/**
+ * Calculate one-sided slopes of the channel along the rows and columns through each input point, sampling the
+ * surface with a fine step around it. Slopes are second order one-sided differences on both sides of the point.
+ *
+ * @param model - surface model.
+ * @param channel - index of the model channel to sample, or -1 to sample heights.
+ * @param slopes - output slopes, four per input point: left, right, above, below.
+ */
+void calcSlopes(const SurfaceModel &model, int channel, vector<double> &slopes)
+{
+    const int r = SLOPE_RESOLUTION - 1;
+    const HeightField &field = model.grid();
+    int w = field.width(), h = field.height();
+    vector<Vertex> points(5 * 5);
+    vector<double> values(5 * 5);
+    vector<double *> outChannels(max(channel + 1, 1), (double *)0);
+    if (channel >= 0)
+        outChannels[channel] = values.data();
+    slopes.assign(w * h * 4, 0.0);
+    for (int z = 0; z < h; ++z)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            int x0 = max(x * r - 2, 0), x1 = min(x * r + 2, (w - 1) * r);
+            int z0 = max(z * r - 2, 0), z1 = min(z * r + 2, (h - 1) * r);
+            SurfaceBuilder::evaluate(model, SLOPE_RESOLUTION, x0, z0, x1 - x0 + 1, z1 - z0 + 1, points.data(), 5,
+                                     outChannels.data());
+            const double *y = channel >= 0 ? values.data() : 0;
+            int cx = x * r - x0, cz = z * r - z0;
+            double hx = (field.x(min(x + 1, w - 1), z) - field.x(max(x - 1, 0), z)) / ((min(x + 1, w - 1) - max(x - 1, 0)) * r);
+            double hz = (field.z(x, min(z + 1, h - 1)) - field.z(x, max(z - 1, 0))) / ((min(z + 1, h - 1) - max(z - 1, 0)) * r);
+            auto at = [&](int i, int j) { return y ? y[j * 5 + i] : points[j * 5 + i].position.y; };
+            double *s = &slopes[(z * w + x) * 4];
+            if (x > 0)
+                s[0] = (3.0 * at(cx, cz) - 4.0 * at(cx - 1, cz) + at(cx - 2, cz)) / (2.0 * hx);
+            if (x < w - 1)
+                s[1] = (-3.0 * at(cx, cz) + 4.0 * at(cx + 1, cz) - at(cx + 2, cz)) / (2.0 * hx);
+            if (z > 0)
+                s[2] = (3.0 * at(cx, cz) - 4.0 * at(cx, cz - 1) + at(cx, cz - 2)) / (2.0 * hz);
+            if (z < h - 1)
+                s[3] = (-3.0 * at(cx, cz) + 4.0 * at(cx, cz + 1) - at(cx, cz + 2)) / (2.0 * hz);
+        }
+    }
+}
+
+/**
+ * Check the channels interpolated by <code>buildChannels</code> against separate builds of each channel as heights.
+ * A channel equal to the heights has to reproduce them exactly. Another channel only has its handles moved along
+ * the tangents, so it has to pass through the input points with the same slopes on both sides of each of them
+ * as its separate build and to have no misplaced extremes, while it differs between the input points.
+ */
+bool runChannels(const Dataset &d, const Dataset &other, const Output &reference, double referenceTime)
+{
+    HeightField field(HeightField::FLOAT64, d.heights.data(), d.width, d.height, d.width * sizeof(double));
+    HeightField otherField(HeightField::FLOAT64, other.heights.data(), d.width, d.height, d.width * sizeof(double));
+    vector<HeightField> channels;
+    channels.push_back(field);
+    channels.push_back(otherField);
+
+    Output out;
+    vector<vector<double> > outChannels;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!SurfaceBuilder::buildChannels(field, channels, RESOLUTION, C, out.points, outChannels, out.width, out.height))
+    {
+        printf("  %-18s build failed FAIL\n", "channel values");
+        return false;
+    }
+    double time = seconds(start);
+
+    Output own, shared;
+    SurfaceBuilder::build(otherField, RESOLUTION, C, own.points, own.width, own.height);
+    own.hasNormals = shared.hasNormals = false;
+    shared.points = own.points;
+    shared.width = own.width;
+    shared.height = own.height;
+    double exact = 0.0;
+    for (int i = 0, n = out.points.size(); i < n; ++i)
+    {
+        exact = max(exact, max(abs(out.points[i].position.y - reference.points[i].position.y),
+                               abs(outChannels[0][i] - reference.points[i].position.y)));
+        shared.points[i].position.y = outChannels[1][i];
+    }
+    Deviation dev = compare(own, shared);
+    double overshoot;
+    double range = 0.0;
+    for (int i = 0, n = other.heights.size(); i < n; ++i)
+        range = max(range, abs(other.heights[i]));
+    int extremes = countMisplacedExtremes(other, shared, range * 1.0e-12 + Math::EPSILON, overshoot);
+
+    SurfaceModel ownModel, sharedModel;
+    vector<double> ownSlopes, sharedSlopes;
+    SurfaceBuilder::prepare(otherField, C, ownModel);
+    SurfaceBuilder::prepare(field, channels, C, sharedModel);
+    calcSlopes(ownModel, -1, ownSlopes);
+    calcSlopes(sharedModel, 1, sharedSlopes);
+    double slope = 0.0;
+    for (int i = 0, n = ownSlopes.size(); i < n; ++i)
+        slope = max(slope, abs(ownSlopes[i] - sharedSlopes[i]) / (1.0 + abs(ownSlopes[i])));
+
+    bool passed = exact == 0.0 && extremes == 0 && slope <= SLOPE_TOLERANCE;
+    printf("  %-18s max %-9.3g rms %-9.3g heights %-9.3g slope %-9.3g overshoot %-9.3g extremes %-5d speedup %-6.2f %s\n",
+           "channel values", dev.maxHeight, dev.rmsHeight, exact, slope, max(overshoot, 0.0), extremes, referenceTime / time,
+           passed ? "ok" : "FAIL");
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    vector<Dataset> datasets;
+    makeDatasets(datasets);
+    Executor executor(2);
+    bool passed = true;
+
+    for (size_t k = 0; k < datasets.size(); ++k)
+    {
+        const Dataset &d = datasets[k];
+        HeightField field(HeightField::FLOAT64, d.heights.data(), d.width, d.height, d.width * sizeof(double));
+        double range = 0.0;
+        for (int i = 0, n = d.heights.size(); i < n; ++i)
+            range = max(range, abs(d.heights[i]));
+        printf("%s (%dx%d, resolution %d)\n", d.name.c_str(), d.width, d.height, RESOLUTION);
+
+        Output reference;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        SurfaceBuilder::build(field, RESOLUTION, C, reference.points, reference.width, reference.height);
+        addNormals(reference);
+        double referenceTime = seconds(start);
+        int w = reference.width;
+        int h = reference.height;
+
+        passed = runCurves(d) && passed;
+        passed = runNormals(reference) && passed;
+
+        vector<float> floatHeights(d.heights.begin(), d.heights.end());
+        passed = runMode(d, reference, referenceTime, "float32 input", 1.0e-5 * max(1.0, range), [&](Output &out)
+        {
+            HeightField floatField(HeightField::FLOAT32, floatHeights.data(), d.width, d.height, d.width * sizeof(float));
+            if (!SurfaceBuilder::build(floatField, RESOLUTION, C, out.points, out.width, out.height))
+                return false;
+            addNormals(out);
+            return true;
+        }) && passed;
+
+        passed = runMode(d, reference, referenceTime, "region evaluate", 0.0, [&](Output &out)
+        {
+            const int size = 61;
+            SurfaceModel model;
+            if (!SurfaceBuilder::prepare(field, C, model))
+                return false;
+            out.width = w;
+            out.height = h;
+            out.points.resize(w * h);
+            for (int z = 0; z < h; z += size)
+            {
+                for (int x = 0; x < w; x += size)
+                    SurfaceBuilder::evaluate(model, RESOLUTION, x, z, min(size, w - x), min(size, h - z),
+                                             out.points.data() + z * w + x, w);
+            }
+            addNormals(out);
+            return true;
+        }) && passed;
+
+        passed = runMode(d, reference, referenceTime, "parallel build", 0.0, [&](Output &out)
+        {
+            GridBuffer buffer;
+            if (!SurfaceBuilder::build(field, RESOLUTION, C, KERNEL_RADIUS, buffer))
+                return false;
+            out.width = buffer.width();
+            out.height = buffer.height();
+            out.points.assign(buffer.data(), buffer.data() + out.width * out.height);
+            out.hasNormals = true;
+            return true;
+        }) && passed;
+
+        passed = runMode(d, reference, referenceTime, "fused tiles", 0.0, [&](Output &out)
+        {
+            GridBuffer buffer;
+            if (!SurfaceBuilder::buildFused(field, RESOLUTION, C, KERNEL_RADIUS, 23, buffer))
+                return false;
+            out.width = buffer.width();
+            out.height = buffer.height();
+            out.points.assign(buffer.data(), buffer.data() + out.width * out.height);
+            out.hasNormals = true;
+            return true;
+        }) && passed;
+
+        passed = runMode(d, reference, referenceTime, "banded", 0.0, [&](Output &out)
+        {
+            out.width = w;
+            out.height = h;
+            out.points.resize(w * h);
+            if (!SurfaceBuilder::buildBanded(field, RESOLUTION, C, 5, [&out](int z, int rows, const Vertex *points)
+                {
+                    copy(points, points + rows * out.width, out.points.begin() + z * out.width);
+                    return true;
+                }))
+                return false;
+            addNormals(out);
+            return true;
+        }) && passed;
+
+        passed = runMode(d, reference, referenceTime, "async chunks", 0.0, [&](Output &out)
+        {
+            out.width = w;
+            out.height = h;
+            out.points.resize(w * h);
+            future<bool> result = AsyncSurfaceBuilder::build(executor, field, RESOLUTION, C, KERNEL_RADIUS, 7,
+                [&out](const SurfaceChunk &chunk)
+                {
+                    copy(chunk.vertices.begin(), chunk.vertices.end(), out.points.begin() + chunk.z0 * chunk.width);
+                });
+            out.hasNormals = true;
+            return result.get();
+        }) && passed;
+
+        passed = runMode(d, reference, referenceTime, "partitioned", 0.0, [&](Output &out)
+        {
+            out.hasNormals = true;
+            return PartitionedBuilder::build(field, RESOLUTION, C, KERNEL_RADIUS, 3, 2, 2, out.points, out.width, out.height);
+        }) && passed;
+
+        TileProvider provider;
+        const int tileSize = 16;
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            // The second pass takes the tiles from the cache.
+            passed = runMode(d, reference, referenceTime, pass == 0 ? "tiles" : "cached tiles", 0.0, [&](Output &out)
+            {
+                int nx, nz;
+                if ((pass == 0 && !provider.init(field, C, tileSize, KERNEL_RADIUS, (size_t)1 << 30)) ||
+                    !provider.getTileCount(LEVELS, nx, nz))
+                    return false;
+                out.width = w;
+                out.height = h;
+                out.points.resize(w * h);
+                for (int tz = 0; tz < nz; ++tz)
+                {
+                    for (int tx = 0; tx < nx; ++tx)
+                    {
+                        shared_ptr<const SurfaceTile> tile = provider.getTile(LEVELS, tx, tz);
+                        if (!tile)
+                            return false;
+                        for (int z = 0; z < tile->height; ++z)
+                            copy(tile->vertices.begin() + z * tile->width, tile->vertices.begin() + (z + 1) * tile->width,
+                                 out.points.begin() + (tile->z0 + z) * w + tile->x0);
+                    }
+                }
+                out.hasNormals = true;
+                return true;
+            }) && passed;
+        }
+
+        passed = runMode(d, reference, referenceTime, "progressive", 0.0, [&](Output &out)
+        {
+            if (!ProgressiveSurfaceBuilder::build(field, LEVELS, C, 0.0, [](int, int, int) { return true; },
+                                                  out.points, out.width, out.height))
+                return false;
+            addNormals(out);
+            return true;
+        }) && passed;
+
+        SurfaceDerivatives derivatives;
+        passed = runMode(d, reference, referenceTime, "derivatives", 0.0, [&](Output &out)
+        {
+            if (!SurfaceBuilder::buildWithDerivatives(field, RESOLUTION, C, out.points, derivatives, out.width, out.height))
+                return false;
+            addNormals(out);
+            return true;
+        }) && passed;
+        passed = runDerivatives(field, reference, derivatives) && passed;
+
+        passed = runMode(d, reference, referenceTime, "channels", 0.0, [&](Output &out)
+        {
+            vector<HeightField> channels(1, field);
+            vector<vector<double> > outChannels;
+            if (!SurfaceBuilder::buildChannels(field, channels, RESOLUTION, C, out.points, outChannels, out.width, out.height))
+                return false;
+            addNormals(out);
+            return true;
+        }) && passed;
+        passed = runChannels(d, datasets[(k + 1) % datasets.size()], reference, referenceTime) && passed;
+
+        const double maxError = 1.0e-6 * max(1.0, range);
+        passed = runMode(d, reference, referenceTime, "codec", maxError, [&](Output &out)
+        {
+            vector<unsigned char> data;
+            out.hasNormals = true;
+            return SurfaceCodec::encode(reference.points, w, h, maxError, 16, 64, data) &&
+                   SurfaceCodec::decode(data, out.points, out.width, out.height);
+        }) && passed;
+    }
+
+    printf(passed ? "All modes conform.\n" : "Some modes do not conform.\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,308 @@
+/**
+ * contour.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides functions to extract isolines of sleek surfaces.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "contour.h"
+#include <unordered_map>
+
+
+using namespace SleekSurface;
+
+// Edges of the quad are walked from left to right and from top to bottom: top, right, bottom and left one.
+static const int EDGE_FIRST[4] = {0, 1, 3, 0};
+static const int EDGE_SECOND[4] = {1, 2, 2, 3};
+static const int EDGE_DX[4] = {0, 1, 0, 0};
+static const int EDGE_DZ[4] = {0, 0, 1, 0};
+
+/**
+ * Segment of the isoline within one quad, its ends are keyed by the global quad edges they lie on.
+ */
+class ContourBuilder::Piece
+{
+public:
+    long long keys[2];
+    Vec3 points[2];
+};
+
+void ContourBuilder::findCrossing(const SurfaceModel &model, int subdivisions, int x, int z, bool horizontal,
+                                  double v0, double v1, double level, Vec3 &point)
+{
+    const HeightField &field = model.grid();
+    int n = subdivisions;
+    // The edge is evaluated in the cell owning its first node, as the output samples are.
+    int cx = min(x / n, field.width() - 1);
+    int cz = min(z / n, field.height() - 1);
+    double t0 = (double)(x - cx * n) / n;
+    double q0 = (double)(z - cz * n) / n;
+    double a = 0.0, b = 1.0;
+    double fa = v0 - level, fb = v1 - level;
+    double s = fa == 0.0 ? 0.0 : 1.0;
+    int side = 0;
+    // Illinois variant of the regular falsi keeps the bracket and converges superlinearly.
+    for (int i = 0; i < 64 && fa != 0.0 && fb != 0.0 && b - a > TOLERANCE; ++i)
+    {
+        s = (a * fb - b * fa) / (fb - fa);
+        if (!(s > a && s < b))
+            s = 0.5 * (a + b);
+        double y;
+        if (!SurfaceBuilder::evaluateHeight(model, cx, cz, horizontal ? t0 + s / n : t0, horizontal ? q0 : q0 + s / n, y))
+            break;
+        double fs = y - level;
+        if (abs(fs) <= TOLERANCE * (1.0 + abs(level)))
+            break;
+        if ((fs >= 0.0) == (fb >= 0.0))
+        {
+            b = s;
+            fb = fs;
+            if (side == -1)
+                fa *= 0.5;
+            side = -1;
+        }
+        else
+        {
+            a = s;
+            fa = fs;
+            if (side == 1)
+                fb *= 0.5;
+            side = 1;
+        }
+    }
+    double t = horizontal ? t0 + s / n : t0;
+    double q = horizontal ? q0 : q0 + s / n;
+    double x11 = field.x(cx, cz), z11 = field.z(cx, cz);
+    point.x = t == 0.0 ? x11 : x11 + t * (field.x(cx + 1, cz) - x11);
+    point.y = level;
+    point.z = q == 0.0 ? z11 : z11 + q * (field.z(cx, cz + 1) - z11);
+}
+
+void ContourBuilder::buildCell(const SurfaceModel &model, int x, int z, int subdivisions, const vector<double> &levels,
+                               double minY, double maxY, vector<double> &values, vector<vector<Piece> > &pieces)
+{
+    int n = subdivisions;
+    int r = n + 1;
+    const HeightField &field = model.grid();
+    long long fw = (long long)(field.width() - 1) * n + 1;
+    bool evaluated = false;
+    vector<Vertex> nodes;
+    vector<Vec3> crossings;
+    vector<bool> found;
+    for (size_t l = 0; l < levels.size(); ++l)
+    {
+        double level = levels[l];
+        if (level < minY || level > maxY)
+            continue;
+        if (!evaluated)
+        {
+            // Nodes are the samples of the output grid, so the cells sharing an edge see the same values on it.
+            nodes.resize(r * r);
+            SurfaceBuilder::evaluate(model, r, x * n, z * n, r, r, &nodes[0], r);
+            values.resize(r * r);
+            for (int i = 0; i < r * r; ++i)
+                values[i] = nodes[i].position.y;
+            evaluated = true;
+            crossings.resize(r * r * 2);
+        }
+        found.assign(r * r * 2, false);
+        for (int j = 0; j < n; ++j)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                // Corners and edges go clockwise from the top left.
+                int corners[4] = {j * r + i, j * r + i + 1, (j + 1) * r + i + 1, (j + 1) * r + i};
+                double v[4];
+                bool above[4];
+                for (int k = 0; k < 4; ++k)
+                {
+                    v[k] = values[corners[k]];
+                    above[k] = v[k] >= level;
+                }
+                int edges[4];
+                int count = 0;
+                for (int k = 0; k < 4; ++k)
+                {
+                    if (above[k] != above[(k + 1) % 4])
+                        edges[count++] = k;
+                }
+                if (count == 0)
+                    continue;
+                if (count == 4)
+                {
+                    // Saddle is resolved by the center of the quad: if it is on the side of the top left corner,
+                    // that corner is joined with the bottom right one, otherwise they are separated.
+                    double y;
+                    SurfaceBuilder::evaluateHeight(model, x, z, (i + 0.5) / n, (j + 0.5) / n, y);
+                    if ((y >= level) == above[0])
+                    {
+                        edges[0] = 0, edges[1] = 1;
+                        edges[2] = 2, edges[3] = 3;
+                    }
+                    else
+                    {
+                        edges[0] = 3, edges[1] = 0;
+                        edges[2] = 1, edges[3] = 2;
+                    }
+                }
+                for (int p = 0; p < count; p += 2)
+                {
+                    Piece piece;
+                    for (int e = 0; e < 2; ++e)
+                    {
+                        int k = edges[p + e];
+                        int gx = x * n + i + EDGE_DX[k];
+                        int gz = z * n + j + EDGE_DZ[k];
+                        piece.keys[e] = ((long long)gz * fw + gx) * 2 + k % 2;
+                        // Inner edges are shared by two quads of the cell, so their crossings are found once.
+                        int local = ((j + EDGE_DZ[k]) * r + i + EDGE_DX[k]) * 2 + k % 2;
+                        if (!found[local])
+                        {
+                            findCrossing(model, n, gx, gz, k % 2 == 0, v[EDGE_FIRST[k]], v[EDGE_SECOND[k]], level, crossings[local]);
+                            found[local] = true;
+                        }
+                        piece.points[e] = crossings[local];
+                    }
+                    pieces[l].push_back(piece);
+                }
+            }
+        }
+    }
+}
+
+void ContourBuilder::stitch(const vector<Piece> &pieces, double level, vector<Contour> &contours)
+{
+    // Each key is shared by at most two pieces, so every end of the piece has at most one neighbour.
+    vector<int> neighbours(pieces.size() * 2, -1);
+    unordered_map<long long, int> owners;
+    owners.reserve(pieces.size() * 4);
+    for (size_t i = 0; i < pieces.size(); ++i)
+    {
+        for (int e = 0; e < 2; ++e)
+        {
+            pair<unordered_map<long long, int>::iterator, bool> res = owners.insert(make_pair(pieces[i].keys[e], (int)i));
+            if (!res.second)
+            {
+                int j = res.first->second;
+                neighbours[i * 2 + e] = j;
+                neighbours[j * 2 + (pieces[j].keys[0] == pieces[i].keys[e] ? 0 : 1)] = i;
+            }
+        }
+    }
+    vector<bool> visited(pieces.size(), false);
+    for (size_t i = 0; i < pieces.size(); ++i)
+    {
+        if (visited[i])
+            continue;
+        visited[i] = true;
+        Contour contour;
+        contour.level = level;
+        // Walk forward from the second end, then backward from the first one unless the loop is closed.
+        vector<Vec3> forward(1, pieces[i].points[0]);
+        forward.push_back(pieces[i].points[1]);
+        int current = i, end = 1;
+        while (true)
+        {
+            int next = neighbours[current * 2 + end];
+            if (next < 0)
+                break;
+            if (next == (int)i)
+            {
+                contour.closed = true;
+                forward.push_back(forward.front());
+                break;
+            }
+            if (visited[next])
+                break;
+            visited[next] = true;
+            end = pieces[next].keys[0] == pieces[current].keys[end] ? 1 : 0;
+            forward.push_back(pieces[next].points[end]);
+            current = next;
+        }
+        if (!contour.closed)
+        {
+            vector<Vec3> backward;
+            current = i, end = 0;
+            while (true)
+            {
+                int next = neighbours[current * 2 + end];
+                if (next < 0 || visited[next])
+                    break;
+                visited[next] = true;
+                end = pieces[next].keys[0] == pieces[current].keys[end] ? 1 : 0;
+                backward.push_back(pieces[next].points[end]);
+                current = next;
+            }
+            contour.points.assign(backward.rbegin(), backward.rend());
+        }
+        contour.points.insert(contour.points.end(), forward.begin(), forward.end());
+        contours.push_back(contour);
+    }
+}
+
+bool ContourBuilder::build(const SurfaceModel &model, const vector<double> &levels, int subdivisions, vector<Contour> &contours)
+{
+    const HeightField &field = model.grid();
+    int inWidth = field.width();
+    int inHeight = field.height();
+    if (subdivisions < 1 || inWidth < 2 || inHeight < 2)
+        return false;
+    int cellsX = inWidth - 1;
+    int cellsZ = inHeight - 1;
+    // Pieces are collected per cell row, so the result does not depend on the scheduling.
+    vector<vector<vector<Piece> > > rows(cellsZ, vector<vector<Piece> >(levels.size()));
+    #pragma omp parallel for schedule(dynamic)
+    for (int z = 0; z < cellsZ; ++z)
+    {
+        vector<double> values;
+        for (int x = 0; x < cellsX; ++x)
+        {
+            double minY, maxY;
+            // Incomplete cells have no patch and so no isolines.
+            if (SurfaceBuilder::getPatchBounds(model, x, z, minY, maxY))
+                buildCell(model, x, z, subdivisions, levels, minY, maxY, values, rows[z]);
+        }
+    }
+    vector<vector<Contour> > results(levels.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (int l = 0; l < (int)levels.size(); ++l)
+    {
+        vector<Piece> pieces;
+        for (int z = 0; z < cellsZ; ++z)
+            pieces.insert(pieces.end(), rows[z][l].begin(), rows[z][l].end());
+        stitch(pieces, levels[l], results[l]);
+    }
+    contours.clear();
+    for (size_t l = 0; l < levels.size(); ++l)
+        contours.insert(contours.end(), results[l].begin(), results[l].end());
+    return true;
+}
+
+bool ContourBuilder::build(const HeightField &inField, double c, const vector<double> &levels, int subdivisions,
+                           vector<Contour> &contours)
+{
+    SurfaceModel model;
+    if (!SurfaceBuilder::prepare(inField, c, model))
+        return false;
+    return build(model, levels, subdivisions, contours);
+}
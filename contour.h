@@ -0,0 +1,109 @@
+/**
+ * contour.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides functions to extract isolines of sleek surfaces.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_CONTOUR_H__
+#define __SLEEKSURFACE_CONTOUR_H__
+
+#include "surface.h"
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The Contour class stores a polyline of the surface isoline.
+     */
+    class Contour
+    {
+    public:
+        /**
+         * Height of the isoline.
+         */
+        double level;
+        /**
+         * Points of the polyline, y-coordinate of each point is equal to the level.
+         */
+        vector<Vec3> points;
+        /**
+         * True if the polyline is closed, its last point is equal to the first one then.
+         */
+        bool closed;
+
+        /**
+         * Contour constructor.
+         */
+        Contour() : level(0.0), closed(false) {};
+    };
+
+    /**
+     * The ContourBuilder static class extracts isolines of sleek surfaces directly from the patch model, without
+     * building the dense mesh. Cells whose height bounds do not contain a level are skipped. Other cells are
+     * subdivided into the regular grid of quads, where the isoline crossings of the quad edges are found by root
+     * finding on the analytic form of the patch, so the crossings are exactly on the surface. Edges of the cells
+     * are evaluated the same way from both sides, so the polylines are stitched across the cells.
+     */
+    class ContourBuilder
+    {
+        constexpr static const double TOLERANCE = 1.0e-12;
+
+        class Piece;
+
+        static void findCrossing(const SurfaceModel &model, int subdivisions, int x, int z, bool horizontal,
+                                   double v0, double v1, double level, Vec3 &point);
+        static void buildCell(const SurfaceModel &model, int x, int z, int subdivisions, const vector<double> &levels,
+                              double minY, double maxY, vector<double> &values, vector<vector<Piece> > &pieces);
+        static void stitch(const vector<Piece> &pieces, double level, vector<Contour> &contours);
+
+    public:
+        /**
+         * Extract isolines of the surface. Cells are processed in parallel, and so are the levels while stitching.
+         *
+         * @param model - surface model created by <code>SurfaceBuilder::prepare</code>.
+         * @param levels - heights of the isolines.
+         * @param subdivisions - number of quads along each cell side, the more the better saddles and sharp turns
+         * of isolines are resolved.
+         * @param contours - output polylines of all the levels.
+         * @return true if isolines are extracted, false if parameters are invalid.
+         */
+        static bool build(const SurfaceModel &model, const vector<double> &levels, int subdivisions, vector<Contour> &contours);
+        /**
+         * Extract isolines of the surface built according to the grid.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param levels - heights of the isolines.
+         * @param subdivisions - number of quads along each cell side.
+         * @param contours - output polylines of all the levels.
+         * @return true if isolines are extracted, false if not.
+         */
+        static bool build(const HeightField &inField, double c, const vector<double> &levels, int subdivisions,
+                          vector<Contour> &contours);
+    };
+}
+
+#endif // __SLEEKSURFACE_CONTOUR_H__
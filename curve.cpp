@@ -35,23 +35,29 @@ bool CurveBuilder::build(const vector<Vec2> &values, Segment *curve, double c)
 {
     int n = values.size() - 1;
     
-    if (n < 2)
+    if (n < 1)
         return false;
 
-    Vec2 cur, next, tgL, tgR, deltaC;
-    double l1, l2, tmp, x;
-    bool zL, zR;
+    buildRange(values.data(), n, 0, n - 1, curve, c);
+    return true;
+}
+
+void CurveBuilder::buildRange(const Vec2 *values, int n, int first, int last, Segment *curve, double c)
+{
+    Vec2 cur, next, tgL, tgR;
+    Segment previous;
     
-    next = values[1] - values[0];
+    // The left tangent of the segment is the right one of the previous segment clipped by it,
+    // so the previous segment is rebuilt as well, but not stored.
+    int start = max(first - 1, 0);
+    next = values[start + 1] - values[start];
     next.normalize();
     
-    for (int i = 0; i < n; ++i)
+    for (int i = start; i <= last; ++i)
     {
         tgL = tgR;
         cur = next;
         
-        deltaC = values[i + 1] - values[i];
-        
         if (i < n - 1)
         {
             next = values[i + 2] - values[i + 1];
@@ -64,47 +70,105 @@ bool CurveBuilder::build(const vector<Vec2> &values, Segment *curve, double c)
             tgR.x = tgR.y = 0.0;
         }
         
-        if (Math::sign(tgL.x) != Math::sign(deltaC.x))
-            tgL.x = 0.0;
-        if (Math::sign(tgL.y) != Math::sign(deltaC.y))
-            tgL.y = 0.0;
-        if (Math::sign(tgR.x) != Math::sign(deltaC.x))
-            tgR.x = 0.0;
-        if (Math::sign(tgR.y) != Math::sign(deltaC.y))
-            tgR.y = 0.0;
-        
-        zL = Math::isZero(tgL.x);
-        zR = Math::isZero(tgR.x);
-        
-        l1 = zL ? 0.0 : deltaC.x / (c * tgL.x);
-        l2 = zR ? 0.0 : deltaC.x / (c * tgR.x);
-        
-        if (abs(l1 * tgL.y) > abs(deltaC.y))
-            l1 = Math::isZero(tgL.y) ? 0.0 : deltaC.y / tgL.y;
-        if (abs(l2 * tgR.y) > abs(deltaC.y))
-            l2 = Math::isZero(tgR.y) ? 0.0 : deltaC.y / tgR.y;
-        
-        if (!zL && !zR)
+        buildSegment(values[i], values[i + 1], tgL, tgR, c, i < first ? previous : curve[i]);
+    }
+}
+
+void CurveBuilder::buildSegment(const Vec2 &p0, const Vec2 &p1, Vec2 tgL, Vec2 &tgR, double c, Segment &segment)
+{
+    Vec2 deltaC = p1 - p0;
+    double l1, l2, tmp, x;
+    bool zL, zR;
+    
+    if (Math::sign(tgL.x) != Math::sign(deltaC.x))
+        tgL.x = 0.0;
+    if (Math::sign(tgL.y) != Math::sign(deltaC.y))
+        tgL.y = 0.0;
+    if (Math::sign(tgR.x) != Math::sign(deltaC.x))
+        tgR.x = 0.0;
+    if (Math::sign(tgR.y) != Math::sign(deltaC.y))
+        tgR.y = 0.0;
+    
+    zL = Math::isZero(tgL.x);
+    zR = Math::isZero(tgR.x);
+    
+    l1 = zL ? 0.0 : deltaC.x / (c * tgL.x);
+    l2 = zR ? 0.0 : deltaC.x / (c * tgR.x);
+    
+    if (abs(l1 * tgL.y) > abs(deltaC.y))
+        l1 = Math::isZero(tgL.y) ? 0.0 : deltaC.y / tgL.y;
+    if (abs(l2 * tgR.y) > abs(deltaC.y))
+        l2 = Math::isZero(tgR.y) ? 0.0 : deltaC.y / tgR.y;
+    
+    if (!zL && !zR)
+    {
+        tmp = tgL.y / tgL.x - tgR.y / tgR.x;
+        if (!Math::isZero(tmp))
         {
-            tmp = tgL.y / tgL.x - tgR.y / tgR.x;
-            if (!Math::isZero(tmp))
+            x = (p1.y - tgR.y / tgR.x * p1.x - p0.y + tgL.y / tgL.x * p0.x) / tmp;
+            if (x > p0.x && x < p1.x)
             {
-                x = (values[i + 1].y - tgR.y / tgR.x * values[i + 1].x - values[i].y + tgL.y / tgL.x * values[i].x) / tmp;
-                if (x > values[i].x && x < values[i + 1].x)
-                {
-                    if (abs(l1) > abs(l2))
-                        l1 = 0.0;
-                    else
-                        l2 = 0.0;
-                }
+                if (abs(l1) > abs(l2))
+                    l1 = 0.0;
+                else
+                    l2 = 0.0;
             }
         }
+    }
+
+    segment.points[0] = p0;
+    segment.points[1] = segment.points[0] + tgL * l1;
+    segment.points[3] = p1;
+    segment.points[2] = segment.points[3] - tgR * l2;
+}
 
-        curve[i].points[0] = values[i];
-        curve[i].points[1] = curve[i].points[0] + tgL * l1;
-        curve[i].points[3] = values[i + 1];
-        curve[i].points[2] = curve[i].points[3] - tgR * l2;
+bool StreamingCurveBuilder::push(const Vec2 &point, Segment &segment)
+{
+    if (count == 0)
+    {
+        p0 = point;
+        ++count;
+        return false;
     }
-    
+    if (count == 1)
+    {
+        p1 = point;
+        next = p1 - p0;
+        next.normalize();
+        tgL = Vec2();
+        ++count;
+        return false;
+    }
+
+    Vec2 cur = next;
+    next = point - p1;
+    next.normalize();
+    Vec2 tgR = cur + next;
+    tgR.normalize();
+
+    CurveBuilder::buildSegment(p0, p1, tgL, tgR, c, segment);
+
+    tgL = tgR;
+    p0 = p1;
+    p1 = point;
+    ++count;
     return true;
 }
+
+bool StreamingCurveBuilder::finish(Segment &segment)
+{
+    bool result = count > 1;
+    if (result)
+    {
+        Vec2 tgR;
+        CurveBuilder::buildSegment(p0, p1, tgL, tgR, c, segment);
+    }
+    count = 0;
+    return result;
+}
+
+void StreamingCurveBuilder::sample(const Segment &segment, int resolution, vector<Vec2> &points)
+{
+    for (int i = 0; i < resolution; ++i)
+        points.push_back(segment.calc((double)i / (double)resolution, true));
+}
@@ -58,48 +58,133 @@ namespace SleekSurface
          */
         Vec2 calc(double t, bool regularize) const
         {
-            if (regularize)
+            if (regularize && !regularParam(t, t))
+                return Vec2(points[0].x + t * (points[3].x - points[0].x), calcY(t));
+
+            double t2 = t * t;
+            double t3 = t2 * t;
+            double nt = 1.0 - t;
+            double nt2 = nt * nt;
+            double nt3 = nt2 * nt;
+            return Vec2(nt3 * points[0].x + 3.0 * t * nt2 * points[1].x + 3.0 * t2 * nt * points[2].x + t3 * points[3].x,
+                        nt3 * points[0].y + 3.0 * t * nt2 * points[1].y + 3.0 * t2 * nt * points[2].y + t3 * points[3].y);
+        };
+
+        /**
+         * Find the curve parameter giving the point with x-coordinate linearly interpolated between the end points.
+         * It depends on x-coordinates of control points only, so it can be shared by segments having them equal.
+         * y-coordinate of <code>calc(t, true)</code> is always equal to <code>calcY(s)</code>,
+         * where s is <code>t</code> if the parameter is not found.
+         *
+         * @param t - linear interpolation quotient, should be in [0; 1].
+         * @param s - output curve parameter, it is only changed if the function returns true.
+         * @return true if the parameter is found in (0; 1), false if not.
+         */
+        bool regularParam(double t, double &s) const
+        {
+            // We solve this by t to find out parameter giving regular grid:
+            // x0 + t0 (x3 - x0) = (1 - t)^3 x0 + 3 t (1 - t)^2 x1 + 3 t^2 (1 - t) x2 + t^3 x3.
+            double a = -points[0].x + 3.0 * (points[1].x - points[2].x) + points[3].x;
+            double b = 3.0 * (points[0].x - 2.0 * points[1].x + points[2].x);
+            double c = 3.0 * (-points[0].x + points[1].x);
+            double d = t * (points[0].x - points[3].x);
+            double roots[3];
+            int rn = Math::solveCubicEq(a, b, c, d, roots);
+            if (rn > 0)
             {
-                // We solve this by t to find out parameter giving regular grid:
-                // x0 + t0 (x3 - x0) = (1 - t)^3 x0 + 3 t (1 - t)^2 x1 + 3 t^2 (1 - t) x2 + t^3 x3.
-                double a = -points[0].x + 3.0 * (points[1].x - points[2].x) + points[3].x;
-                double b = 3.0 * (points[0].x - 2.0 * points[1].x + points[2].x);
-                double c = 3.0 * (-points[0].x + points[1].x);
-                double d = t * (points[0].x - points[3].x);
-                double roots[3];
-                int rn = Math::solveCubicEq(a, b, c, d, roots);
-                if (rn > 0)
+                double nearestRoot = roots[0];
+                for (int i = 1; i < rn; ++i)
                 {
-                    double nearestRoot = roots[0];
-                    for (int i = 1; i < rn; ++i)
-                    {
-                        if (roots[i] > 0.0 && roots[i] < 1.0 && abs(t - roots[i]) < abs(t - nearestRoot))
-                            nearestRoot = roots[i];
-                    }
-                    if (nearestRoot > 0.0 && nearestRoot < 1.0)
-                        t = nearestRoot;
-                    else
-                        rn = 0;
+                    if (roots[i] > 0.0 && roots[i] < 1.0 && abs(t - roots[i]) < abs(t - nearestRoot))
+                        nearestRoot = roots[i];
                 }
-                if (rn == 0)
+                if (nearestRoot > 0.0 && nearestRoot < 1.0)
                 {
-                    double t2 = t * t;
-                    double t3 = t2 * t;
-                    double nt = 1.0 - t;
-                    double nt2 = nt * nt;
-                    double nt3 = nt2 * nt;
-                    return Vec2(points[0].x + t * (points[3].x - points[0].x),
-                                nt3 * points[0].y + 3.0 * t * nt2 * points[1].y + 3.0 * t2 * nt * points[2].y + t3 * points[3].y);
+                    s = nearestRoot;
+                    return true;
                 }
             }
+            return false;
+        };
 
+        /**
+         * Calculate y-coordinate of the curve point.
+         *
+         * @param t - parameter of the curve, should be in [0; 1].
+         * @return y-coordinate of Bezier curve point that corresponds the given parameter.
+         */
+        double calcY(double t) const
+        {
             double t2 = t * t;
             double t3 = t2 * t;
             double nt = 1.0 - t;
             double nt2 = nt * nt;
             double nt3 = nt2 * nt;
-            return Vec2(nt3 * points[0].x + 3.0 * t * nt2 * points[1].x + 3.0 * t2 * nt * points[2].x + t3 * points[3].x,
-                        nt3 * points[0].y + 3.0 * t * nt2 * points[1].y + 3.0 * t2 * nt * points[2].y + t3 * points[3].y);
+            return nt3 * points[0].y + 3.0 * t * nt2 * points[1].y + 3.0 * t2 * nt * points[2].y + t3 * points[3].y;
+        };
+
+        /**
+         * Calculate derivatives of y-coordinate of the regularized curve by the linear interpolation quotient,
+         * i.e. derivatives of <code>calc(t, true).y</code> by t. In the end point with zero-length handle
+         * x'(s) is zero, and the limits are taken: the first derivative is y''/x'' (x3 - x0), while the second one
+         * is unbounded there as y grows as a power 3/2 of x, so its finite quadratic part is returned.
+         *
+         * @param s - curve parameter found by <code>regularParam</code> for t, or t itself if it is not found.
+         * @param regular - flag determining if the parameter has been found (true) or not (false).
+         * @param dy, ddy - output first and second derivatives.
+         */
+        void calcDerivativesY(double s, bool regular, double &dy, double &ddy) const
+        {
+            double ns = 1.0 - s;
+            double y1 = 3.0 * (ns * ns * (points[1].y - points[0].y) + 2.0 * s * ns * (points[2].y - points[1].y) +
+                               s * s * (points[3].y - points[2].y));
+            double y2 = 6.0 * (ns * (points[2].y - 2.0 * points[1].y + points[0].y) + s * (points[3].y - 2.0 * points[2].y + points[1].y));
+            double x1 = 3.0 * (ns * ns * (points[1].x - points[0].x) + 2.0 * s * ns * (points[2].x - points[1].x) +
+                               s * s * (points[3].x - points[2].x));
+            double x2 = 6.0 * (ns * (points[2].x - 2.0 * points[1].x + points[0].x) + s * (points[3].x - 2.0 * points[2].x + points[1].x));
+            double length = points[3].x - points[0].x;
+            // The parameter is not found in the end points, but there it is exact, as x(0) = x0 and x(1) = x3.
+            if (!regular && s != 0.0 && s != 1.0)
+            {
+                dy = y1;
+                ddy = y2;
+                return;
+            }
+
+            if (x1 == 0.0)
+            {
+                if (x2 == 0.0)
+                {
+                    dy = ddy = 0.0;
+                    return;
+                }
+                // Expanding x and y by the powers of the parameter around the end point gives
+                // y = y2 / x2 x + k x^(3/2) + m x^2 + ..., where x is counted from the end point.
+                double x3 = 6.0 * (points[3].x - 3.0 * (points[2].x - points[1].x) - points[0].x);
+                double y3 = 6.0 * (points[3].y - 3.0 * (points[2].y - points[1].y) - points[0].y);
+                double x22 = x2 * x2;
+                dy = y2 / x2 * length;
+                ddy = -2.0 / 3.0 * x3 * (y3 * x2 - y2 * x3) / (x22 * x22) * length * length;
+                return;
+            }
+
+            // Parameter s(t) is defined by x(s) = x0 + t (x3 - x0).
+            double ds = length / x1;
+            double dds = -x2 * ds * ds / x1;
+            dy = y1 * ds;
+            ddy = y2 * ds * ds + y1 * dds;
+        };
+
+        /**
+         * Test if two segments have equal x-coordinates of control points, so their regular parameters are equal.
+         *
+         * @param s - segment to compare with.
+         * @return true if x-coordinates are equal, false if not.
+         */
+        bool sameX(const Segment &s) const
+        {
+            return points[0].x == s.points[0].x && points[1].x == s.points[1].x &&
+                   points[2].x == s.points[2].x && points[3].x == s.points[3].x;
         };
     };
 
@@ -116,9 +201,99 @@ namespace SleekSurface
          * @param values - input array of points to interpolate.
          * @param curve - pointer to the preallocated output array of curve segments.
          * @param c - paramenet affecting curvature, should be in [2; +inf).
-         * @return true if interpolation successful, false if not.
+         * @return true if interpolation successful, false if there are less than 2 points.
          */
         static bool build(const vector<Vec2> &values, Segment *curve, double c = 2.0);
+
+        /**
+         * Rebuild the range of curve segments, e.g. after some of the points have been moved.
+         * Segment i depends on the points from i - 1 to i + 2 only, so the segments are exactly the same
+         * as the ones built by <code>build</code> for the whole curve.
+         *
+         * @param values - pointer to the first point of the curve, only the points from first - 1 to last + 2 are read.
+         * @param n - number of curve segments, i.e. number of points minus 1.
+         * @param first, last - range of segments to rebuild, should lie in [0; n - 1].
+         * @param curve - pointer to the first segment of the curve, only the segments of the range are written.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         */
+        static void buildRange(const Vec2 *values, int n, int first, int last, Segment *curve, double c = 2.0);
+
+        /**
+         * Build a single curve segment between two neighbouring points.
+         * This is the per-segment step of <code>build</code>, so both batch and streaming builders produce
+         * exactly the same segments.
+         *
+         * @param p0, p1 - segment end points.
+         * @param tgL - tangent in the left end point (zero for the first segment of the curve).
+         * @param tgR - tangent in the right end point (zero for the last segment of the curve).
+         * It is clipped according to the segment direction, and the clipped value has to be used as
+         * <code>tgL</code> of the next segment.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param segment - output curve segment.
+         */
+        static void buildSegment(const Vec2 &p0, const Vec2 &p1, Vec2 tgL, Vec2 &tgR, double c, Segment &segment);
+    };
+
+    /**
+     * The StreamingCurveBuilder class provides methods to create sleek curves incrementally.
+     * Points are pushed one at a time and each segment is emitted as soon as its right-hand neighbour is known,
+     * so the memory used does not depend on the curve length.
+     * The emitted segments are identical to the ones produced by <code>CurveBuilder::build</code>.
+     */
+    class StreamingCurveBuilder
+    {
+        double c;
+        int count;
+        Vec2 p0, p1;
+        Vec2 next, tgL;
+
+    public:
+        /**
+         * StreamingCurveBuilder constructor.
+         *
+         * @param _c - paramenet affecting curvature, should be in [2; +inf).
+         */
+        StreamingCurveBuilder(double _c = 2.0) : c(_c), count(0) {};
+
+        /**
+         * Push the next point of the curve.
+         *
+         * @param point - next point to interpolate.
+         * @param segment - output curve segment, it is only filled if the function returns true.
+         * @return true if the segment ending in the previous point is finalized, false if not.
+         */
+        bool push(const Vec2 &point, Segment &segment);
+
+        /**
+         * Finish the curve and start a new one.
+         *
+         * @param segment - output last curve segment, it is only filled if the function returns true.
+         * @return true if the last segment is emitted, false if the curve has less than 2 points
+         * and therefore cannot be built.
+         */
+        bool finish(Segment &segment);
+
+        /**
+         * Reset the builder state without emitting anything.
+         */
+        void reset() { count = 0; };
+
+        /**
+         * Get the number of points pushed since the curve start.
+         *
+         * @return number of points.
+         */
+        int size() const { return count; };
+
+        /**
+         * Resample segment at fixed step of x-coordinate.
+         *
+         * @param segment - segment to resample.
+         * @param resolution - number of steps to subdivide the segment to.
+         * @param points - array to append <code>resolution</code> points to. The right end point of the segment is
+         * not appended, because it is the first point of the next segment.
+         */
+        static void sample(const Segment &segment, int resolution, vector<Vec2> &points);
     };
 }
 
@@ -31,19 +31,21 @@
 using namespace SleekSurface;
 using namespace std;
 
-void printOBJ(const vector<Vertex> &vertices, const vector<int> &indices)
+void printOBJ(const GridBuffer &grid, const vector<int> &indices)
 {
+    const Vertex *vertices = grid.data();
+    int count = grid.width() * grid.height();
     cout << "# Testing the sleek-surface library" << endl << endl;
-    cout << "# " << vertices.size() << " vertex positions" << endl;
-    for (int i = 0, n = vertices.size(); i < n; ++i)
+    cout << "# " << count << " vertex positions" << endl;
+    for (int i = 0; i < count; ++i)
     {
         cout << "v " <<
             vertices[i].position.x << " " <<
             vertices[i].position.y << " " <<
             vertices[i].position.z << endl;
     }
-    cout << endl << "# " << vertices.size() << " vertex normals" << endl;
-    for (int i = 0, n = vertices.size(); i < n; ++i)
+    cout << endl << "# " << count << " vertex normals" << endl;
+    for (int i = 0; i < count; ++i)
     {
         cout << "vn " <<
             vertices[i].normal.x << " " <<
@@ -78,26 +80,15 @@ int main(int argc, char **argv)
     const int resolution = 17;
     const int kernelRadius = 17 / 5;
 
-    vector<Vec3> points(w * h);
-    for (int z = 0; z < h; ++z)
-    {
-        for (int x = 0; x < w; ++x)
-            points[z * w + x] = Vec3(x, data[z][x], z);
-    }
+    HeightField field(HeightField::FLOAT64, data, w, h, sizeof(data[0]));
 
-    vector<Vertex> vertices;
+    GridBuffer vertices;
     vector<int> indices;
-    vector<float> gaussianKernel;
-    vector<Vertex> smoothedVertices;
-    int rw, rh;
 
-    SurfaceBuilder::build(points, w, h, resolution, c, vertices, rw, rh);
-    SurfaceBuilder::triangulateGrid(rw, rh, indices);
-    SurfaceBuilder::computeNormals(vertices, indices);
-    Math::calcGaussianKernel(kernelRadius, false, gaussianKernel);
-    SurfaceBuilder::smoothNormalsWithKernel(vertices, rw, rh, gaussianKernel, kernelRadius, smoothedVertices);
+    SurfaceBuilder::buildFused(field, resolution, c, kernelRadius, 0, vertices);
+    SurfaceBuilder::triangulateGrid(vertices.width(), vertices.height(), indices);
 
-    printOBJ(smoothedVertices, indices);
+    printOBJ(vertices, indices);
 
     return 0;
 }
@@ -0,0 +1,192 @@
+/**
+ * partition.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides functions to build sleek surfaces partitioned between several processes.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "partition.h"
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+using namespace SleekSurface;
+
+bool SharedMemoryTransport::receive(const TilePart &part, vector<Vec3> &points)
+{
+    points.resize(part.inWidth * part.inHeight);
+    for (int z = 0; z < part.inHeight; ++z)
+    {
+        for (int x = 0; x < part.inWidth; ++x)
+            points[z * part.inWidth + x] = field.point(part.inX0 + x, part.inZ0 + z);
+    }
+    return true;
+}
+
+bool SharedMemoryTransport::send(const TilePart &part, const vector<Vertex> &vertices)
+{
+    for (int z = 0; z < part.height; ++z)
+    {
+        const Vertex *src = &vertices[z * part.width];
+        copy(src, src + part.width, output + (part.z0 + z) * outWidth + part.x0);
+    }
+    return true;
+}
+
+bool PartitionedBuilder::getParts(int inWidth, int inHeight, int resolution, int kernelRadius, int partsX, int partsZ,
+                                  vector<TilePart> &parts)
+{
+    if (inWidth < 2 || inHeight < 2 || resolution < 2 || kernelRadius < 0 || partsX < 1 || partsZ < 1)
+        return false;
+
+    int outWidth, outHeight;
+    SurfaceBuilder::getOutputSize(inWidth, inHeight, resolution, outWidth, outHeight);
+    if (partsX > outWidth || partsZ > outHeight)
+        return false;
+
+    // Normals need one more vertex around the part, smoothing needs kernel radius more normals around.
+    // Patches of these vertices need their curves, which are exact two cells away from the window border
+    // since tangents of a curve segment depend on one point before and one point after it.
+    int step = resolution - 1;
+    int halo = kernelRadius + 1;
+    parts.resize(partsX * partsZ);
+    for (int pz = 0; pz < partsZ; ++pz)
+    {
+        for (int px = 0; px < partsX; ++px)
+        {
+            TilePart &part = parts[pz * partsX + px];
+            part.index = pz * partsX + px;
+            part.x0 = (int)((long long)px * outWidth / partsX);
+            part.z0 = (int)((long long)pz * outHeight / partsZ);
+            part.width = (int)((long long)(px + 1) * outWidth / partsX) - part.x0;
+            part.height = (int)((long long)(pz + 1) * outHeight / partsZ) - part.z0;
+
+            int cellX0 = max(part.x0 - halo, 0) / step;
+            int cellZ0 = max(part.z0 - halo, 0) / step;
+            int cellX1 = min(part.x0 + part.width + halo, outWidth) - 1;
+            int cellZ1 = min(part.z0 + part.height + halo, outHeight) - 1;
+            cellX1 = min(cellX1 / step, inWidth - 1);
+            cellZ1 = min(cellZ1 / step, inHeight - 1);
+            part.inX0 = max(cellX0 - 2, 0);
+            part.inZ0 = max(cellZ0 - 2, 0);
+            part.inWidth = min(cellX1 + 2, inWidth - 1) - part.inX0 + 1;
+            part.inHeight = min(cellZ1 + 2, inHeight - 1) - part.inZ0 + 1;
+        }
+    }
+    return true;
+}
+
+bool PartitionedBuilder::buildPart(const TilePart &part, int inWidth, int inHeight, int resolution, double c, int kernelRadius,
+                                   TileTransport &transport)
+{
+    vector<Vec3> points;
+    SurfaceModel model;
+    if (!transport.receive(part, points) ||
+        !SurfaceBuilder::prepare(HeightField::fromPoints(points.data(), part.inWidth, part.inHeight), c, model))
+        return false;
+
+    int step = resolution - 1;
+    int halo = kernelRadius + 1;
+    int outWidth, outHeight;
+    SurfaceBuilder::getOutputSize(inWidth, inHeight, resolution, outWidth, outHeight);
+    int rx0 = max(part.x0 - halo, 0);
+    int rz0 = max(part.z0 - halo, 0);
+    int rw = min(part.x0 + part.width + halo, outWidth) - rx0;
+    int rh = min(part.z0 + part.height + halo, outHeight) - rz0;
+
+    vector<Vertex> region(rw * rh);
+    SurfaceBuilder::evaluate(model, resolution, rx0 - part.inX0 * step, rz0 - part.inZ0 * step, rw, rh, region.data(), rw);
+    SurfaceBuilder::computeGridNormals(region, rw, rh);
+    vector<Vertex> smoothed;
+    if (kernelRadius > 0)
+    {
+        vector<float> kernel;
+        Math::calcGaussianKernel(kernelRadius, false, kernel);
+        SurfaceBuilder::smoothNormalsWithKernel(region, rw, rh, kernel, kernelRadius, smoothed);
+    }
+    else
+        smoothed.swap(region);
+
+    vector<Vertex> vertices(part.width * part.height);
+    for (int z = 0; z < part.height; ++z)
+    {
+        const Vertex *src = &smoothed[(part.z0 - rz0 + z) * rw + (part.x0 - rx0)];
+        copy(src, src + part.width, vertices.begin() + z * part.width);
+    }
+    return transport.send(part, vertices);
+}
+
+bool PartitionedBuilder::build(const HeightField &inField, int resolution, double c, int kernelRadius, int partsX, int partsZ,
+                               int processes, vector<Vertex> &outPoints, int &outWidth, int &outHeight)
+{
+    vector<TilePart> parts;
+    if (processes < 1 || !getParts(inField.width(), inField.height(), resolution, kernelRadius, partsX, partsZ, parts))
+        return false;
+
+    SurfaceBuilder::getOutputSize(inField.width(), inField.height(), resolution, outWidth, outHeight);
+    size_t bytes = (size_t)outWidth * outHeight * sizeof(Vertex);
+    void *shared = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        return false;
+
+    SharedMemoryTransport transport(inField, (Vertex *)shared, outWidth);
+    int n = parts.size();
+    processes = min(processes, n);
+    vector<pid_t> workers;
+    bool result = true;
+    for (int k = 0; k < processes && result; ++k)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // OpenMP thread pool of the parent does not exist in the child, parallel regions would wait for it.
+#ifdef _OPENMP
+            omp_set_num_threads(1);
+#endif
+            bool built = true;
+            for (int i = k; i < n && built; i += processes)
+                built = buildPart(parts[i], inField.width(), inField.height(), resolution, c, kernelRadius, transport);
+            _exit(built ? 0 : 1);
+        }
+        if (pid < 0)
+            result = false;
+        else
+            workers.push_back(pid);
+    }
+
+    for (int i = 0, m = workers.size(); i < m; ++i)
+    {
+        int status;
+        if (waitpid(workers[i], &status, 0) != workers[i] || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            result = false;
+    }
+
+    if (result)
+        outPoints.assign((const Vertex *)shared, (const Vertex *)shared + outWidth * outHeight);
+    munmap(shared, bytes);
+    return result;
+}
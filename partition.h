@@ -0,0 +1,167 @@
+/**
+ * partition.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides functions to build sleek surfaces partitioned between several processes.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_PARTITION_H__
+#define __SLEEKSURFACE_PARTITION_H__
+
+#include "surface.h"
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The TilePart class describes a part of the output grid built by one worker.
+     */
+    class TilePart
+    {
+    public:
+        /**
+         * Index of the part.
+         */
+        int index;
+        /**
+         * Region of the output grid owned by the part.
+         */
+        int x0, z0, width, height;
+        /**
+         * Window of the input grid needed to build the part, including the halo.
+         */
+        int inX0, inZ0, inWidth, inHeight;
+    };
+
+    /**
+     * The TileTransport class is an interface of data exchange between the workers and the coordinator
+     * of partitioned build.
+     */
+    class TileTransport
+    {
+    public:
+        /**
+         * TileTransport destructor.
+         */
+        virtual ~TileTransport() {};
+
+        /**
+         * Get the input window of the part, called by the worker.
+         *
+         * @param part - part to build.
+         * @param points - output points of the input window, row by row.
+         * @return true if window is received, false if not.
+         */
+        virtual bool receive(const TilePart &part, vector<Vec3> &points) = 0;
+        /**
+         * Hand over the built part, called by the worker.
+         *
+         * @param part - built part.
+         * @param vertices - vertices of the owned region with smoothed normals, row by row.
+         * @return true if part is sent, false if not.
+         */
+        virtual bool send(const TilePart &part, const vector<Vertex> &vertices) = 0;
+    };
+
+    /**
+     * The SharedMemoryTransport class exchanges data of the workers running on the same host: input grid is
+     * read directly and output vertices are written to the memory shared with the coordinator.
+     */
+    class SharedMemoryTransport : public TileTransport
+    {
+        const HeightField &field;
+        Vertex *output;
+        int outWidth;
+
+    public:
+        /**
+         * SharedMemoryTransport constructor.
+         *
+         * @param _field - input grid.
+         * @param _output - output grid, should be mapped as shared memory to be seen by the coordinator.
+         * @param _outWidth - output grid width.
+         */
+        SharedMemoryTransport(const HeightField &_field, Vertex *_output, int _outWidth) :
+            field(_field), output(_output), outWidth(_outWidth) {};
+
+        virtual bool receive(const TilePart &part, vector<Vec3> &points);
+        virtual bool send(const TilePart &part, const vector<Vertex> &vertices);
+    };
+
+    /**
+     * The PartitionedBuilder static class builds sleek surfaces split into parts built independently,
+     * e.g. by different processes or hosts. Each part gets the window of the input grid with the halo big enough
+     * to build the same curves, patches and smoothed normals as the single build, so the results stitch
+     * exactly: every output vertex is equal to the one built by <code>SurfaceBuilder::build</code>,
+     * <code>SurfaceBuilder::computeGridNormals</code> and <code>SurfaceBuilder::smoothNormalsWithKernel</code>.
+     */
+    class PartitionedBuilder
+    {
+    public:
+        /**
+         * Split the output grid into parts.
+         *
+         * @param inWidth, inHeight - resolution of input grid.
+         * @param resolution - resolution of each coons patch.
+         * @param kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @param partsX, partsZ - number of parts along x and z.
+         * @param parts - output parts.
+         * @return true if grid is split successfully, false if not.
+         */
+        static bool getParts(int inWidth, int inHeight, int resolution, int kernelRadius, int partsX, int partsZ,
+                             vector<TilePart> &parts);
+        /**
+         * Build one part, called by the worker.
+         *
+         * @param part - part to build.
+         * @param inWidth, inHeight - resolution of input grid.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @param transport - transport to get the input window and hand over the result.
+         * @return true if part is built, false if not.
+         */
+        static bool buildPart(const TilePart &part, int inWidth, int inHeight, int resolution, double c, int kernelRadius,
+                              TileTransport &transport);
+        /**
+         * Build a surface by several worker processes forked from the calling one and exchanging data
+         * through <code>SharedMemoryTransport</code>. Each worker runs single-threaded.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @param partsX, partsZ - number of parts along x and z.
+         * @param processes - number of worker processes, the parts are distributed between them evenly.
+         * @param outPoints - regular grid of 3D points with smoothed normals.
+         * @param outWidth, outHeight - resolution of output grid.
+         * @return true if surface building successful, false if not.
+         */
+        static bool build(const HeightField &inField, int resolution, double c, int kernelRadius, int partsX, int partsZ,
+                          int processes, vector<Vertex> &outPoints, int &outWidth, int &outHeight);
+    };
+}
+
+#endif // __SLEEKSURFACE_PARTITION_H__
@@ -0,0 +1,366 @@
+/**
+ * pipeline.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides pipelines to build sequences of sleek surfaces.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "pipeline.h"
+
+
+using namespace SleekSurface;
+
+FramePipeline::FramePipeline() :
+    inWidth(0), inHeight(0), resolution(0), c(0.0), kernelRadius(0), outWidth(0), outHeight(0), frames(0), stopping(false)
+{
+    bufferFrames[0] = bufferFrames[1] = -1;
+}
+
+FramePipeline::~FramePipeline()
+{
+    close();
+}
+
+bool FramePipeline::init(int _inWidth, int _inHeight, int _resolution, double _c, int _kernelRadius, const FrameHandler &_handler)
+{
+    close();
+    if (_inWidth < 2 || _inHeight < 2 || _resolution < 2 || _kernelRadius < 0 || !_handler)
+        return false;
+
+    inWidth = _inWidth;
+    inHeight = _inHeight;
+    resolution = _resolution;
+    c = _c;
+    kernelRadius = _kernelRadius;
+    handler = _handler;
+    if (kernelRadius > 0)
+        Math::calcGaussianKernel(kernelRadius, false, kernel);
+    SurfaceBuilder::getOutputSize(inWidth, inHeight, resolution, outWidth, outHeight);
+    SurfaceBuilder::triangulateGrid(outWidth, outHeight, indices);
+    for (int i = 0; i < 2; ++i)
+    {
+        buffers[i].resize(outWidth * outHeight);
+        bufferFrames[i] = -1;
+    }
+    frames = 0;
+    stopping = false;
+    worker = thread(&FramePipeline::run, this);
+    return true;
+}
+
+bool FramePipeline::push(const HeightField &inField)
+{
+    if (!worker.joinable() || inField.width() != inWidth || inField.height() != inHeight)
+        return false;
+
+    // Frames alternate between the buffers, so the buffer of the frame before the previous one has to be handled.
+    int k = frames % 2;
+    {
+        unique_lock<mutex> lock(bufferMutex);
+        bufferChanged.wait(lock, [this, k] { return bufferFrames[k] < 0; });
+    }
+
+    if (!SurfaceBuilder::prepare(inField, c, model))
+        return false;
+    SurfaceBuilder::evaluate(model, resolution, 0, 0, outWidth, outHeight, buffers[k].data(), outWidth);
+
+    {
+        lock_guard<mutex> lock(bufferMutex);
+        bufferFrames[k] = frames++;
+    }
+    bufferChanged.notify_all();
+    return true;
+}
+
+void FramePipeline::flush()
+{
+    unique_lock<mutex> lock(bufferMutex);
+    bufferChanged.wait(lock, [this] { return bufferFrames[0] < 0 && bufferFrames[1] < 0; });
+}
+
+void FramePipeline::close()
+{
+    if (!worker.joinable())
+        return;
+
+    {
+        lock_guard<mutex> lock(bufferMutex);
+        stopping = true;
+    }
+    bufferChanged.notify_all();
+    worker.join();
+}
+
+void FramePipeline::run()
+{
+    for (int frame = 0; ; ++frame)
+    {
+        int k = frame % 2;
+        {
+            unique_lock<mutex> lock(bufferMutex);
+            bufferChanged.wait(lock, [this, k] { return bufferFrames[k] >= 0 || stopping; });
+            if (bufferFrames[k] < 0)
+                return;
+        }
+
+        vector<Vertex> &vertices = buffers[k];
+        SurfaceBuilder::computeGridNormals(vertices, outWidth, outHeight);
+        if (kernelRadius > 0)
+        {
+            SurfaceBuilder::smoothNormalsWithKernel(vertices, outWidth, outHeight, kernel, kernelRadius, smoothed);
+            handler(frame, smoothed);
+        }
+        else
+            handler(frame, vertices);
+
+        {
+            lock_guard<mutex> lock(bufferMutex);
+            bufferFrames[k] = -1;
+        }
+        bufferChanged.notify_all();
+    }
+}
+
+Executor::Executor(int threads) : stopping(false)
+{
+    if (threads <= 0)
+        threads = max(1, (int)thread::hardware_concurrency());
+    for (int i = 0; i < threads; ++i)
+        workers.push_back(thread(&Executor::run, this));
+}
+
+Executor::~Executor()
+{
+    {
+        lock_guard<mutex> lock(taskMutex);
+        stopping = true;
+    }
+    taskAdded.notify_all();
+    for (int i = 0, n = workers.size(); i < n; ++i)
+        workers[i].join();
+}
+
+void Executor::submit(const function<void()> &task)
+{
+    {
+        lock_guard<mutex> lock(taskMutex);
+        tasks.push_back(task);
+    }
+    taskAdded.notify_one();
+}
+
+void Executor::run()
+{
+    while (true)
+    {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(taskMutex);
+            taskAdded.wait(lock, [this] { return !tasks.empty() || stopping; });
+            if (tasks.empty())
+                return;
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+class AsyncSurfaceBuilder::Job
+{
+public:
+    Executor *executor;
+    HeightField field;
+    int resolution;
+    double c;
+    int kernelRadius;
+    int chunkPatchRows;
+    ChunkHandler onChunk;
+    ProgressHandler onProgress;
+    CancellationToken token;
+
+    SurfaceModel model;
+    vector<float> kernel;
+    int outWidth, outHeight;
+    atomic<int> builtPatchRows;
+
+    mutex chunkMutex;
+    vector<shared_ptr<SurfaceChunk> > chunks;
+    int finishedChunks, handledChunks;
+    bool handling;
+    promise<bool> result;
+};
+
+future<bool> AsyncSurfaceBuilder::build(Executor &executor, const HeightField &inField, int resolution, double c, int kernelRadius,
+                                        int chunkPatchRows, const ChunkHandler &onChunk, const ProgressHandler &onProgress,
+                                        const CancellationToken &token)
+{
+    shared_ptr<Job> job = make_shared<Job>();
+    future<bool> result = job->result.get_future();
+    if (resolution < 2 || kernelRadius < 0 || chunkPatchRows < 1 || !onChunk)
+    {
+        job->result.set_value(false);
+        return result;
+    }
+
+    job->executor = &executor;
+    job->field = inField;
+    job->resolution = resolution;
+    job->c = c;
+    job->kernelRadius = kernelRadius;
+    job->chunkPatchRows = chunkPatchRows;
+    job->onChunk = onChunk;
+    job->onProgress = onProgress;
+    job->token = token;
+    job->builtPatchRows = 0;
+    job->finishedChunks = job->handledChunks = 0;
+    job->handling = false;
+    executor.submit([job] { prepare(job); });
+    return result;
+}
+
+void AsyncSurfaceBuilder::prepare(const shared_ptr<Job> &job)
+{
+    if (job->token.isCancelled() || !SurfaceBuilder::prepare(job->field, job->c, job->model))
+    {
+        job->result.set_value(false);
+        return;
+    }
+
+    if (job->kernelRadius > 0)
+        Math::calcGaussianKernel(job->kernelRadius, false, job->kernel);
+    SurfaceBuilder::getOutputSize(job->field.width(), job->field.height(), job->resolution, job->outWidth, job->outHeight);
+    int patchRows = job->field.height() - 1;
+    int n = (patchRows + job->chunkPatchRows - 1) / job->chunkPatchRows;
+    job->chunks.resize(n);
+    for (int i = 0; i < n; ++i)
+        job->executor->submit([job, i] { buildChunk(job, i); });
+}
+
+void AsyncSurfaceBuilder::buildChunk(const shared_ptr<Job> &job, int index)
+{
+    // Chunk rows are built with the halo of kernel radius + 1 rows, so the normals and their smoothing
+    // are the same as in the full grid.
+    int step = job->resolution - 1;
+    int patchRows = job->field.height() - 1;
+    int p0 = index * job->chunkPatchRows;
+    int p1 = min(patchRows, p0 + job->chunkPatchRows);
+    int z0 = p0 * step;
+    int z1 = p1 == patchRows ? job->outHeight : p1 * step;
+    int halo = job->kernelRadius + 1;
+    int rz0 = max(0, z0 - halo);
+    int rz1 = min(job->outHeight, z1 + halo);
+    int w = job->outWidth;
+
+    shared_ptr<SurfaceChunk> chunk;
+    vector<Vertex> region((rz1 - rz0) * w);
+    SurfaceBuilder::evaluate(job->model, job->resolution, 0, rz0, w, z0 - rz0, region.data(), w);
+    bool cancelled = false;
+    for (int p = p0; p < p1 && !cancelled; ++p)
+    {
+        cancelled = job->token.isCancelled();
+        if (cancelled)
+            break;
+
+        int r0 = p * step;
+        int r1 = p + 1 == p1 ? z1 : r0 + step;
+        SurfaceBuilder::evaluate(job->model, job->resolution, 0, r0, w, r1 - r0, region.data() + (r0 - rz0) * w, w);
+        int built = ++job->builtPatchRows;
+        if (job->onProgress)
+            job->onProgress(built, patchRows);
+    }
+    if (!cancelled)
+    {
+        SurfaceBuilder::evaluate(job->model, job->resolution, 0, z1, w, rz1 - z1, region.data() + (z1 - rz0) * w, w);
+        SurfaceBuilder::computeGridNormals(region, w, rz1 - rz0);
+        if (job->kernelRadius > 0)
+        {
+            vector<Vertex> smoothed;
+            SurfaceBuilder::smoothNormalsWithKernel(region, w, rz1 - rz0, job->kernel, job->kernelRadius, smoothed);
+            region.swap(smoothed);
+        }
+
+        chunk = make_shared<SurfaceChunk>();
+        chunk->index = index;
+        chunk->z0 = z0;
+        chunk->width = w;
+        chunk->height = z1 - z0;
+        chunk->vertices.assign(region.begin() + (z0 - rz0) * w, region.begin() + (z1 - rz0) * w);
+    }
+
+    // Chunks are handled in order by the thread which finishes the next one to handle, the others just leave theirs.
+    unique_lock<mutex> lock(job->chunkMutex);
+    job->chunks[index] = chunk;
+    ++job->finishedChunks;
+    if (job->handling)
+        return;
+
+    job->handling = true;
+    int n = job->chunks.size();
+    while (job->handledChunks < n && job->chunks[job->handledChunks] && !job->token.isCancelled())
+    {
+        shared_ptr<SurfaceChunk> next;
+        next.swap(job->chunks[job->handledChunks]);
+        lock.unlock();
+        job->onChunk(*next);
+        lock.lock();
+        ++job->handledChunks;
+    }
+    job->handling = false;
+
+    // The last finished chunk ends the job, nothing more can be handled after it.
+    if (job->finishedChunks == n)
+        job->result.set_value(job->handledChunks == n);
+}
+
+bool ProgressiveSurfaceBuilder::build(const HeightField &inField, int levels, double c, double budget, const LevelHandler &onLevel,
+                                      vector<Vertex> &outPoints, int &outWidth, int &outHeight)
+{
+    SurfaceModel model;
+    if (levels < 0 || levels > 16 || !onLevel || !SurfaceBuilder::prepare(inField, c, model))
+        return false;
+
+    int resolution = (1 << levels) + 1;
+    SurfaceBuilder::getOutputSize(inField.width(), inField.height(), resolution, outWidth, outHeight);
+    outPoints.resize(outWidth * outHeight);
+
+    // Each level has about four times as many new samples as the previous one, so it is expected to take
+    // four times longer. Levels are shown as soon as the next one is not expected to fit into the budget.
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    double elapsed = 0.0;
+    bool shown = false;
+    for (int level = 0; level <= levels; ++level)
+    {
+        int step = 1 << (levels - level);
+        SurfaceBuilder::evaluateLevel(model, resolution, step, level > 0, outPoints.data(), outWidth);
+
+        double levelTime = -elapsed;
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        levelTime += elapsed;
+        shown = shown || level == levels || elapsed + 4.0 * levelTime > budget;
+        if (shown && !onLevel(level, (1 << level) + 1, step))
+            return false;
+    }
+
+    return true;
+}
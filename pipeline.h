@@ -0,0 +1,313 @@
+/**
+ * pipeline.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides pipelines to build sequences of sleek surfaces.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_PIPELINE_H__
+#define __SLEEKSURFACE_PIPELINE_H__
+
+#include "surface.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The FramePipeline class builds sleek surfaces for a sequence of height fields of the same size,
+     * e.g. frames of an animation. Topology and Gaussian kernel are built once, vertex buffers are reused
+     * between frames, and the surface of the next frame is built on the calling thread while the normals of the
+     * previous one are computed, smoothed and handed to the frame handler on the pipeline's worker thread.
+     */
+    class FramePipeline
+    {
+    public:
+        /**
+         * Frame handler, called on the worker thread in the order of frames.
+         * Vertices are valid only during the call.
+         */
+        typedef function<void(int frame, const vector<Vertex> &vertices)> FrameHandler;
+
+    private:
+        int inWidth, inHeight;
+        int resolution;
+        double c;
+        int kernelRadius;
+        vector<float> kernel;
+        int outWidth, outHeight;
+        vector<int> indices;
+        FrameHandler handler;
+
+        SurfaceModel model;
+        vector<Vertex> buffers[2];
+        vector<Vertex> smoothed;
+        int frames;
+
+        thread worker;
+        mutex bufferMutex;
+        condition_variable bufferChanged;
+        int bufferFrames[2];
+        bool stopping;
+
+        void run();
+
+    public:
+        /**
+         * FramePipeline constructor.
+         */
+        FramePipeline();
+        /**
+         * FramePipeline destructor, waits for the pushed frames to be handled.
+         */
+        ~FramePipeline();
+
+        /**
+         * Prepare the pipeline and start its worker thread.
+         *
+         * @param _inWidth, _inHeight - resolution of input height fields.
+         * @param _resolution - resolution of each coons patch.
+         * @param _c - paramenet affecting curvature, should be in [2; +inf).
+         * @param _kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @param _handler - handler of the built frames.
+         * @return true if pipeline is successfully prepared, false if not.
+         */
+        bool init(int _inWidth, int _inHeight, int _resolution, double _c, int _kernelRadius, const FrameHandler &_handler);
+        /**
+         * Build the surface of the next frame. Returns as soon as the surface is built, its normals are computed
+         * and handled in background while the next frame is pushed.
+         *
+         * @param inField - regular grid of 3D points or heights of the frame, it can be changed or destroyed
+         * after the call.
+         * @return true if frame is successfully built, false if not.
+         */
+        bool push(const HeightField &inField);
+        /**
+         * Wait for all the pushed frames to be handled.
+         */
+        void flush();
+        /**
+         * Wait for all the pushed frames to be handled and stop the worker thread.
+         */
+        void close();
+
+        /**
+         * Get output grid width.
+         *
+         * @return number of vertices in the output grid row.
+         */
+        int width() const { return outWidth; };
+        /**
+         * Get output grid height.
+         *
+         * @return number of vertices in the output grid column.
+         */
+        int height() const { return outHeight; };
+        /**
+         * Get triangles of the output grid, the same for all frames.
+         *
+         * @return vertex indices built by <code>SurfaceBuilder::triangulateGrid</code>.
+         */
+        const vector<int> &getIndices() const { return indices; };
+    };
+
+    /**
+     * The Executor class is a pool of worker threads running submitted tasks in the order of submission.
+     * One executor can be shared by any number of pipelines.
+     */
+    class Executor
+    {
+        vector<thread> workers;
+        deque<function<void()> > tasks;
+        mutex taskMutex;
+        condition_variable taskAdded;
+        bool stopping;
+
+        void run();
+
+    public:
+        /**
+         * Executor constructor.
+         *
+         * @param threads - number of worker threads, 0 to use the number of hardware threads.
+         */
+        explicit Executor(int threads = 0);
+        /**
+         * Executor destructor, waits for the submitted tasks to finish.
+         */
+        ~Executor();
+
+        /**
+         * Submit a task.
+         *
+         * @param task - task to run on one of the worker threads.
+         */
+        void submit(const function<void()> &task);
+    };
+
+    /**
+     * The CancellationToken class allows to stop asynchronous operations cooperatively.
+     * Copies of the token share the same state.
+     */
+    class CancellationToken
+    {
+        shared_ptr<atomic<bool> > cancelled;
+
+    public:
+        /**
+         * CancellationToken constructor.
+         */
+        CancellationToken() : cancelled(make_shared<atomic<bool> >(false)) {};
+
+        /**
+         * Request the operations using this token to stop.
+         */
+        void cancel() { *cancelled = true; };
+        /**
+         * Check if cancellation is requested.
+         *
+         * @return true if operations should stop, false if not.
+         */
+        bool isCancelled() const { return *cancelled; };
+    };
+
+    /**
+     * The SurfaceChunk class stores a band of rows of the output grid built asynchronously.
+     */
+    class SurfaceChunk
+    {
+    public:
+        /**
+         * Index of the chunk, chunks go from top to bottom.
+         */
+        int index;
+        /**
+         * First row of the chunk in the output grid.
+         */
+        int z0;
+        /**
+         * Resolution of the chunk, width is the same as the output grid width.
+         */
+        int width, height;
+        /**
+         * Vertices of the chunk rows with smoothed normals, the same as in the full output grid.
+         */
+        vector<Vertex> vertices;
+
+        /**
+         * SurfaceChunk constructor.
+         */
+        SurfaceChunk() : index(0), z0(0), width(0), height(0) {};
+    };
+
+    /**
+     * The AsyncSurfaceBuilder static class builds sleek surfaces on the executor.
+     * Curves are built first, then the output grid is split into bands of patch rows, which are built,
+     * get normals computed and smoothed in parallel, and are handed over in order as soon as they are ready,
+     * so the first rows can be exported while the last ones are still being built.
+     */
+    class AsyncSurfaceBuilder
+    {
+    public:
+        /**
+         * Chunk handler, called in the order of chunks, never concurrently.
+         */
+        typedef function<void(const SurfaceChunk &chunk)> ChunkHandler;
+        /**
+         * Progress handler, called on the executor threads each time a patch row is built.
+         */
+        typedef function<void(int builtPatchRows, int totalPatchRows)> ProgressHandler;
+
+    private:
+        class Job;
+
+        static void prepare(const shared_ptr<Job> &job);
+        static void buildChunk(const shared_ptr<Job> &job, int index);
+
+    public:
+        /**
+         * Start building a surface.
+         *
+         * @param executor - executor to run the stages on.
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * It is not copied and has to stay alive and unchanged until the build is finished.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @param chunkPatchRows - number of patch rows in each chunk.
+         * @param onChunk - handler of the built chunks.
+         * @param onProgress - handler of the progress, can be empty.
+         * @param token - cancellation token, checked before each patch row and each chunk handling.
+         * @return future becoming true when all the chunks are handled, or false if build failed or was cancelled.
+         */
+        static future<bool> build(Executor &executor, const HeightField &inField, int resolution, double c, int kernelRadius,
+                                  int chunkPatchRows, const ChunkHandler &onChunk,
+                                  const ProgressHandler &onProgress = ProgressHandler(),
+                                  const CancellationToken &token = CancellationToken());
+    };
+
+    /**
+     * The ProgressiveSurfaceBuilder static class builds sleek surfaces for interactive previews.
+     * The output grid is built in levels of resolution 2, 3, 5, 9, ... 2^n + 1, each level refining the previous one
+     * in place: samples of a coarser level coincide with the samples of the finer ones, so only the missing samples
+     * are evaluated and the whole sequence costs about the same as building the finest level directly.
+     */
+    class ProgressiveSurfaceBuilder
+    {
+    public:
+        /**
+         * Level handler, called on the building thread after each level starting from the first shown one.
+         * Samples of the level are the points of the output grid with both indices divisible by the step.
+         * Returns true to continue refinement, false to stop it.
+         */
+        typedef function<bool(int level, int resolution, int step)> LevelHandler;
+
+        /**
+         * Build a surface progressively.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param levels - number of refinement levels, the final resolution of each coons patch is 2^levels + 1.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param budget - latency budget in seconds. The first level shown is the finest one expected to be ready
+         * within the budget, 0 shows all the levels.
+         * @param onLevel - handler of the built levels.
+         * @param outPoints - regular grid of 3D points of the final resolution, refined in place.
+         * @param outWidth, outHeight - resolution of output grid.
+         * @return true if all the levels are built, false if building failed or was stopped by the handler.
+         */
+        static bool build(const HeightField &inField, int levels, double c, double budget, const LevelHandler &onLevel,
+                          vector<Vertex> &outPoints, int &outWidth, int &outHeight);
+    };
+}
+
+#endif // __SLEEKSURFACE_PIPELINE_H__
@@ -0,0 +1,312 @@
+/**
+ * raster.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides data structures and functions to read and write raster grids.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "raster.h"
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+using namespace SleekSurface;
+
+bool RasterFile::open(const string &path)
+{
+    close();
+
+    ifstream header((path + ".hdr").c_str());
+    if (!header)
+        return false;
+
+    int width = 0, height = 0;
+    HeightField::Type type = HeightField::POINTS;
+    size_t offset = 0, stride = 0;
+    double originX = 0.0, originZ = 0.0, stepX = 1.0, stepZ = 1.0, scale = 1.0, zero = 0.0;
+    string key;
+    while (header >> key)
+    {
+        if (key == "width")
+            header >> width;
+        else if (key == "height")
+            header >> height;
+        else if (key == "offset")
+            header >> offset;
+        else if (key == "stride")
+            header >> stride;
+        else if (key == "origin")
+            header >> originX >> originZ;
+        else if (key == "step")
+            header >> stepX >> stepZ;
+        else if (key == "scale")
+            header >> scale;
+        else if (key == "zero")
+            header >> zero;
+        else if (key == "type")
+        {
+            string value;
+            header >> value;
+            if (value == "float32")
+                type = HeightField::FLOAT32;
+            else if (value == "float64")
+                type = HeightField::FLOAT64;
+            else if (value == "int16")
+                type = HeightField::INT16;
+            else
+                return false;
+        }
+        else
+            return false;
+        if (header.fail())
+            return false;
+    }
+
+    if (width < 1 || height < 1 || type == HeightField::POINTS)
+        return false;
+    size_t rowSize = width * HeightField::elementSize(type);
+    if (stride == 0)
+        stride = rowSize;
+    if (stride < rowSize)
+        return false;
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < offset + (height - 1) * stride + rowSize)
+    {
+        close();
+        return false;
+    }
+    mappingSize = st.st_size;
+    void *ptr = mmap(0, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    mapping = ptr;
+    dataOffset = offset;
+    rowStride = stride;
+
+    grid = HeightField(type, (const unsigned char *)mapping + offset, width, height, stride, originX, originZ, stepX, stepZ);
+    grid.setHeightTransform(scale, zero);
+    return true;
+}
+
+void RasterFile::close()
+{
+    if (mapping)
+        munmap(mapping, mappingSize);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    mapping = 0;
+    mappingSize = 0;
+    grid = HeightField();
+}
+
+void RasterFile::advise(int z0, int z1, int advice)
+{
+    if (!mapping)
+        return;
+    if (z0 < 0)
+        z0 = 0;
+    if (z1 > grid.height())
+        z1 = grid.height();
+    if (z0 >= z1)
+        return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = (dataOffset + z0 * rowStride) / page * page;
+    size_t end = dataOffset + z1 * rowStride;
+    if (end > mappingSize)
+        end = mappingSize;
+    madvise((char *)mapping + begin, end - begin, advice);
+}
+
+void RasterFile::adviseSequential()
+{
+    if (mapping)
+        madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+}
+
+void RasterFile::prefetchRows(int z0, int z1)
+{
+    advise(z0, z1, MADV_WILLNEED);
+}
+
+void RasterFile::releaseRows(int z0, int z1)
+{
+    advise(z0, z1, MADV_DONTNEED);
+}
+
+bool RasterWriter::writeHeights(const string &path, const vector<Vertex> &vertices, int width, int height, Format format)
+{
+    if (width < 1 || height < 1 || vertices.size() != (size_t)width * height)
+        return false;
+
+    ofstream out(path.c_str(), ios::binary);
+    if (!out)
+        return false;
+
+    if (format == FLOAT32)
+    {
+        vector<float> row(width);
+        for (int z = 0; z < height; ++z)
+        {
+            const Vertex *v = &vertices[z * width];
+            for (int x = 0; x < width; ++x)
+                row[x] = (float)v[x].position.y;
+            out.write((const char *)row.data(), width * sizeof(float));
+        }
+        if (!out)
+            return false;
+
+        // Sidecar for RasterFile, spacing is taken from the first grid cell.
+        ofstream header((path + ".hdr").c_str());
+        header.precision(17);
+        header << "width " << width << endl;
+        header << "height " << height << endl;
+        header << "type float32" << endl;
+        header << "origin " << vertices[0].position.x << " " << vertices[0].position.z << endl;
+        header << "step " << (width > 1 ? vertices[1].position.x - vertices[0].position.x : 1.0) << " " <<
+                  (height > 1 ? vertices[width].position.z - vertices[0].position.z : 1.0) << endl;
+        return (bool)header;
+    }
+
+    double minY = vertices[0].position.y;
+    double maxY = minY;
+    for (int i = 1, n = vertices.size(); i < n; ++i)
+    {
+        double y = vertices[i].position.y;
+        if (y < minY)
+            minY = y;
+        else if (y > maxY)
+            maxY = y;
+    }
+    double scale = Math::isZero(maxY - minY) ? 0.0 : 65535.0 / (maxY - minY);
+
+    out.precision(17);
+    out << "P5" << endl << "# height range " << minY << " " << maxY << endl << width << " " << height << endl << 65535 << endl;
+    vector<unsigned char> row(width * 2);
+    for (int z = 0; z < height; ++z)
+    {
+        const Vertex *v = &vertices[z * width];
+        for (int x = 0; x < width; ++x)
+        {
+            // PGM stores 16-bit samples in big-endian order.
+            int q = (int)((v[x].position.y - minY) * scale + 0.5);
+            row[x * 2] = (unsigned char)(q >> 8);
+            row[x * 2 + 1] = (unsigned char)(q & 0xFF);
+        }
+        out.write((const char *)row.data(), row.size());
+    }
+    return (bool)out;
+}
+
+bool RasterWriter::writeNormalMap(const string &path, const vector<Vertex> &vertices, int width, int height)
+{
+    if (width < 1 || height < 1 || vertices.size() != (size_t)width * height)
+        return false;
+
+    ofstream out(path.c_str(), ios::binary);
+    if (!out)
+        return false;
+
+    out << "P6" << endl << width << " " << height << endl << 255 << endl;
+    vector<unsigned char> row(width * 3);
+    for (int z = 0; z < height; ++z)
+    {
+        const Vertex *v = &vertices[z * width];
+        for (int x = 0; x < width; ++x)
+        {
+            const Vec3 &n = v[x].normal;
+            row[x * 3] = (unsigned char)((n.x * 0.5 + 0.5) * 255.0 + 0.5);
+            row[x * 3 + 1] = (unsigned char)((n.y * 0.5 + 0.5) * 255.0 + 0.5);
+            row[x * 3 + 2] = (unsigned char)((n.z * 0.5 + 0.5) * 255.0 + 0.5);
+        }
+        out.write((const char *)row.data(), row.size());
+    }
+    return (bool)out;
+}
+
+bool RasterWriter::writeSurface(const string &path, RasterFile &raster, int resolution, double c, int bandRows)
+{
+    const HeightField &field = raster.field();
+    if (!raster.isOpen() || field.width() < 2 || field.height() < 2 || resolution < 2 || bandRows < 1)
+        return false;
+
+    ofstream out(path.c_str(), ios::binary);
+    if (!out)
+        return false;
+
+    // Input rows are prefetched one band ahead of the band being built.
+    int width, height;
+    SurfaceBuilder::getOutputSize(field.width(), field.height(), resolution, width, height);
+    raster.adviseSequential();
+    raster.prefetchRows(0, 2 * bandRows + 2);
+    int released = 0;
+    double originX = 0.0, originZ = 0.0, stepX = 1.0, stepZ = 1.0;
+    vector<float> row(width);
+    bool written = SurfaceBuilder::buildBanded(field, resolution, c, bandRows, [&](int z, int rows, const Vertex *points)
+    {
+        if (z == 0)
+        {
+            originX = points[0].position.x;
+            originZ = points[0].position.z;
+            stepX = points[1].position.x - points[0].position.x;
+        }
+        for (int i = 0; i < rows; ++i)
+        {
+            const Vertex *v = points + (size_t)i * width;
+            if (z + i == 1)
+                stepZ = v[0].position.z - originZ;
+            for (int x = 0; x < width; ++x)
+                row[x] = (float)v[x].position.y;
+            out.write((const char *)row.data(), width * sizeof(float));
+        }
+        return (bool)out;
+    },
+    [&](int z0, int z1)
+    {
+        raster.prefetchRows(z1, z1 + bandRows);
+        raster.releaseRows(released, z0);
+        released = max(released, z0);
+    });
+    if (!written)
+        return false;
+
+    // Sidecar for RasterFile, spacing is taken from the first grid cell.
+    ofstream header((path + ".hdr").c_str());
+    header.precision(17);
+    header << "width " << width << endl;
+    header << "height " << height << endl;
+    header << "type float32" << endl;
+    header << "origin " << originX << " " << originZ << endl;
+    header << "step " << stepX << " " << stepZ << endl;
+    return (bool)header;
+}
@@ -0,0 +1,182 @@
+/**
+ * raster.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides data structures and functions to read and write raster grids.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_RASTER_H__
+#define __SLEEKSURFACE_RASTER_H__
+
+#include "surface.h"
+#include <string>
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The RasterFile class provides memory-mapped read-only access to the headerless binary height raster.
+     * The raster is described by the text sidecar file with the same name and ".hdr" suffix,
+     * which contains "key value" lines:
+     *
+     *   width 4096          - number of columns (required).
+     *   height 4096         - number of rows (required).
+     *   type float32        - element type: float32, float64 or int16 (required).
+     *   offset 0            - offset of the first element in the raster file in bytes.
+     *   stride 16384        - distance between rows in bytes, defaults to width * element size.
+     *   origin 0 0          - x and z coordinates of the first element.
+     *   step 1 1            - distance between neighbouring elements along x and z.
+     *   scale 1             - int16 only: height = zero + scale * value.
+     *   zero 0              - int16 only: height of the zero value.
+     *
+     * Elements are expected in the native byte order. The file is never copied into memory:
+     * the grid view returned by <code>field</code> points directly to the mapped pages,
+     * so reading a file larger than RAM is left to the page cache. Note that <code>SurfaceBuilder::prepare</code>
+     * stores the curve segments of every row and column, which takes about 128 bytes per sample, so rasters larger
+     * than RAM have to be built band by band by <code>RasterWriter::writeSurface</code>.
+     */
+    class RasterFile
+    {
+        int fd;
+        void *mapping;
+        size_t mappingSize;
+        size_t dataOffset;
+        size_t rowStride;
+        HeightField grid;
+
+        RasterFile(const RasterFile &);
+        RasterFile &operator =(const RasterFile &);
+
+        void advise(int z0, int z1, int advice);
+
+    public:
+        /**
+         * RasterFile constructor.
+         */
+        RasterFile() : fd(-1), mapping(0), mappingSize(0), dataOffset(0), rowStride(0) {};
+        /**
+         * RasterFile destructor. Unmaps the file.
+         */
+        ~RasterFile() { close(); };
+
+        /**
+         * Map raster file.
+         *
+         * @param path - path to the raster file. Its sidecar has to be located at path + ".hdr".
+         * @return true if file is successfully mapped, false if not.
+         */
+        bool open(const string &path);
+        /**
+         * Unmap raster file.
+         */
+        void close();
+
+        /**
+         * Test if raster file is mapped.
+         *
+         * @return true if file is mapped, false if not.
+         */
+        bool isOpen() const { return mapping != 0; };
+
+        /**
+         * Get grid view of mapped raster. It stays valid until the file is closed.
+         *
+         * @return grid view.
+         */
+        const HeightField &field() const { return grid; };
+
+        /**
+         * Hint the kernel that the raster will be read sequentially row by row,
+         * so it reads ahead aggressively and frees pages behind.
+         */
+        void adviseSequential();
+        /**
+         * Hint the kernel that rows in [z0; z1) will be needed soon, so it starts reading them in background.
+         *
+         * @param z0, z1 - range of rows.
+         */
+        void prefetchRows(int z0, int z1);
+        /**
+         * Hint the kernel that rows in [z0; z1) will not be needed anymore, so their pages can be dropped.
+         *
+         * @param z0, z1 - range of rows.
+         */
+        void releaseRows(int z0, int z1);
+    };
+
+    /**
+     * The RasterWriter static class provides methods to store built surface as images instead of meshes.
+     * Rows are written through the single row buffer, so no full-size copy of the output is made.
+     */
+    class RasterWriter
+    {
+    public:
+        /**
+         * Formats of height rasters.
+         */
+        enum Format
+        {
+            FLOAT32, // Headerless float32 raster with ".hdr" sidecar readable by RasterFile.
+            PGM16    // 16-bit binary PGM image, heights are quantized linearly between their minimum and maximum.
+        };
+
+        /**
+         * Write heights of the regular grid.
+         *
+         * @param path - output file path.
+         * @param vertices - regular grid of 3D points, for example built by <code>SurfaceBuilder::build</code>.
+         * @param width, height - resolution of the grid.
+         * @param format - output file format.
+         * @return true if file is successfully written, false if not.
+         */
+        static bool writeHeights(const string &path, const vector<Vertex> &vertices, int width, int height, Format format);
+        /**
+         * Write vertex normals of the regular grid as 8-bit binary PPM normal map.
+         * Each normal component is mapped from [-1; 1] to [0; 255] and stored in RGB order as x, y, z.
+         *
+         * @param path - output file path.
+         * @param vertices - regular grid of 3D points with computed normals.
+         * @param width, height - resolution of the grid.
+         * @return true if file is successfully written, false if not.
+         */
+        static bool writeNormalMap(const string &path, const vector<Vertex> &vertices, int width, int height);
+        /**
+         * Build the surface of the mapped raster band by band by <code>SurfaceBuilder::buildBanded</code> and write
+         * its heights as FLOAT32 raster, so neither the input nor the output grid has to fit into memory.
+         * The raster is advised to be read sequentially, the input rows of the next band are prefetched while
+         * the current one is built, and the rows left behind are released.
+         *
+         * @param path - output file path.
+         * @param raster - mapped input raster.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param bandRows - number of patch rows in each band.
+         * @return true if file is successfully written, false if not.
+         */
+        static bool writeSurface(const string &path, RasterFile &raster, int resolution, double c, int bandRows);
+    };
+}
+
+#endif // __SLEEKSURFACE_RASTER_H__
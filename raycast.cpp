@@ -0,0 +1,256 @@
+/**
+ * raycast.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides data structures and functions to intersect rays with sleek surfaces.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "raycast.h"
+
+
+using namespace SleekSurface;
+
+bool SurfaceRaycaster::init(const vector<Vertex> &_vertices, int _width, int _height)
+{
+    levels.clear();
+    levelWidths.clear();
+    levelHeights.clear();
+    vertices = 0;
+    if (_width < 2 || _height < 2 || _vertices.size() != (size_t)_width * _height)
+        return false;
+
+    vertices = _vertices.data();
+    width = _width;
+    height = _height;
+
+    // Level 0 contains grid cells, each next level merges 2x2 nodes of the previous one.
+    int lw = width - 1;
+    int lh = height - 1;
+    levels.push_back(vector<Bounds>(lw * lh));
+    levelWidths.push_back(lw);
+    levelHeights.push_back(lh);
+    #pragma omp parallel for schedule(static)
+    for (int z = 0; z < lh; ++z)
+    {
+        for (int x = 0; x < lw; ++x)
+        {
+            Bounds &b = levels[0][z * lw + x];
+            b.boundsMin = b.boundsMax = vertices[z * width + x].position;
+            for (int i = 1; i < 4; ++i)
+            {
+                const Vec3 &p = vertices[(z + i / 2) * width + x + i % 2].position;
+                b.boundsMin = Vec3(min(b.boundsMin.x, p.x), min(b.boundsMin.y, p.y), min(b.boundsMin.z, p.z));
+                b.boundsMax = Vec3(max(b.boundsMax.x, p.x), max(b.boundsMax.y, p.y), max(b.boundsMax.z, p.z));
+            }
+        }
+    }
+
+    while (lw > 1 || lh > 1)
+    {
+        int pw = lw;
+        int ph = lh;
+        lw = (pw + 1) / 2;
+        lh = (ph + 1) / 2;
+        levels.push_back(vector<Bounds>(lw * lh));
+        levelWidths.push_back(lw);
+        levelHeights.push_back(lh);
+        const vector<Bounds> &prev = levels[levels.size() - 2];
+        vector<Bounds> &cur = levels.back();
+        for (int z = 0; z < lh; ++z)
+        {
+            for (int x = 0; x < lw; ++x)
+            {
+                Bounds &b = cur[z * lw + x];
+                b = prev[z * 2 * pw + x * 2];
+                for (int i = 1; i < 4; ++i)
+                {
+                    int cx = x * 2 + i % 2;
+                    int cz = z * 2 + i / 2;
+                    if (cx >= pw || cz >= ph)
+                        continue;
+                    const Bounds &c = prev[cz * pw + cx];
+                    b.boundsMin = Vec3(min(b.boundsMin.x, c.boundsMin.x), min(b.boundsMin.y, c.boundsMin.y), min(b.boundsMin.z, c.boundsMin.z));
+                    b.boundsMax = Vec3(max(b.boundsMax.x, c.boundsMax.x), max(b.boundsMax.y, c.boundsMax.y), max(b.boundsMax.z, c.boundsMax.z));
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool SurfaceRaycaster::intersectBounds(const Bounds &b, const Vec3 &origin, const Vec3 &invDirection, double maxT, double &tMin)
+{
+    const double o[3] = { origin.x, origin.y, origin.z };
+    const double d[3] = { invDirection.x, invDirection.y, invDirection.z };
+    const double lo[3] = { b.boundsMin.x, b.boundsMin.y, b.boundsMin.z };
+    const double hi[3] = { b.boundsMax.x, b.boundsMax.y, b.boundsMax.z };
+    double t0 = 0.0;
+    double t1 = maxT;
+    for (int i = 0; i < 3; ++i)
+    {
+        if (isinf(d[i]))
+        {
+            // Ray is parallel to the slab.
+            if (o[i] < lo[i] || o[i] > hi[i])
+                return false;
+            continue;
+        }
+        double tNear = (lo[i] - o[i]) * d[i];
+        double tFar = (hi[i] - o[i]) * d[i];
+        if (tNear > tFar)
+            swap(tNear, tFar);
+        t0 = max(t0, tNear);
+        t1 = min(t1, tFar);
+        if (t0 > t1)
+            return false;
+    }
+    tMin = t0;
+    return true;
+}
+
+bool SurfaceRaycaster::intersectCell(int x, int z, const Ray &ray, RayHit &hit) const
+{
+    // Cell triangles are the same as in triangulateGrid.
+    const int tl = z * width + x;
+    const int tr = tl + 1;
+    const int bl = tl + width;
+    const int br = bl + 1;
+    const int triangles[2][3] = { { tr, tl, bl }, { bl, br, tr } };
+    bool found = false;
+    for (int i = 0; i < 2; ++i)
+    {
+        // Moller-Trumbore intersection.
+        const Vertex &v0 = vertices[triangles[i][0]];
+        const Vertex &v1 = vertices[triangles[i][1]];
+        const Vertex &v2 = vertices[triangles[i][2]];
+        Vec3 e1 = v1.position - v0.position;
+        Vec3 e2 = v2.position - v0.position;
+        Vec3 p = Vec3::cross(ray.direction, e2);
+        double det = e1.x * p.x + e1.y * p.y + e1.z * p.z;
+        if (det == 0.0)
+            continue;
+        double invDet = 1.0 / det;
+        Vec3 s = ray.origin - v0.position;
+        double u = (s.x * p.x + s.y * p.y + s.z * p.z) * invDet;
+        if (u < 0.0 || u > 1.0)
+            continue;
+        Vec3 q = Vec3::cross(s, e1);
+        double v = (ray.direction.x * q.x + ray.direction.y * q.y + ray.direction.z * q.z) * invDet;
+        if (v < 0.0 || u + v > 1.0)
+            continue;
+        double t = (e2.x * q.x + e2.y * q.y + e2.z * q.z) * invDet;
+        if (t < 0.0 || t > ray.maxT || (hit.hit && t >= hit.t))
+            continue;
+
+        hit.hit = true;
+        hit.t = t;
+        hit.position = ray.origin + ray.direction * t;
+        hit.normal = v0.normal * (1.0 - u - v) + v1.normal * u + v2.normal * v;
+        hit.normal.normalize();
+        if (hit.normal.x == 0.0 && hit.normal.y == 0.0 && hit.normal.z == 0.0)
+        {
+            hit.normal = Math::normal(v0.position, v1.position, v2.position);
+            hit.normal.normalize();
+        }
+        hit.cellX = x;
+        hit.cellZ = z;
+        found = true;
+    }
+    return found;
+}
+
+bool SurfaceRaycaster::intersect(const Ray &ray, RayHit &hit) const
+{
+    hit = RayHit();
+    if (levels.empty())
+        return false;
+
+    Vec3 invDirection(1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z);
+
+    // Depth-first traversal visiting nearer children first, so the farther ones are culled by the found hit.
+    class Node
+    {
+    public:
+        int level, x, z;
+        double t;
+    };
+    vector<Node> stack;
+    stack.reserve(levels.size() * 4);
+    Node root;
+    root.level = levels.size() - 1;
+    root.x = root.z = 0;
+    if (!intersectBounds(levels[root.level][0], ray.origin, invDirection, ray.maxT, root.t))
+        return false;
+    stack.push_back(root);
+
+    while (!stack.empty())
+    {
+        Node node = stack.back();
+        stack.pop_back();
+        if (hit.hit && node.t > hit.t)
+            continue;
+
+        if (node.level == 0)
+        {
+            intersectCell(node.x, node.z, ray, hit);
+            continue;
+        }
+
+        int child = node.level - 1;
+        int cw = levelWidths[child];
+        int ch = levelHeights[child];
+        Node children[4];
+        int n = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            Node c;
+            c.level = child;
+            c.x = node.x * 2 + i % 2;
+            c.z = node.z * 2 + i / 2;
+            if (c.x >= cw || c.z >= ch)
+                continue;
+            if (!intersectBounds(levels[child][c.z * cw + c.x], ray.origin, invDirection, hit.hit ? hit.t : ray.maxT, c.t))
+                continue;
+            // Insertion sort by descending distance, so the nearest child is pushed last.
+            int j = n++;
+            while (j > 0 && children[j - 1].t < c.t)
+            {
+                children[j] = children[j - 1];
+                --j;
+            }
+            children[j] = c;
+        }
+        for (int i = 0; i < n; ++i)
+            stack.push_back(children[i]);
+    }
+    return hit.hit;
+}
+
+void SurfaceRaycaster::intersect(const vector<Ray> &rays, vector<RayHit> &hits) const
+{
+    int n = rays.size();
+    hits.resize(n);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < n; ++i)
+        intersect(rays[i], hits[i]);
+}
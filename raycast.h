@@ -0,0 +1,161 @@
+/**
+ * raycast.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides data structures and functions to intersect rays with sleek surfaces.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_RAYCAST_H__
+#define __SLEEKSURFACE_RAYCAST_H__
+
+#include "common.h"
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The Ray class stores ray to cast.
+     */
+    class Ray
+    {
+    public:
+        /**
+         * Ray origin.
+         */
+        Vec3 origin;
+        /**
+         * Ray direction, does not have to be normalized.
+         */
+        Vec3 direction;
+        /**
+         * Maximum ray parameter, intersections further than origin + direction * maxT are ignored.
+         */
+        double maxT;
+
+        /**
+         * Ray constructor.
+         */
+        Ray() : maxT(HUGE_VAL) {};
+        /**
+         * Ray constructor.
+         *
+         * @param _origin - ray origin.
+         * @param _direction - ray direction.
+         * @param _maxT - maximum ray parameter.
+         */
+        Ray(const Vec3 &_origin, const Vec3 &_direction, double _maxT = HUGE_VAL) :
+            origin(_origin), direction(_direction), maxT(_maxT) {};
+    };
+
+    /**
+     * The RayHit class stores result of the ray cast.
+     */
+    class RayHit
+    {
+    public:
+        /**
+         * Flag determining if ray hits the surface (true) or not (false).
+         */
+        bool hit;
+        /**
+         * Ray parameter of the hit point.
+         */
+        double t;
+        /**
+         * Hit point.
+         */
+        Vec3 position;
+        /**
+         * Surface normal in the hit point.
+         */
+        Vec3 normal;
+        /**
+         * Grid cell containing the hit point.
+         */
+        int cellX, cellZ;
+
+        /**
+         * RayHit constructor.
+         */
+        RayHit() : hit(false), t(0.0), cellX(-1), cellZ(-1) {};
+    };
+
+    /**
+     * The SurfaceRaycaster class provides methods to intersect rays with the regular grid triangulated by
+     * <code>SurfaceBuilder::triangulateGrid</code>. It builds quadtree of cell bounding boxes with minimum and
+     * maximum heights, so each ray visits only the cells along its path instead of all the triangles.
+     * The grid is not copied and has to stay alive and unchanged while raycaster is used.
+     */
+    class SurfaceRaycaster
+    {
+        class Bounds
+        {
+        public:
+            Vec3 boundsMin, boundsMax;
+        };
+
+        const Vertex *vertices;
+        int width, height;
+        vector<vector<Bounds> > levels;
+        vector<int> levelWidths, levelHeights;
+
+        static bool intersectBounds(const Bounds &b, const Vec3 &origin, const Vec3 &invDirection, double maxT, double &tMin);
+        bool intersectCell(int x, int z, const Ray &ray, RayHit &hit) const;
+
+    public:
+        /**
+         * SurfaceRaycaster constructor.
+         */
+        SurfaceRaycaster() : vertices(0), width(0), height(0) {};
+
+        /**
+         * Build the quadtree for the grid.
+         *
+         * @param _vertices - regular grid of 3D points. If the normals are computed, hit normals are interpolated
+         * from them, otherwise triangle normals are used.
+         * @param _width, _height - resolution of the grid.
+         * @return true if grid is valid, false if not.
+         */
+        bool init(const vector<Vertex> &_vertices, int _width, int _height);
+
+        /**
+         * Find the nearest intersection of the ray with the surface.
+         *
+         * @param ray - ray to cast.
+         * @param hit - output intersection.
+         * @return true if ray hits the surface, false if not.
+         */
+        bool intersect(const Ray &ray, RayHit &hit) const;
+        /**
+         * Find the nearest intersections of many rays in parallel.
+         *
+         * @param rays - rays to cast.
+         * @param hits - output intersections, one per ray.
+         */
+        void intersect(const vector<Ray> &rays, vector<RayHit> &hits) const;
+    };
+}
+
+#endif // __SLEEKSURFACE_RAYCAST_H__
@@ -0,0 +1,310 @@
+/**
+ * simplify.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides functions to simplify sleek surfaces into triangulated irregular networks.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "simplify.h"
+#include <unordered_map>
+
+
+using namespace SleekSurface;
+
+bool SurfaceSimplifier::simplify(const HeightField &inField, int resolution, double c, double maxError, int tileSize,
+                                 vector<Vertex> &outVertices, vector<int> &outIndices)
+{
+    SurfaceModel model;
+    if (!SurfaceBuilder::prepare(inField, c, model))
+        return false;
+
+    return simplify(model, resolution, maxError, tileSize, outVertices, outIndices);
+}
+
+bool SurfaceSimplifier::simplify(const SurfaceModel &model, int resolution, double maxError, int tileSize,
+                                 vector<Vertex> &outVertices, vector<int> &outIndices)
+{
+    if (resolution < 2 || !(maxError >= 0.0 && maxError < HUGE_VAL) || tileSize < 2 || (tileSize & (tileSize - 1)) != 0)
+        return false;
+
+    int outWidth, outHeight;
+    SurfaceBuilder::getOutputSize(model.grid().width(), model.grid().height(), resolution, outWidth, outHeight);
+    int nx = (outWidth - 1 + tileSize - 1) / tileSize;
+    int nz = (outHeight - 1 + tileSize - 1) / tileSize;
+    int n = nx * nz;
+    vector<Tile> tiles(n);
+    for (int i = 0; i < n; ++i)
+    {
+        tiles[i].dirty = true;
+        tiles[i].borders.assign(SIDES * (tileSize + 1), 0.0);
+    }
+
+    // Each tile takes errors of the border points found by its neighbours as the lower bounds of its own ones,
+    // the tiles are processed again while the errors grow. Errors do not decrease, so it stops, and then each
+    // border point has the same error in both tiles and is split by both of them or by none.
+    bool dirty = true;
+    while (dirty)
+    {
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < n; ++i)
+        {
+            if (tiles[i].dirty)
+                processTile(model, resolution, tileSize, outWidth, outHeight, tiles, nx, nz, i, maxError);
+        }
+
+        vector<bool> changed(n, false);
+        for (int i = 0; i < n; ++i)
+        {
+            Tile &tile = tiles[i];
+            if (tile.dirty && tile.newBorders != tile.borders)
+            {
+                changed[i] = true;
+                tile.borders.swap(tile.newBorders);
+            }
+            tile.newBorders.clear();
+        }
+        dirty = false;
+        for (int i = 0; i < n; ++i)
+        {
+            int tx = i % nx, tz = i / nx;
+            tiles[i].dirty = (tx > 0 && changed[i - 1]) || (tx + 1 < nx && changed[i + 1]) ||
+                             (tz > 0 && changed[i - nx]) || (tz + 1 < nz && changed[i + nx]);
+            dirty = dirty || tiles[i].dirty;
+        }
+    }
+
+    // Merge the tiles, the vertices on the tile borders are shared.
+    unordered_map<int, int> outIndexByGrid;
+    outVertices.clear();
+    outIndices.clear();
+    for (int i = 0; i < n; ++i)
+    {
+        Tile &tile = tiles[i];
+        vector<int> outIndexByTile(tile.vertices.size());
+        for (int j = 0, m = tile.vertices.size(); j < m; ++j)
+        {
+            pair<unordered_map<int, int>::iterator, bool> inserted =
+                outIndexByGrid.insert(make_pair(tile.gridIndices[j], (int)outVertices.size()));
+            if (inserted.second)
+                outVertices.push_back(tile.vertices[j]);
+            outIndexByTile[j] = inserted.first->second;
+        }
+        for (int j = 0, m = tile.indices.size(); j < m; ++j)
+            outIndices.push_back(outIndexByTile[tile.indices[j]]);
+        tile = Tile();
+    }
+
+    return true;
+}
+
+void SurfaceSimplifier::processTile(const SurfaceModel &model, int resolution, int size, int outWidth, int outHeight,
+                                    vector<Tile> &tiles, int nx, int nz, int i, double maxError)
+{
+    Tile &tile = tiles[i];
+    int tx = i % nx, tz = i / nx;
+    int n = size + 1;
+    tile.x0 = tx * size;
+    tile.z0 = tz * size;
+    tile.width = min(n, outWidth - tile.x0);
+    tile.height = min(n, outHeight - tile.z0);
+    tile.points.resize(n * n);
+    SurfaceBuilder::evaluate(model, resolution, tile.x0, tile.z0, tile.width, tile.height, tile.points.data(), n);
+
+    tile.errors.assign(n * n, 0.0);
+    const double *w = tx > 0 ? &tiles[i - 1].borders[EAST * n] : 0;
+    const double *e = tx + 1 < nx ? &tiles[i + 1].borders[WEST * n] : 0;
+    const double *t = tz > 0 ? &tiles[i - nx].borders[SOUTH * n] : 0;
+    const double *b = tz + 1 < nz ? &tiles[i + nx].borders[NORTH * n] : 0;
+    for (int k = 0; k < n; ++k)
+    {
+        if (w)
+            tile.errors[k * n] = w[k];
+        if (e)
+            tile.errors[k * n + size] = e[k];
+        if (t)
+            tile.errors[k] = t[k];
+        if (b)
+            tile.errors[size * n + k] = b[k];
+    }
+    computeErrors(tile, size);
+
+    tile.newBorders.resize(SIDES * n);
+    for (int k = 0; k < n; ++k)
+    {
+        tile.newBorders[WEST * n + k] = tile.errors[k * n];
+        tile.newBorders[EAST * n + k] = tile.errors[k * n + size];
+        tile.newBorders[NORTH * n + k] = tile.errors[k];
+        tile.newBorders[SOUTH * n + k] = tile.errors[size * n + k];
+    }
+
+    tile.vertices.clear();
+    tile.gridIndices.clear();
+    tile.indices.clear();
+    tile.localIndices.assign(n * n, -1);
+    emitTriangles(tile, size, maxError, outWidth, 0, 0, size, size, size, 0);
+    emitTriangles(tile, size, maxError, outWidth, size, size, 0, 0, 0, size);
+    vector<Vertex>().swap(tile.points);
+    vector<double>().swap(tile.errors);
+    vector<int>().swap(tile.localIndices);
+}
+
+bool SurfaceSimplifier::clampTriangle(const Tile &tile, int &ax, int &az, int &bx, int &bz, int &cx, int &cz)
+{
+    // A partial tile is padded to the full size by the copies of its last row and column, i.e. the triangles
+    // are squeezed into its valid points. The squeezed triangles still cover the valid points without overlaps,
+    // and the ones lying in the padding collapse and cover nothing.
+    ax = min(ax, tile.width - 1);
+    bx = min(bx, tile.width - 1);
+    cx = min(cx, tile.width - 1);
+    az = min(az, tile.height - 1);
+    bz = min(bz, tile.height - 1);
+    cz = min(cz, tile.height - 1);
+    return (bx - ax) * (cz - az) - (bz - az) * (cx - ax) != 0;
+}
+
+double SurfaceSimplifier::triangleError(const Tile &tile, int size, int ax, int az, int bx, int bz, int cx, int cz)
+{
+    int n = size + 1;
+    if (!clampTriangle(tile, ax, az, bx, bz, cx, cz))
+        return 0.0;
+
+    // Plane through the triangle vertices: y = a.y + gx * (x - a.x) + gz * (z - a.z).
+    const Vec3 &a = tile.points[az * n + ax].position;
+    const Vec3 &b = tile.points[bz * n + bx].position;
+    const Vec3 &c = tile.points[cz * n + cx].position;
+    double ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+    double vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+    double det = ux * vz - uz * vx;
+    if (fabs(det) < Math::EPSILON * Math::EPSILON)
+        return HUGE_VAL;
+    double gx = (uy * vz - uz * vy) / det;
+    double gz = (ux * vy - uy * vx) / det;
+
+    // Grid points inside the triangle, including its edges.
+    int orientation = (bx - ax) * (cz - az) - (bz - az) * (cx - ax) > 0 ? 1 : -1;
+    int minX = min(ax, min(bx, cx)), maxX = max(ax, max(bx, cx));
+    int minZ = min(az, min(bz, cz)), maxZ = max(az, max(bz, cz));
+    double error = 0.0;
+    for (int z = minZ; z <= maxZ; ++z)
+    {
+        for (int x = minX; x <= maxX; ++x)
+        {
+            if (orientation * ((bx - ax) * (z - az) - (bz - az) * (x - ax)) < 0 ||
+                orientation * ((cx - bx) * (z - bz) - (cz - bz) * (x - bx)) < 0 ||
+                orientation * ((ax - cx) * (z - cz) - (az - cz) * (x - cx)) < 0)
+                continue;
+
+            const Vec3 &p = tile.points[z * n + x].position;
+            error = max(error, fabs(p.y - (a.y + gx * (p.x - a.x) + gz * (p.z - a.z))));
+        }
+    }
+    return error;
+}
+
+void SurfaceSimplifier::computeErrors(Tile &tile, int size)
+{
+    // Triangle ABC has the right angle in C, it is split through the middle M of the hypotenuse AB into the
+    // triangles CAM and BCM. Error stored in M is the maximum error of both triangles sharing AB and all their
+    // descendants, so a triangle is split whenever any of its descendants or its neighbours' descendants has to be.
+    // The triangles are numbered as a binary tree: 2 and 3 are the halves of the tile, children of the triangle i
+    // are 2 * i and 2 * i + 1. They are visited from the smallest to the largest, so errors of both triangles
+    // sharing the hypotenuse of the children are known when the parent is visited.
+    int n = size + 1;
+    int triangles = size * size * 2 - 2;
+    int parents = triangles - size * size;
+    for (int i = triangles - 1; i >= 0; --i)
+    {
+        int id = i + 2;
+        int ax = 0, az = 0, bx = 0, bz = 0, cx = 0, cz = 0;
+        if (id & 1)
+            bx = bz = cx = size;
+        else
+            ax = az = cz = size;
+        while ((id >>= 1) > 1)
+        {
+            int mx = (ax + bx) / 2;
+            int mz = (az + bz) / 2;
+            if (id & 1)
+            {
+                bx = ax;
+                bz = az;
+                ax = cx;
+                az = cz;
+            }
+            else
+            {
+                ax = bx;
+                az = bz;
+                bx = cx;
+                bz = cz;
+            }
+            cx = mx;
+            cz = mz;
+        }
+
+        double error = triangleError(tile, size, ax, az, bx, bz, cx, cz);
+        if (i < parents)
+            error = max(error, max(tile.errors[((cz + az) / 2) * n + (cx + ax) / 2],
+                                   tile.errors[((bz + cz) / 2) * n + (bx + cx) / 2]));
+        double &stored = tile.errors[((az + bz) / 2) * n + (ax + bx) / 2];
+        stored = max(stored, error);
+    }
+}
+
+void SurfaceSimplifier::emitTriangles(Tile &tile, int size, double maxError, int outWidth,
+                                      int ax, int az, int bx, int bz, int cx, int cz)
+{
+    int n = size + 1;
+    if (abs(ax - cx) + abs(az - cz) > 1)
+    {
+        int mx = (ax + bx) / 2;
+        int mz = (az + bz) / 2;
+        if (tile.errors[mz * n + mx] > maxError)
+        {
+            emitTriangles(tile, size, maxError, outWidth, cx, cz, ax, az, mx, mz);
+            emitTriangles(tile, size, maxError, outWidth, bx, bz, cx, cz, mx, mz);
+            return;
+        }
+    }
+    if (!clampTriangle(tile, ax, az, bx, bz, cx, cz))
+        return;
+
+    // Same orientation as the triangles of SurfaceBuilder::triangulateGrid.
+    if ((bx - ax) * (cz - az) - (bz - az) * (cx - ax) > 0)
+    {
+        swap(bx, cx);
+        swap(bz, cz);
+    }
+    int corners[3] = {az * n + ax, bz * n + bx, cz * n + cx};
+    for (int i = 0; i < 3; ++i)
+    {
+        int &local = tile.localIndices[corners[i]];
+        if (local < 0)
+        {
+            local = tile.vertices.size();
+            tile.vertices.push_back(tile.points[corners[i]]);
+            tile.gridIndices.push_back((tile.z0 + corners[i] / n) * outWidth + tile.x0 + corners[i] % n);
+        }
+        tile.indices.push_back(local);
+    }
+}
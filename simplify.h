@@ -0,0 +1,108 @@
+/**
+ * simplify.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides functions to simplify sleek surfaces into triangulated irregular networks.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_SIMPLIFY_H__
+#define __SLEEKSURFACE_SIMPLIFY_H__
+
+#include "surface.h"
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The SurfaceSimplifier static class provides methods to build triangulated irregular networks (TIN)
+     * approximating sleek surfaces within the given vertical error.
+     * The output grid is split into square tiles, each tile is simplified independently as a right-triangulated
+     * irregular network (hierarchy of right triangles split through the middle of the hypotenuse) and only the
+     * tile being processed is evaluated, so the full grid is never materialized.
+     * Errors along the tile borders are exchanged between the neighbouring tiles and the tiles are processed again
+     * until they agree on them, so the tiles stitch without cracks.
+     */
+    class SurfaceSimplifier
+    {
+        class Tile
+        {
+        public:
+            int x0, z0, width, height;
+            bool dirty;
+            vector<double> borders, newBorders;
+            vector<Vertex> points;
+            vector<double> errors;
+            vector<int> localIndices;
+            vector<Vertex> vertices;
+            vector<int> gridIndices;
+            vector<int> indices;
+        };
+
+        enum Side {WEST, EAST, NORTH, SOUTH, SIDES};
+
+        static bool clampTriangle(const Tile &tile, int &ax, int &az, int &bx, int &bz, int &cx, int &cz);
+        static double triangleError(const Tile &tile, int size, int ax, int az, int bx, int bz, int cx, int cz);
+        static void computeErrors(Tile &tile, int size);
+        static void emitTriangles(Tile &tile, int size, double maxError, int outWidth,
+                                  int ax, int az, int bx, int bz, int cx, int cz);
+        static void processTile(const SurfaceModel &model, int resolution, int size, int outWidth, int outHeight,
+                                vector<Tile> &tiles, int nx, int nz, int i, double maxError);
+
+    public:
+        /**
+         * Build a triangulated irregular network approximating the surface.
+         * Vertices of the network are the points of the output grid of <code>SurfaceBuilder::build</code> with the
+         * same resolution and the vertical distance from every other point of this grid to the network does not
+         * exceed the given error.
+         *
+         * @param model - prepared surface model.
+         * @param resolution - resolution of each coons patch.
+         * @param maxError - maximum vertical error, should be non-negative.
+         * @param tileSize - size of the tiles in output grid cells, should be a power of two not less than 2.
+         * @param outVertices - output vertices of the network without normals.
+         * @param outIndices - output triangles of the network, oriented the same way as in
+         * <code>SurfaceBuilder::triangulateGrid</code>.
+         * @return true if simplification successful, false if not.
+         */
+        static bool simplify(const SurfaceModel &model, int resolution, double maxError, int tileSize,
+                             vector<Vertex> &outVertices, vector<int> &outIndices);
+        /**
+         * Build a sleek surface and simplify it into triangulated irregular network.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param maxError - maximum vertical error, should be non-negative.
+         * @param tileSize - size of the tiles in output grid cells, should be a power of two not less than 2.
+         * @param outVertices - output vertices of the network without normals.
+         * @param outIndices - output triangles of the network.
+         * @return true if simplification successful, false if not.
+         */
+        static bool simplify(const HeightField &inField, int resolution, double c, double maxError, int tileSize,
+                             vector<Vertex> &outVertices, vector<int> &outIndices);
+    };
+}
+
+#endif // __SLEEKSURFACE_SIMPLIFY_H__
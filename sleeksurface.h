@@ -0,0 +1,181 @@
+/**
+ * sleeksurface.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides C interface of the library to embed it into applications written in C and other languages.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_SLEEKSURFACE_H__
+#define __SLEEKSURFACE_SLEEKSURFACE_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Types of the height values.
+ */
+typedef enum
+{
+    SLEEK_SURFACE_FLOAT32,
+    SLEEK_SURFACE_FLOAT64,
+    SLEEK_SURFACE_INT16
+} SleekSurfaceHeightType;
+
+/**
+ * Regular grid of heights in the caller's buffer, it is read in place without copying.
+ */
+typedef struct
+{
+    /**
+     * Type of the height values.
+     */
+    SleekSurfaceHeightType type;
+    /**
+     * First height value of the first row.
+     */
+    const void *data;
+    /**
+     * Resolution of the grid.
+     */
+    int width, height;
+    /**
+     * Distance in bytes between the beginnings of the rows, not less than width times the value size.
+     */
+    size_t stride;
+    /**
+     * Coordinates of the first grid point and distances between the grid points along x and z.
+     * The distances have to be finite and non-zero.
+     */
+    double originX, originZ, stepX, stepZ;
+    /**
+     * Scale and offset applied to INT16 heights.
+     */
+    double heightScale, heightOffset;
+} SleekSurfaceHeights;
+
+/**
+ * Parameters of the surface.
+ */
+typedef struct
+{
+    /**
+     * Resolution of each coons patch, should be not less than 2.
+     */
+    int resolution;
+    /**
+     * Parameter affecting curvature, should be in [2; +inf).
+     */
+    double c;
+    /**
+     * Radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+     */
+    int kernelRadius;
+} SleekSurfaceParams;
+
+/**
+ * Triangulated output grid. Each of the buffers is either provided by the caller or, if it is null, allocated
+ * by the library and then has to be released by <code>sleek_surface_free</code>.
+ */
+typedef struct
+{
+    /**
+     * Resolution of the output grid.
+     */
+    int width, height;
+    /**
+     * Vertex positions, 3 values per vertex.
+     */
+    double *positions;
+    /**
+     * Vertex normals, 3 values per vertex.
+     */
+    double *normals;
+    /**
+     * Vertex indices, 3 values per triangle, 2 triangles per grid cell.
+     */
+    int *indices;
+    /**
+     * Number of vertices and indices.
+     */
+    size_t vertexCount, indexCount;
+    /**
+     * Flags of the buffers allocated by the library, do not change.
+     */
+    int allocated;
+} SleekSurfaceMesh;
+
+/**
+ * Initialize heights descriptor with FLOAT64 type, unit steps, zero origin and no INT16 transform.
+ *
+ * @param heights - descriptor to initialize.
+ * @param data - first height value of the first row.
+ * @param width, height - resolution of the grid, rows are packed tightly.
+ */
+void sleek_surface_heights_init(SleekSurfaceHeights *heights, const double *data, int width, int height);
+
+/**
+ * Initialize mesh with no buffers, so all of them are allocated by the library.
+ *
+ * @param mesh - mesh to initialize.
+ */
+void sleek_surface_mesh_init(SleekSurfaceMesh *mesh);
+
+/**
+ * Get the sizes of the output buffers to provide them from the caller.
+ *
+ * @param inWidth, inHeight - resolution of input grid.
+ * @param resolution - resolution of each coons patch.
+ * @param vertexCount - output number of vertices, positions and normals take 3 values per vertex.
+ * @param indexCount - output number of indices.
+ * @return 1 if sizes are valid, 0 if not.
+ */
+int sleek_surface_output_size(int inWidth, int inHeight, int resolution, size_t *vertexCount, size_t *indexCount);
+
+/**
+ * Build the sleek surface, compute and smooth its normals and triangulate it.
+ *
+ * @param heights - input heights.
+ * @param params - surface parameters.
+ * @param mesh - output mesh, its non-null buffers provided by the caller have to be large enough according to
+ * <code>sleek_surface_output_size</code>. Buffers allocated by the library in an earlier call are reused,
+ * or reallocated if they are too small.
+ * @return 1 if surface building successful, 0 if not.
+ */
+int sleek_surface_build(const SleekSurfaceHeights *heights, const SleekSurfaceParams *params, SleekSurfaceMesh *mesh);
+
+/**
+ * Release the buffers of the mesh allocated by the library and reset them to null.
+ *
+ * @param mesh - mesh to release.
+ */
+void sleek_surface_free(SleekSurfaceMesh *mesh);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SLEEKSURFACE_SLEEKSURFACE_H__
@@ -0,0 +1,275 @@
+/**
+ * snapshot.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides sleek surfaces readable concurrently with their updates.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "snapshot.h"
+#include <limits>
+
+
+using namespace SleekSurface;
+
+const SurfaceTile *SurfaceSnapshot::getTile(int tx, int tz) const
+{
+    if (tx < 0 || tz < 0 || tx >= tilesX || tz >= tilesZ)
+        return 0;
+    return tiles[tz * tilesX + tx];
+}
+
+bool SurfaceSnapshot::getVertex(int x, int z, Vertex &vertex) const
+{
+    if (x < 0 || z < 0 || x >= width || z >= height)
+        return false;
+    // Border vertices are shared by the neighbouring tiles, the last ones exist in the last tile only.
+    const SurfaceTile *tile = tiles[min(z / tileSize, tilesZ - 1) * tilesX + min(x / tileSize, tilesX - 1)];
+    vertex = tile->vertices[(z - tile->z0) * tile->width + (x - tile->x0)];
+    return true;
+}
+
+ConcurrentSurface::Reader::Reader(ConcurrentSurface &_surface) : surface(_surface), slot(-1)
+{
+    for (int i = 0; i < surface.slotCount; ++i)
+    {
+        bool expected = false;
+        if (surface.slots[i].taken.compare_exchange_strong(expected, true))
+        {
+            slot = i;
+            break;
+        }
+    }
+}
+
+ConcurrentSurface::Reader::~Reader()
+{
+    if (slot >= 0)
+    {
+        surface.slots[slot].epoch.store(0);
+        surface.slots[slot].taken.store(false);
+    }
+}
+
+const SurfaceSnapshot *ConcurrentSurface::Reader::pin()
+{
+    if (slot < 0)
+        return 0;
+    // The epoch is announced before the snapshot is loaded, so the writer sees it before deleting the snapshot.
+    surface.slots[slot].epoch.store(surface.epoch.load());
+    return surface.current.load();
+}
+
+void ConcurrentSurface::Reader::unpin()
+{
+    if (slot >= 0)
+        surface.slots[slot].epoch.store(0);
+}
+
+bool ConcurrentSurface::Reader::getVertex(int x, int z, Vertex &vertex)
+{
+    const SurfaceSnapshot *snapshot = pin();
+    bool found = snapshot && snapshot->getVertex(x, z, vertex);
+    unpin();
+    return found;
+}
+
+ConcurrentSurface::ConcurrentSurface(int maxReaders) :
+    inWidth(0), inHeight(0), zoom(0), tileSize(0), kernelRadius(0), current(0), epoch(1),
+    slots(new ReaderSlot[max(maxReaders, 1)]), slotCount(max(maxReaders, 1))
+{
+}
+
+ConcurrentSurface::~ConcurrentSurface()
+{
+    release();
+}
+
+void ConcurrentSurface::release()
+{
+    const SurfaceSnapshot *snapshot = current.exchange(0);
+    if (snapshot)
+    {
+        for (size_t i = 0; i < snapshot->tiles.size(); ++i)
+            delete snapshot->tiles[i];
+        delete snapshot;
+    }
+    for (size_t i = 0; i < retired.size(); ++i)
+    {
+        for (size_t j = 0; j < retired[i].tiles.size(); ++j)
+            delete retired[i].tiles[j];
+        delete retired[i].snapshot;
+    }
+    retired.clear();
+}
+
+bool ConcurrentSurface::init(const HeightField &inField, double _c, int _zoom, int _tileSize, int _kernelRadius)
+{
+    int outWidth, outHeight;
+    if (!TileProvider::getOutputSize(inField.width(), inField.height(), _zoom, outWidth, outHeight) ||
+        _tileSize < 1 || _kernelRadius < 0 ||
+        (long long)((outWidth - 2) / _tileSize + 1) * ((outHeight - 2) / _tileSize + 1) > numeric_limits<int>::max())
+        return false;
+
+    lock_guard<mutex> lock(writerMutex);
+    inWidth = inField.width();
+    inHeight = inField.height();
+    points.resize(inWidth * inHeight);
+    for (int z = 0; z < inHeight; ++z)
+    {
+        for (int x = 0; x < inWidth; ++x)
+            points[z * inWidth + x] = inField.point(x, z);
+    }
+    // The model refers to the points, which are updated in place.
+    if (!SurfaceBuilder::prepare(HeightField::fromPoints(points.data(), inWidth, inHeight), _c, model))
+        return false;
+    zoom = _zoom;
+    tileSize = _tileSize;
+    kernelRadius = _kernelRadius;
+    kernel.clear();
+    if (kernelRadius > 0)
+        Math::calcGaussianKernel(kernelRadius, false, kernel);
+
+    SurfaceSnapshot base;
+    const SurfaceSnapshot *previous = current.load();
+    base.version = previous ? previous->version : 0;
+    base.zoom = zoom;
+    base.width = outWidth;
+    base.height = outHeight;
+    base.tileSize = tileSize;
+    base.tilesX = (base.width - 1 + tileSize - 1) / tileSize;
+    base.tilesZ = (base.height - 1 + tileSize - 1) / tileSize;
+    base.tiles.assign(base.tilesX * base.tilesZ, 0);
+    vector<int> tileIndices(base.tiles.size());
+    for (size_t i = 0; i < tileIndices.size(); ++i)
+        tileIndices[i] = i;
+    publish(base, tileIndices);
+    return true;
+}
+
+bool ConcurrentSurface::update(int x0, int z0, int w, int h, const double *heights)
+{
+    lock_guard<mutex> lock(writerMutex);
+    const SurfaceSnapshot *previous = current.load();
+    if (!previous || !heights || w < 1 || h < 1 || x0 < 0 || z0 < 0 || x0 + w > inWidth || z0 + h > inHeight)
+        return false;
+
+    for (int z = 0; z < h; ++z)
+    {
+        for (int x = 0; x < w; ++x)
+            points[(z0 + z) * inWidth + x0 + x].y = heights[z * w + x];
+    }
+    SurfaceBuilder::refresh(model, x0, z0, w, h);
+
+    // Cell (x, z) depends on the points from x - 1 to x + 2 and from z - 1 to z + 2, and its vertices affect
+    // the smoothed normals up to the kernel radius plus one vertex around.
+    int step = 1 << zoom;
+    int halo = kernelRadius + 1;
+    int cx0 = max(x0 - 2, 0), cx1 = min(x0 + w, inWidth - 2);
+    int cz0 = max(z0 - 2, 0), cz1 = min(z0 + h, inHeight - 2);
+    int ox0 = max(cx0 * step - halo, 0), ox1 = min((cx1 + 1) * step + halo, previous->width - 1);
+    int oz0 = max(cz0 * step - halo, 0), oz1 = min((cz1 + 1) * step + halo, previous->height - 1);
+    // Tile (tx, tz) covers vertices from tx * tileSize to (tx + 1) * tileSize inclusive.
+    int tx0 = max((ox0 + tileSize - 1) / tileSize - 1, 0), tx1 = min(ox1 / tileSize, previous->tilesX - 1);
+    int tz0 = max((oz0 + tileSize - 1) / tileSize - 1, 0), tz1 = min(oz1 / tileSize, previous->tilesZ - 1);
+    vector<int> tileIndices;
+    for (int tz = tz0; tz <= tz1; ++tz)
+    {
+        for (int tx = tx0; tx <= tx1; ++tx)
+            tileIndices.push_back(tz * previous->tilesX + tx);
+    }
+    publish(*previous, tileIndices);
+    return true;
+}
+
+void ConcurrentSurface::publish(const SurfaceSnapshot &base, const vector<int> &tileIndices)
+{
+    vector<const SurfaceTile *> built(tileIndices.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < (int)tileIndices.size(); ++i)
+    {
+        SurfaceTile *tile = new SurfaceTile();
+        TileProvider::buildTile(model, zoom, tileIndices[i] % base.tilesX, tileIndices[i] / base.tilesX, tileSize,
+                                kernelRadius, kernel, *tile);
+        built[i] = tile;
+    }
+
+    // Copy on write: the new snapshot shares all the tiles of the base except the rebuilt ones.
+    SurfaceSnapshot *snapshot = new SurfaceSnapshot(base);
+    for (size_t i = 0; i < tileIndices.size(); ++i)
+        snapshot->tiles[tileIndices[i]] = built[i];
+    ++snapshot->version;
+    const SurfaceSnapshot *previous = current.exchange(snapshot);
+
+    if (previous)
+    {
+        Retired old;
+        old.snapshot = previous;
+        if (previous == &base)
+        {
+            for (size_t i = 0; i < tileIndices.size(); ++i)
+                old.tiles.push_back(previous->tiles[tileIndices[i]]);
+        }
+        else
+        {
+            old.tiles = previous->tiles;
+        }
+        // Readers announcing this epoch or an earlier one may still see the old snapshot.
+        old.epoch = epoch.fetch_add(1);
+        retired.push_back(old);
+    }
+    reclaimRetired();
+}
+
+int ConcurrentSurface::reclaimRetired()
+{
+    unsigned long long oldest = numeric_limits<unsigned long long>::max();
+    for (int i = 0; i < slotCount; ++i)
+    {
+        unsigned long long announced = slots[i].epoch.load();
+        if (announced != 0 && announced < oldest)
+            oldest = announced;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); ++i)
+    {
+        if (retired[i].epoch < oldest)
+        {
+            for (size_t j = 0; j < retired[i].tiles.size(); ++j)
+                delete retired[i].tiles[j];
+            delete retired[i].snapshot;
+        }
+        else
+        {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired.resize(kept);
+    return kept;
+}
+
+int ConcurrentSurface::reclaim()
+{
+    lock_guard<mutex> lock(writerMutex);
+    return reclaimRetired();
+}
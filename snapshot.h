@@ -0,0 +1,234 @@
+/**
+ * snapshot.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides sleek surfaces readable concurrently with their updates.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_SNAPSHOT_H__
+#define __SLEEKSURFACE_SNAPSHOT_H__
+
+#include "tiles.h"
+#include <atomic>
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The SurfaceSnapshot class stores immutable version of the surface cut into tiles, as <code>TileProvider</code>
+     * does at one zoom level. Tiles not changed by an update are shared between the snapshots.
+     */
+    class SurfaceSnapshot
+    {
+        friend class ConcurrentSurface;
+
+        long long version;
+        int zoom;
+        int width, height;
+        int tileSize;
+        int tilesX, tilesZ;
+        vector<const SurfaceTile *> tiles;
+
+    public:
+        /**
+         * Get number of updates applied before the snapshot was published.
+         *
+         * @return version of the snapshot.
+         */
+        long long getVersion() const { return version; };
+        /**
+         * Get resolution of the output grid.
+         *
+         * @param w, h - number of vertices along x and z axes.
+         */
+        void getSize(int &w, int &h) const { w = width; h = height; };
+        /**
+         * Get the tile.
+         *
+         * @param tx, tz - tile position.
+         * @return tile or null if position is invalid.
+         */
+        const SurfaceTile *getTile(int tx, int tz) const;
+        /**
+         * Get vertex of the output grid.
+         *
+         * @param x, z - vertex position in the output grid.
+         * @param vertex - output vertex with smoothed normal.
+         * @return true if position is valid, false if not.
+         */
+        bool getVertex(int x, int z, Vertex &vertex) const;
+    };
+
+    /**
+     * The ConcurrentSurface class stores the surface built at one zoom level, which is read from many threads
+     * while it is updated. Readers get wait-free access to the current snapshot: they never lock and never retry.
+     * The writer keeps the surface model, rebuilds only the curve segments depending on the updated points,
+     * re-evaluates only the tiles affected by the update, copies the tile table replacing them, and
+     * publishes the new snapshot with a single atomic store. Old snapshots and replaced tiles are reclaimed
+     * by epochs: each reader announces the epoch it has started reading in, and the retired data is deleted
+     * once all the active readers have started after its retirement.
+     * Updates are serialized between themselves, but do not block the readers.
+     */
+    class ConcurrentSurface
+    {
+        /**
+         * Epoch announced by the reader, each slot takes its own cache line.
+         */
+        class ReaderSlot
+        {
+        public:
+            atomic<unsigned long long> epoch;
+            atomic<bool> taken;
+            char padding[64 - sizeof(atomic<unsigned long long>) - sizeof(atomic<bool>)];
+
+            ReaderSlot() : epoch(0), taken(false) {};
+        };
+
+        /**
+         * Snapshot replaced at the epoch, together with its tiles not shared with the newer snapshot.
+         */
+        class Retired
+        {
+        public:
+            unsigned long long epoch;
+            const SurfaceSnapshot *snapshot;
+            vector<const SurfaceTile *> tiles;
+        };
+
+        mutex writerMutex;
+        vector<Vec3> points;
+        int inWidth, inHeight;
+        SurfaceModel model;
+        int zoom;
+        int tileSize;
+        int kernelRadius;
+        vector<float> kernel;
+        atomic<const SurfaceSnapshot *> current;
+        atomic<unsigned long long> epoch;
+        unique_ptr<ReaderSlot[]> slots;
+        int slotCount;
+        vector<Retired> retired;
+
+        ConcurrentSurface(const ConcurrentSurface &);
+        ConcurrentSurface &operator=(const ConcurrentSurface &);
+
+        void publish(const SurfaceSnapshot &base, const vector<int> &tileIndices);
+        int reclaimRetired();
+        void release();
+
+    public:
+        /**
+         * The Reader class provides access to the snapshots of the surface from one thread. The reader takes
+         * a slot of the surface when created, so the snapshot is later pinned without any allocation or lock.
+         */
+        class Reader
+        {
+            ConcurrentSurface &surface;
+            int slot;
+
+            Reader(const Reader &);
+            Reader &operator=(const Reader &);
+
+        public:
+            /**
+             * Reader constructor. Takes a free slot of the surface.
+             *
+             * @param _surface - surface to read.
+             */
+            explicit Reader(ConcurrentSurface &_surface);
+            /**
+             * Reader destructor. Frees the slot.
+             */
+            ~Reader();
+
+            /**
+             * Test if the reader has got a slot.
+             *
+             * @return true if the reader can pin snapshots, false if all the slots are taken.
+             */
+            bool isValid() const { return slot >= 0; };
+            /**
+             * Pin the current snapshot. It stays alive until <code>unpin</code> is called, even if newer snapshots
+             * are published meanwhile.
+             *
+             * @return current snapshot or null if the reader is invalid or the surface is not initialized.
+             */
+            const SurfaceSnapshot *pin();
+            /**
+             * Unpin the snapshot, it must not be accessed afterwards.
+             */
+            void unpin();
+            /**
+             * Get vertex of the output grid from the current snapshot.
+             *
+             * @param x, z - vertex position in the output grid.
+             * @param vertex - output vertex with smoothed normal.
+             * @return true if position is valid, false if not.
+             */
+            bool getVertex(int x, int z, Vertex &vertex);
+        };
+
+        /**
+         * ConcurrentSurface constructor.
+         *
+         * @param maxReaders - maximum number of readers existing at once.
+         */
+        explicit ConcurrentSurface(int maxReaders = 64);
+        /**
+         * ConcurrentSurface destructor. All the readers have to be destroyed before.
+         */
+        ~ConcurrentSurface();
+
+        /**
+         * Build the surface and publish its first snapshot.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according, it is copied.
+         * @param _c - paramenet affecting curvature, should be in [2; +inf).
+         * @param _zoom - zoom level in [0; TileProvider::MAX_ZOOM], each input cell is subdivided into 2^zoom steps.
+         * @param _tileSize - number of cells along the tile side.
+         * @param _kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @return true if the surface is built, false if not.
+         */
+        bool init(const HeightField &inField, double _c, int _zoom, int _tileSize, int _kernelRadius);
+        /**
+         * Replace heights of rectangular region of the input grid, rebuild the tiles it affects and publish
+         * the new snapshot.
+         *
+         * @param x0, z0 - position of the region in the input grid.
+         * @param w, h - resolution of the region, it has to lie within the input grid.
+         * @param heights - new heights of the region, densely packed row by row.
+         * @return true if the snapshot is published, false if parameters are invalid.
+         */
+        bool update(int x0, int z0, int w, int h, const double *heights);
+        /**
+         * Delete the retired snapshots and tiles no reader can access anymore. It is also done by each update.
+         *
+         * @return number of retired snapshots still alive.
+         */
+        int reclaim();
+    };
+}
+
+#endif // __SLEEKSURFACE_SNAPSHOT_H__
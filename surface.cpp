@@ -27,53 +27,220 @@
  */
 
 #include "surface.h"
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 using namespace SleekSurface;
 
-bool SurfaceBuilder::getRowSegments(vector<Vec3> &inPoints, int inWidth, int inHeight, double c, vector<Segment> &segments)
+void SurfaceBuilder::getRowSegments(const HeightField &inField, const HeightField &inValues, const unsigned char *mask, double c,
+                                    vector<Segment> &segments)
 {
-    vector<Vec2> points(inWidth);
+    // Curves break at the missing points, each run of valid points gets its own curve.
+    int inWidth = inField.width();
+    int inHeight = inField.height();
+    vector<Vec2> points;
+    points.reserve(inWidth);
     segments.resize(inWidth * inHeight);
-    int segPtr = 0;
     for (int z = 0; z < inHeight; ++z)
+    {
+        for (int x = 0; x <= inWidth; ++x)
+        {
+            if (x < inWidth && (!mask || mask[index(inWidth, x, z)]))
+                points.push_back(Vec2(inField.x(x, z), inValues.y(x, z)));
+            else
+            {
+                if (points.size() > 1)
+                    CurveBuilder::build(points, &(segments[index(inWidth, x - points.size(), z)]), c);
+                points.clear();
+            }
+        }
+    }
+}
+
+void SurfaceBuilder::getColSegments(const HeightField &inField, const HeightField &inValues, const unsigned char *mask, double c,
+                                    vector<Segment> &segments)
+{
+    // Columns are built simultaneously row by row, so the grid is read sequentially.
+    // A missing point finishes the curve of its column.
+    int inWidth = inField.width();
+    int inHeight = inField.height();
+    vector<StreamingCurveBuilder> builders(inWidth, StreamingCurveBuilder(c));
+    Segment segment;
+    segments.resize(inWidth * inHeight);
+    for (int z = 0; z <= inHeight; ++z)
     {
         for (int x = 0; x < inWidth; ++x)
         {
-            int idx = index(inWidth, x, z);
-            points[x] = Vec2(inPoints[idx].x, inPoints[idx].y);
+            if (z < inHeight && (!mask || mask[index(inWidth, x, z)]))
+            {
+                if (builders[x].push(Vec2(inField.z(x, z), inValues.y(x, z)), segment))
+                    segments[index(inHeight, z - 2, x)] = segment;
+            }
+            else if (builders[x].finish(segment))
+                segments[index(inHeight, z - 2, x)] = segment;
         }
-        if (!CurveBuilder::build(points, &(segments[segPtr]), c))
-            return false;
-        segPtr += inWidth;
     }
-    return true;
 }
 
-bool SurfaceBuilder::getColSegments(vector<Vec3> &inPoints, int inWidth, int inHeight, double c, vector<Segment> &segments)
+void SurfaceBuilder::updateRowSegments(const HeightField &inField, const HeightField &inValues, const unsigned char *mask, double c,
+                                       int s0, int s1, int z0, int z1, vector<Segment> &segments)
 {
+    // Each run of valid points crossing the range is rebuilt as a separate curve, as getRowSegments does.
+    int inWidth = inField.width();
+    vector<Vec2> points(inWidth);
+    for (int z = z0; z <= z1; ++z)
+    {
+        int x = s0;
+        while (x <= s1)
+        {
+            if (mask && (!mask[index(inWidth, x, z)] || !mask[index(inWidth, x + 1, z)]))
+            {
+                ++x;
+                continue;
+            }
+
+            int a = 0, b = inWidth - 1;
+            if (mask)
+            {
+                for (a = x; a > 0 && mask[index(inWidth, a - 1, z)]; --a);
+                for (b = x + 1; b < inWidth - 1 && mask[index(inWidth, b + 1, z)]; ++b);
+            }
+            int last = min(s1, b - 1);
+            for (int i = max(x - 1, a), n = min(last + 2, b); i <= n; ++i)
+                points[i] = Vec2(inField.x(i, z), inValues.y(i, z));
+            CurveBuilder::buildRange(&points[a], b - a, x - a, last - a, &segments[index(inWidth, a, z)], c);
+            x = b + 1;
+        }
+    }
+}
+
+void SurfaceBuilder::updateColSegments(const HeightField &inField, const HeightField &inValues, const unsigned char *mask, double c,
+                                       int x0, int x1, int s0, int s1, vector<Segment> &segments)
+{
+    // Columns are stored the same way as rows of the transposed grid.
+    int inWidth = inField.width();
+    int inHeight = inField.height();
     vector<Vec2> points(inHeight);
-    segments.resize(inWidth * inHeight);
-    int segPtr = 0;
-    for (int x = 0; x < inWidth; ++x)
+    for (int x = x0; x <= x1; ++x)
     {
-        for (int z = 0; z < inHeight; ++z)
+        int z = s0;
+        while (z <= s1)
         {
-            int idx = index(inWidth, x, z);
-            points[z] = Vec2(inPoints[idx].z, inPoints[idx].y);
+            if (mask && (!mask[index(inWidth, x, z)] || !mask[index(inWidth, x, z + 1)]))
+            {
+                ++z;
+                continue;
+            }
+
+            int a = 0, b = inHeight - 1;
+            if (mask)
+            {
+                for (a = z; a > 0 && mask[index(inWidth, x, a - 1)]; --a);
+                for (b = z + 1; b < inHeight - 1 && mask[index(inWidth, x, b + 1)]; ++b);
+            }
+            int last = min(s1, b - 1);
+            for (int i = max(z - 1, a), n = min(last + 2, b); i <= n; ++i)
+                points[i] = Vec2(inField.z(x, i), inValues.y(x, i));
+            CurveBuilder::buildRange(&points[a], b - a, z - a, last - a, &segments[index(inHeight, a, x)], c);
+            z = b + 1;
+        }
+    }
+}
+
+void SurfaceBuilder::shareParameterization(const vector<Segment> &base, vector<Segment> &segments, int begin, int end)
+{
+    // A handle moved along the tangent keeps the slope of the curve in its end point, so the curve has the same
+    // tangents in the grid points as if it was built alone. The tangent of a zero-length handle points to the
+    // opposite inner control point. The handle is moved to the x-length of the height curve one, if it stays
+    // in the y-range of the end points, so the curve still has no extremes between them, and is not shortened too much,
+    // so the curve does not bend sharply right next to the end point. Otherwise, or if a height handle has zero
+    // length, the segment keeps its own control points and its regular parameters are found separately.
+    for (int i = begin; i < end; ++i)
+    {
+        Segment &segment = segments[i];
+        const Segment &b = base[i];
+        const Vec2 *p = segment.points;
+        double baseL = b.points[1].x - b.points[0].x, baseR = b.points[2].x - b.points[3].x;
+        const Vec2 &tangentL = p[1].x != p[0].x ? p[1] : p[2];
+        const Vec2 &tangentR = p[2].x != p[3].x ? p[2] : p[1];
+        double lengthL = tangentL.x - p[0].x, lengthR = tangentR.x - p[3].x;
+        if (baseL == 0.0 || baseR == 0.0 || lengthL == 0.0 || lengthR == 0.0)
+            continue;
+
+        double ratioL = baseL / lengthL, ratioR = baseR / lengthR;
+        if (ratioL < MIN_HANDLE_RATIO || ratioR < MIN_HANDLE_RATIO)
+            continue;
+
+        double y1 = lengthL == baseL ? tangentL.y : p[0].y + (tangentL.y - p[0].y) * ratioL;
+        double y2 = lengthR == baseR ? tangentR.y : p[3].y + (tangentR.y - p[3].y) * ratioR;
+        double yMin = min(p[0].y, p[3].y), yMax = max(p[0].y, p[3].y);
+        if (y1 < yMin || y1 > yMax || y2 < yMin || y2 > yMax)
+            continue;
+
+        segment.points[1] = Vec2(b.points[1].x, y1);
+        segment.points[2] = Vec2(b.points[2].x, y2);
+    }
+}
+
+void SurfaceBuilder::getValidCells(int inWidth, int inHeight, const unsigned char *mask, vector<unsigned char> &cells)
+{
+    cells.assign((inWidth - 1) * (inHeight - 1), 1);
+    if (!mask)
+        return;
+
+    for (int z = 0; z < inHeight - 1; ++z)
+    {
+        for (int x = 0; x < inWidth - 1; ++x)
+        {
+            cells[index(inWidth - 1, x, z)] = mask[index(inWidth, x, z)] && mask[index(inWidth, x + 1, z)] &&
+                                              mask[index(inWidth, x, z + 1)] && mask[index(inWidth, x + 1, z + 1)];
+        }
+    }
+}
+
+void SurfaceBuilder::triangulateGrid(int inWidth, int inHeight, const unsigned char *mask, int resolution, vector<int> &indices)
+{
+    // Triangles are emitted cell by cell, in the same order within each cell as by triangulateGrid.
+    vector<unsigned char> cells;
+    getValidCells(inWidth, inHeight, mask, cells);
+    int step = resolution - 1;
+    int width = step * (inWidth - 1) + 1;
+    indices.clear();
+    for (int cz = 0; cz < inHeight - 1; ++cz)
+    {
+        for (int cx = 0; cx < inWidth - 1; ++cx)
+        {
+            if (!cells[index(inWidth - 1, cx, cz)])
+                continue;
+
+            for (int z = cz * step; z < (cz + 1) * step; ++z)
+            {
+                for (int x = cx * step; x < (cx + 1) * step; ++x)
+                {
+                    int tl = index(width, x, z);
+                    int tr = index(width, x + 1, z);
+                    int bl = index(width, x, z + 1);
+                    int br = index(width, x + 1, z + 1);
+                    int triangles[6] = {tr, tl, bl, bl, br, tr};
+                    indices.insert(indices.end(), triangles, triangles + 6);
+                }
+            }
         }
-        if (!CurveBuilder::build(points, &(segments[segPtr]), c))
-            return false;
-        segPtr += inHeight;
     }
-    return true;
 }
 
 void SurfaceBuilder::triangulateGrid(int width, int height, vector<int> &indices)
 {
-    int n = (width - 1) * (height - 1) * 6;
-    indices.resize(n);
-    int i = 0;
+    indices.resize((width - 1) * (height - 1) * 6);
+    triangulateGrid(width, height, indices.data());
+}
+
+void SurfaceBuilder::triangulateGrid(int width, int height, int *indices)
+{
+    size_t i = 0;
     for (int z = 0; z < height - 1; ++z)
     {
         for (int x = 0; x < width - 1; ++x)
@@ -121,14 +288,174 @@ void SurfaceBuilder::computeNormals(vector<Vertex> &vertices, const vector<int>
     }
 }
 
-void SurfaceBuilder::smoothNormalsWithKernel(const vector<Vertex> &inVertices, int width, int height, vector<float> kernel, int radius, vector<Vertex> &outVertices)
+void SurfaceBuilder::computeGridNormals(vector<Vertex> &vertices, int width, int height)
 {
-    int n = radius * 2 + 1;
-    outVertices = inVertices;
-    for (int z = 0; z < height; ++z)
+    // Each thread computes a band of rows, so each row is copied to the SIMD lanes once per band.
+    #pragma omp parallel
+    {
+        int thread = 0, threads = 1;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+        threads = omp_get_num_threads();
+#endif
+        int z0 = (int)((long long)thread * height / threads);
+        int z1 = (int)((long long)(thread + 1) * height / threads);
+        computeGridNormalRows(vertices.data(), width, height, 0, 0, z0, z1);
+    }
+}
+
+SLEEKSURFACE_DISPATCH void SurfaceBuilder::computeGridNormalRows(Vertex *vertices, int width, int height, const unsigned char *cells,
+                                                                 int step, int z0, int z1)
+{
+    // Inner vertices of the grid without missing cells take all the six triangles. Their normals are accumulated
+    // in SIMD lanes, a lane per vertex, over SoA copies of the positions of three rows, kept in a ring so each row
+    // is copied once, with the same operations as the other vertices.
+    int count = width - 2;
+    vector<double> lanes(cells || count < 1 ? 0 : 4 * 3 * width);
+    double *nx = lanes.data(), *ny = nx + width, *nz = ny + width;
+    double *rows = nz + width;
+    int loaded = 0;
+    for (int z = z0; z < z1; ++z)
     {
+        const Vertex *top = z > 0 ? &vertices[index(width, 0, z - 1)] : 0;
+        Vertex *mid = &vertices[index(width, 0, z)];
+        const Vertex *bottom = z < height - 1 ? &vertices[index(width, 0, z + 1)] : 0;
+        bool inner = !lanes.empty() && top && bottom;
         for (int x = 0; x < width; ++x)
         {
+            // Triangles of triangulateGrid incident to the vertex P:
+            //
+            //  TL ------ T ------ TR
+            //   |      __/|      __/
+            //   |   __/   |   __/ |
+            //   | _/      | _/    |
+            //   L ------- P ----- R
+            //   |      __/|      __/
+            //   |   __/   |   __/ |
+            //   | _/      | _/    |
+            //  BL ------ B ------ BR
+            //
+            // Only the triangles of valid cells are taken, the vertices outside them are not touched.
+            if (inner && x == 1)
+                x = width - 1;
+            bool tl = x > 0 && top && isQuadValid(cells, width, step, x - 1, z - 1);
+            bool tr = x < width - 1 && top && isQuadValid(cells, width, step, x, z - 1);
+            bool bl = x > 0 && bottom && isQuadValid(cells, width, step, x - 1, z);
+            bool br = x < width - 1 && bottom && isQuadValid(cells, width, step, x, z);
+            if (!tl && !tr && !bl && !br)
+                continue;
+
+            const Vec3 &p = mid[x].position;
+            Vec3 normal;
+            if (tl)
+                normal = normal + Math::normal(mid[x - 1].position, p, top[x].position);
+            if (tr)
+            {
+                normal = normal + Math::normal(top[x + 1].position, top[x].position, p);
+                normal = normal + Math::normal(p, mid[x + 1].position, top[x + 1].position);
+            }
+            if (bl)
+            {
+                normal = normal + Math::normal(p, mid[x - 1].position, bottom[x - 1].position);
+                normal = normal + Math::normal(bottom[x - 1].position, bottom[x].position, p);
+            }
+            if (br)
+                normal = normal + Math::normal(mid[x + 1].position, p, bottom[x].position);
+            normal.normalize();
+            mid[x].normal = normal;
+        }
+        if (!inner)
+            continue;
+
+        for (loaded = max(loaded, z - 1); loaded <= z + 1; ++loaded)
+        {
+            const Vertex *row = &vertices[index(width, 0, loaded)];
+            double *px = rows + loaded % 3 * 3 * width, *py = px + width, *pz = py + width;
+            for (int x = 0; x < width; ++x)
+            {
+                px[x] = row[x].position.x;
+                py[x] = row[x].position.y;
+                pz[x] = row[x].position.z;
+            }
+        }
+        const double *tx = rows + (z - 1) % 3 * 3 * width, *ty = tx + width, *tz = ty + width;
+        const double *mx = rows + z % 3 * 3 * width, *my = mx + width, *mz = my + width;
+        const double *bx = rows + (z + 1) % 3 * 3 * width, *by = bx + width, *bz = by + width;
+        #pragma omp simd
+        for (int x = 1; x < width - 1; ++x)
+        {
+            double sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+            addNormal(mx[x - 1], my[x - 1], mz[x - 1], mx[x], my[x], mz[x], tx[x], ty[x], tz[x], sumX, sumY, sumZ);
+            addNormal(tx[x + 1], ty[x + 1], tz[x + 1], tx[x], ty[x], tz[x], mx[x], my[x], mz[x], sumX, sumY, sumZ);
+            addNormal(mx[x], my[x], mz[x], mx[x + 1], my[x + 1], mz[x + 1], tx[x + 1], ty[x + 1], tz[x + 1], sumX, sumY, sumZ);
+            addNormal(mx[x], my[x], mz[x], mx[x - 1], my[x - 1], mz[x - 1], bx[x - 1], by[x - 1], bz[x - 1], sumX, sumY, sumZ);
+            addNormal(bx[x - 1], by[x - 1], bz[x - 1], bx[x], by[x], bz[x], mx[x], my[x], mz[x], sumX, sumY, sumZ);
+            addNormal(mx[x + 1], my[x + 1], mz[x + 1], mx[x], my[x], mz[x], bx[x], by[x], bz[x], sumX, sumY, sumZ);
+            double length = sqrt(sumX * sumX + sumY * sumY + sumZ * sumZ);
+            bool zero = Math::isZero(length);
+            nx[x] = zero ? 0.0 : sumX / length;
+            ny[x] = zero ? 0.0 : sumY / length;
+            nz[x] = zero ? 0.0 : sumZ / length;
+        }
+        for (int x = 1; x < width - 1; ++x)
+            mid[x].normal = Vec3(nx[x], ny[x], nz[x]);
+    }
+}
+
+void SurfaceBuilder::smoothNormalsWithKernel(const vector<Vertex> &inVertices, int width, int height, const vector<float> &kernel, int radius, vector<Vertex> &outVertices)
+{
+    // Each thread smooths a band of rows, so each input row is copied to the SIMD lanes once per band.
+    outVertices.resize(inVertices.size());
+    #pragma omp parallel
+    {
+        int thread = 0, threads = 1;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+        threads = omp_get_num_threads();
+#endif
+        int z0 = (int)((long long)thread * height / threads);
+        int z1 = (int)((long long)(thread + 1) * height / threads);
+        smoothNormalRows(inVertices.data(), width, height, 0, 0, kernel, radius, outVertices.data(), width, 0, width, z0, z1);
+    }
+}
+
+SLEEKSURFACE_DISPATCH void SurfaceBuilder::smoothNormalRows(const Vertex *inVertices, int width, int height, const unsigned char *cells,
+                                                            int step, const vector<float> &kernel, int radius, Vertex *outVertices,
+                                                            int outStride, int x0, int x1, int z0, int z1)
+{
+    // Vertices outside the valid cells have zero normals, so they do not affect smoothing.
+    // Where the kernel lies inside the grid, normals are smoothed in SIMD lanes, a lane per vertex, over SoA copies
+    // of the kernel rows, kept in a ring so each row is copied once. Each lane adds the products in the same order
+    // as the vertices around, so the result does not depend on the instruction set.
+    int n = radius * 2 + 1;
+    int taps = 2 * radius;
+    int xa = min(max(x0, radius), x1), xb = max(min(x1, width - radius + 1), xa);
+    int count = xb - xa, span = count + taps;
+    vector<double> weights(taps * taps);
+    for (int i = 0; i < taps; ++i)
+    {
+        for (int j = 0; j < taps; ++j)
+            weights[i * taps + j] = (double)kernel[index(n, j, i)];
+    }
+    vector<double> lanes(cells || count == 0 ? 0 : 3 * (taps * span + count));
+    double *nx = lanes.data(), *ny = nx + count, *nz = ny + count;
+    double *rows = nz + count;
+    int loaded = 0;
+    for (int z = z0; z < z1; ++z)
+    {
+        bool inner = !lanes.empty() && z >= radius && z + radius <= height;
+        for (int x = x0; x < x1; ++x)
+        {
+            if (inner && x == xa)
+                x = xb;
+            if (x == x1)
+                break;
+            if (cells && !isQuadValid(cells, width, step, max(x - 1, 0), max(z - 1, 0)) &&
+                !isQuadValid(cells, width, step, min(x, width - 2), max(z - 1, 0)) &&
+                !isQuadValid(cells, width, step, max(x - 1, 0), min(z, height - 2)) &&
+                !isQuadValid(cells, width, step, min(x, width - 2), min(z, height - 2)))
+                continue;
+
             Vec3 normal;
             for (int i = -radius; i < radius; ++i)
             {
@@ -142,7 +469,58 @@ void SurfaceBuilder::smoothNormalsWithKernel(const vector<Vertex> &inVertices, i
                 }
             }
             normal.normalize();
-            outVertices[index(width, x, z)].normal = normal;
+            outVertices[index(outStride, x, z)].position = inVertices[index(width, x, z)].position;
+            outVertices[index(outStride, x, z)].normal = normal;
+        }
+        if (!inner)
+            continue;
+
+        for (loaded = max(loaded, z - radius); loaded < z + radius; ++loaded)
+        {
+            const Vertex *row = &inVertices[index(width, xa - radius, loaded)];
+            double *sx = rows + loaded % taps * 3 * span, *sy = sx + span, *sz = sy + span;
+            for (int l = 0; l < span; ++l)
+            {
+                sx[l] = row[l].normal.x;
+                sy[l] = row[l].normal.y;
+                sz[l] = row[l].normal.z;
+            }
+        }
+        fill(nx, nx + 3 * count, 0.0);
+        for (int i = 0; i < taps; ++i)
+        {
+            const double *sx = rows + (z - radius + i) % taps * 3 * span, *sy = sx + span, *sz = sy + span;
+            const double *w = &weights[i * taps];
+            #pragma omp simd
+            for (int l = 0; l < count; ++l)
+            {
+                double sumX = nx[l], sumY = ny[l], sumZ = nz[l];
+                for (int j = 0; j < taps; ++j)
+                {
+                    sumX = sumX + sx[l + j] * w[j];
+                    sumY = sumY + sy[l + j] * w[j];
+                    sumZ = sumZ + sz[l + j] * w[j];
+                }
+                nx[l] = sumX;
+                ny[l] = sumY;
+                nz[l] = sumZ;
+            }
+        }
+        #pragma omp simd
+        for (int l = 0; l < count; ++l)
+        {
+            double length = sqrt(nx[l] * nx[l] + ny[l] * ny[l] + nz[l] * nz[l]);
+            bool zero = Math::isZero(length);
+            nx[l] = zero ? 0.0 : nx[l] / length;
+            ny[l] = zero ? 0.0 : ny[l] / length;
+            nz[l] = zero ? 0.0 : nz[l] / length;
+        }
+        Vertex *out = &outVertices[index(outStride, xa, z)];
+        const Vertex *in = &inVertices[index(width, xa, z)];
+        for (int l = 0; l < count; ++l)
+        {
+            out[l].position = in[l].position;
+            out[l].normal = Vec3(nx[l], ny[l], nz[l]);
         }
     }
 }
@@ -150,164 +528,962 @@ void SurfaceBuilder::smoothNormalsWithKernel(const vector<Vertex> &inVertices, i
 bool SurfaceBuilder::build(vector<Vec3> &inPoints, int inWidth, int inHeight, int resolution, double c,
                            vector<Vertex> &outPoints, int &outWidth, int &outHeight)
 {
-    int n = inWidth * inHeight;
-
-    if (inWidth < 2 || inHeight < 2 || inPoints.size() != n || resolution < 2)
+    if (inPoints.size() != (size_t)inWidth * inHeight)
         return false;
 
-    vector<Segment> rowSegments;
-    vector<Segment> colSegments;
-    if (!getRowSegments(inPoints, inWidth, inHeight, c, rowSegments) || 
-        !getColSegments(inPoints, inWidth, inHeight, c, colSegments))
+    return build(HeightField::fromPoints(inPoints.data(), inWidth, inHeight), resolution, c, outPoints, outWidth, outHeight);
+}
+
+bool SurfaceBuilder::build(const HeightField &inField, int resolution, double c,
+                           vector<Vertex> &outPoints, int &outWidth, int &outHeight)
+{
+    SurfaceModel model;
+    if (resolution < 2 || !prepare(inField, c, model))
         return false;
-    
-    --resolution;
-    outWidth = resolution * (inWidth - 1) + 1;
-    outHeight = resolution * (inHeight - 1) + 1;
+
+    getOutputSize(inField.width(), inField.height(), resolution, outWidth, outHeight);
     outPoints.resize(outWidth * outHeight);
+    evaluate(model, resolution, 0, 0, outWidth, outHeight, outPoints.data(), outWidth);
 
-    for (int z = 0; z < inHeight; ++z)
+    return true;
+}
+
+bool SurfaceBuilder::build(const HeightField &inField, int resolution, double c, int kernelRadius, GridBuffer &outPoints)
+{
+    SurfaceModel model;
+    if (resolution < 2 || kernelRadius < 0 || !prepare(inField, c, model))
+        return false;
+
+    return buildGrid(model, resolution, kernelRadius, 0, outPoints);
+}
+
+bool SurfaceBuilder::build(const HeightField &inField, const unsigned char *mask, int resolution, double c, int kernelRadius,
+                           GridBuffer &outPoints, vector<int> &outIndices)
+{
+    SurfaceModel model;
+    if (resolution < 2 || kernelRadius < 0 || !prepare(inField, vector<HeightField>(), mask, c, model))
+        return false;
+
+    vector<unsigned char> cells;
+    getValidCells(inField.width(), inField.height(), mask, cells);
+    if (!buildGrid(model, resolution, kernelRadius, mask ? cells.data() : 0, outPoints))
+        return false;
+
+    triangulateGrid(inField.width(), inField.height(), mask, resolution, outIndices);
+    return true;
+}
+
+bool SurfaceBuilder::buildGrid(const SurfaceModel &model, int resolution, int kernelRadius, const unsigned char *cells,
+                               GridBuffer &outPoints)
+{
+    const HeightField &inField = model.field;
+    int outWidth, outHeight;
+    getOutputSize(inField.width(), inField.height(), resolution, outWidth, outHeight);
+    GridBuffer normals(outPoints.getPages());
+    vector<float> kernel;
+    if (!outPoints.allocate(outWidth, outHeight) || (kernelRadius > 0 && !normals.allocate(outWidth, outHeight)))
+        return false;
+    if (kernelRadius > 0)
+        Math::calcGaussianKernel(kernelRadius, false, kernel);
+    Vertex *vertices = kernelRadius > 0 ? normals.data() : outPoints.data();
+
+    // Each thread builds, computes normals and smooths the same band of patch rows, so the pages of the band
+    // are touched first and then reused by the same thread.
+    int patchRows = inField.height() - 1;
+    int step = resolution - 1;
+    #pragma omp parallel
     {
-        for (int x = 0; x < inWidth; ++x)
+        int thread = 0, threads = 1;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+        threads = omp_get_num_threads();
+#endif
+        int z0 = (int)((long long)thread * patchRows / threads) * step;
+        int z1 = thread == threads - 1 ? outHeight : (int)((long long)(thread + 1) * patchRows / threads) * step;
+        evaluate(model, resolution, 0, z0, outWidth, z1 - z0, vertices + z0 * outWidth, outWidth);
+        #pragma omp barrier
+        computeGridNormalRows(vertices, outWidth, outHeight, cells, step, z0, z1);
+        if (kernelRadius > 0)
         {
-            // What we have is Coons patch:
-            //
-            //  +-----> X (row)
-            //  |                               pseg1
-            //  |                 p00-------p01-------p02-------p03
-            //  V                  |         |         |         |
-            //  Z (col)            |         |         |         |
-            //                     |         |   seg1  |         |
-            //                    p10-------p11-------p12-------p13
-            //                     |         |         |         |
-            //               pseg2 |    seg2 |  COONS  | seg4    | pseg4
-            //                     |         |         |         |
-            //                    p20-------p21-------p22-------p23
-            //                     |         |   seg3  |         |
-            //                     |         |         |         |
-            //                     |         |         |         |
-            //                    p30-------p31-------p32-------p33
-            //                                  pseg3
-            //
-            // p00..p33 are points from the input array.
-            // p11, p12, p21, p22 are the points around the interpolation zone.
-            // The surrounding points are needed for bicubic blending.
-            // seg1..seg4 and pseg1..pseg4 are curve segments calculated above.
-            // seg1, seg3, pseg1 and pseg3 are in rowSegments array and their indices correspond to the indices of
-            // p11, p21, p01 and p31 respectively.
-            // seg2, seg4, pseg2 and pseg4 are in colSegments array and their indices correspond to the transposed
-            // indices of p11, p12, p10 and p13 respectively.
-            //
-            int p11 = gridIndex(inWidth, inHeight, x, z);
-            int p12 = gridIndex(inWidth, inHeight, x + 1, z);
-            int p21 = gridIndex(inWidth, inHeight, x, z + 1);
-            int p22 = gridIndex(inWidth, inHeight, x + 1, z + 1);
-            if (p11 >= 0 && p12 >= 0 && p21 >= 0 && p22 >= 0)
+            #pragma omp barrier
+            smoothNormalRows(vertices, outWidth, outHeight, cells, step, kernel, kernelRadius, outPoints.data(), outWidth,
+                             0, outWidth, z0, z1);
+        }
+    }
+
+    return true;
+}
+
+bool SurfaceBuilder::buildFused(const HeightField &inField, int resolution, double c, int kernelRadius, int tileSize,
+                                GridBuffer &outPoints)
+{
+    return buildTiled(inField, resolution, c, kernelRadius, tileSize, &outPoints, 0, 0);
+}
+
+bool SurfaceBuilder::buildFused(const HeightField &inField, int resolution, double c, int kernelRadius, int tileSize,
+                                double *outPositions, double *outNormals)
+{
+    return outPositions && outNormals &&
+           buildTiled(inField, resolution, c, kernelRadius, tileSize, 0, outPositions, outNormals);
+}
+
+bool SurfaceBuilder::buildTiled(const HeightField &inField, int resolution, double c, int kernelRadius, int tileSize,
+                                GridBuffer *outPoints, double *outPositions, double *outNormals)
+{
+    SurfaceModel model;
+    if (resolution < 2 || kernelRadius < 0 || tileSize < 0 || !prepare(inField, c, model))
+        return false;
+
+    int outWidth, outHeight;
+    getOutputSize(inField.width(), inField.height(), resolution, outWidth, outHeight);
+    if (outPoints && !outPoints->allocate(outWidth, outHeight))
+        return false;
+    vector<float> kernel;
+    if (kernelRadius > 0)
+        Math::calcGaussianKernel(kernelRadius, false, kernel);
+
+    // Normals need one more vertex around, smoothing needs kernel radius more normals around.
+    int halo = kernelRadius + 1;
+    if (tileSize == 0)
+        tileSize = max((int)sqrt((double)FUSED_TILE_BYTES / sizeof(Vertex)) - halo * 2, 16);
+    int tilesX = (outWidth + tileSize - 1) / tileSize;
+    int tilesZ = (outHeight + tileSize - 1) / tileSize;
+    Vertex *out = outPoints ? outPoints->data() : 0;
+    // Static schedule gives each thread a band of tile rows, so it touches the pages of the band first.
+    #pragma omp parallel
+    {
+        vector<Vertex> region, smoothed;
+        #pragma omp for schedule(static)
+        for (int tile = 0; tile < tilesX * tilesZ; ++tile)
+        {
+            int x0 = tile % tilesX * tileSize;
+            int z0 = tile / tilesX * tileSize;
+            int x1 = min(x0 + tileSize, outWidth);
+            int z1 = min(z0 + tileSize, outHeight);
+            int rx0 = max(x0 - halo, 0);
+            int rz0 = max(z0 - halo, 0);
+            int rw = min(x1 + halo, outWidth) - rx0;
+            int rh = min(z1 + halo, outHeight) - rz0;
+            region.resize(rw * rh);
+            evaluate(model, resolution, rx0, rz0, rw, rh, region.data(), rw);
+            // Normals on the region border are wrong unless it is the grid border, but they are not used.
+            computeGridNormalRows(region.data(), rw, rh, 0, 0, max(z0 - kernelRadius, 0) - rz0,
+                                  min(z1 + kernelRadius, outHeight) - rz0);
+            if (out)
             {
-                int seg1 = p11;
-                int seg2 = gridIndexClamped(inHeight, inWidth, z, x); // Transposed p11.
-                int seg3 = p21;
-                int seg4 = gridIndexClamped(inHeight, inWidth, z, x + 1); // Transposed p12.
-
-                int p00 = gridIndexClamped(inWidth, inHeight, x - 1, z - 1);
-                int p01 = gridIndexClamped(inWidth, inHeight, x, z - 1);
-                int p02 = gridIndexClamped(inWidth, inHeight, x + 1, z - 1);
-                int p03 = gridIndexClamped(inWidth, inHeight, x + 2, z - 1);
-
-                int p10 = gridIndexClamped(inWidth, inHeight, x - 1, z);
-                int p13 = gridIndexClamped(inWidth, inHeight, x + 2, z);
-                int p20 = gridIndexClamped(inWidth, inHeight, x - 1, z + 1);
-                int p23 = gridIndexClamped(inWidth, inHeight, x + 2, z + 1);
-
-                int p30 = gridIndexClamped(inWidth, inHeight, x - 1, z + 2);
-                int p31 = gridIndexClamped(inWidth, inHeight, x, z + 2);
-                int p32 = gridIndexClamped(inWidth, inHeight, x + 1, z + 2);
-                int p33 = gridIndexClamped(inWidth, inHeight, x + 2, z + 2);
-
-                int pseg1 = p01;
-                int pseg2 = gridIndexClamped(inHeight, inWidth, z, x - 1); // Transposed p10.
-                int pseg3 = p31;
-                int pseg4 = gridIndexClamped(inHeight, inWidth, z, x + 2); // Transposed p13.
-
-                double pValues[16] =
+                Vertex *tileOut = out + index(outWidth, rx0, rz0);
+                if (kernelRadius > 0)
                 {
-                    inPoints[p00].y, inPoints[p01].y, inPoints[p02].y, inPoints[p03].y,
-                    inPoints[p10].y, inPoints[p11].y, inPoints[p12].y, inPoints[p13].y,
-                    inPoints[p20].y, inPoints[p21].y, inPoints[p22].y, inPoints[p23].y,
-                    inPoints[p30].y, inPoints[p31].y, inPoints[p32].y, inPoints[p33].y
-                };
-                double aValues[16];
-                Math::bicubicMatrix(pValues, aValues);
-
-                for (int dx = 0; dx < resolution; ++dx)
+                    smoothNormalRows(region.data(), rw, rh, 0, 0, kernel, kernelRadius, tileOut, outWidth,
+                                     x0 - rx0, x1 - rx0, z0 - rz0, z1 - rz0);
+                }
+                else
                 {
-                    double t = (double)dx / (double)resolution;
-                    Vec2 c1 = rowSegments[seg1].calc(t, true);
-                    Vec2 c2 = rowSegments[seg3].calc(t, true);
-                    for (int dz = 0; dz < resolution; ++dz)
+                    for (int z = z0; z < z1; ++z)
+                    {
+                        const Vertex *src = &region[index(rw, x0 - rx0, z - rz0)];
+                        copy(src, src + (x1 - x0), out + index(outWidth, x0, z));
+                    }
+                }
+                continue;
+            }
+
+            // Positions and normals are split while the tile is still in cache.
+            const Vertex *src = region.data();
+            if (kernelRadius > 0)
+            {
+                smoothed.resize(rw * rh);
+                smoothNormalRows(region.data(), rw, rh, 0, 0, kernel, kernelRadius, smoothed.data(), rw,
+                                 x0 - rx0, x1 - rx0, z0 - rz0, z1 - rz0);
+                src = smoothed.data();
+            }
+            for (int z = z0; z < z1; ++z)
+            {
+                for (int x = x0; x < x1; ++x)
+                {
+                    const Vertex &v = src[index(rw, x - rx0, z - rz0)];
+                    size_t i = ((size_t)z * outWidth + x) * 3;
+                    outPositions[i] = v.position.x;
+                    outPositions[i + 1] = v.position.y;
+                    outPositions[i + 2] = v.position.z;
+                    outNormals[i] = v.normal.x;
+                    outNormals[i + 1] = v.normal.y;
+                    outNormals[i + 2] = v.normal.z;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool SurfaceBuilder::buildBanded(const HeightField &inField, int resolution, double c, int bandRows,
+                                 const BandHandler &onBand, const InputHandler &onInput)
+{
+    int inWidth = inField.width();
+    int inHeight = inField.height();
+    if (inWidth < 2 || inHeight < 2 || resolution < 2 || bandRows < 1)
+        return false;
+
+    int outWidth, outHeight;
+    getOutputSize(inWidth, inHeight, resolution, outWidth, outHeight);
+    int step = resolution - 1;
+
+    // The model of the band covers the input rows [a; b): patch rows [z0; z1) with the rows above and below them
+    // Catmull-Rom blending needs. Row segments of the rows shared with the previous band are kept, column segments
+    // are stored for the patch rows only, transposed as in the model of the whole grid.
+    SurfaceModel model;
+    model.c = c;
+    model.mask = 0;
+    model.values.resize(1);
+    model.rowSegments.resize(1);
+    model.colSegments.resize(1);
+    vector<Segment> &rowSegments = model.rowSegments[0];
+    vector<Segment> &colSegments = model.colSegments[0];
+    vector<StreamingCurveBuilder> builders(inWidth, StreamingCurveBuilder(c));
+    vector<Vec2> points(inWidth);
+    vector<Vertex> band;
+    Segment segment;
+    int a = 0, b = 0, pushed = 0;
+    for (int z0 = 0; z0 < inHeight - 1; z0 += bandRows)
+    {
+        int z1 = min(z0 + bandRows, inHeight - 1);
+        int na = max(z0 - 1, 0), nb = min(z1 + 2, inHeight);
+        if (onInput)
+            onInput(na, nb);
+
+        rowSegments.erase(rowSegments.begin(), rowSegments.begin() + (min(na, b) - a) * inWidth);
+        rowSegments.resize((nb - na) * inWidth);
+        for (int z = max(na, b); z < nb; ++z)
+        {
+            for (int x = 0; x < inWidth; ++x)
+                points[x] = Vec2(inField.x(x, z), inField.y(x, z));
+            CurveBuilder::build(points, &rowSegments[index(inWidth, 0, z - na)], c);
+        }
+        a = na;
+        b = nb;
+
+        // Segment z of a column is finalized by pushing the point z + 2, the last one by finishing the column.
+        colSegments.resize(inWidth * (b - a));
+        for (; pushed < b; ++pushed)
+        {
+            for (int x = 0; x < inWidth; ++x)
+            {
+                if (builders[x].push(Vec2(inField.z(x, pushed), inField.y(x, pushed)), segment))
+                    colSegments[index(b - a, pushed - 2 - a, x)] = segment;
+            }
+        }
+        if (z1 == inHeight - 1)
+        {
+            for (int x = 0; x < inWidth; ++x)
+            {
+                if (builders[x].finish(segment))
+                    colSegments[index(b - a, z1 - 1 - a, x)] = segment;
+            }
+        }
+
+        model.field = inField.rows(a, b);
+        model.values[0] = model.field;
+        int rows = (z1 - z0) * step + (z1 == inHeight - 1 ? 1 : 0);
+        band.resize(rows * outWidth);
+        #pragma omp parallel for schedule(dynamic)
+        for (int z = z0; z < z1; ++z)
+        {
+            evaluate(model, resolution, 0, (z - a) * step, outWidth, z == inHeight - 2 ? step + 1 : step,
+                     &band[index(outWidth, 0, (z - z0) * step)], outWidth);
+        }
+        if (!onBand(z0 * step, rows, band.data()))
+            return false;
+    }
+
+    return true;
+}
+
+bool SurfaceBuilder::buildChannels(const HeightField &inField, const vector<HeightField> &inChannels, int resolution, double c,
+                                   vector<Vertex> &outPoints, vector<vector<double> > &outChannels, int &outWidth, int &outHeight)
+{
+    SurfaceModel model;
+    if (resolution < 2 || !prepare(inField, inChannels, c, model))
+        return false;
+
+    getOutputSize(inField.width(), inField.height(), resolution, outWidth, outHeight);
+    outPoints.resize(outWidth * outHeight);
+    outChannels.resize(inChannels.size());
+    vector<double *> channelPtrs(inChannels.size());
+    for (int i = 0, n = inChannels.size(); i < n; ++i)
+    {
+        outChannels[i].resize(outWidth * outHeight);
+        channelPtrs[i] = outChannels[i].data();
+    }
+    evaluate(model, resolution, 0, 0, outWidth, outHeight, outPoints.data(), outWidth, channelPtrs.data());
+
+    return true;
+}
+
+bool SurfaceBuilder::buildWithDerivatives(const HeightField &inField, int resolution, double c, vector<Vertex> &outPoints,
+                                          SurfaceDerivatives &outDerivatives, int &outWidth, int &outHeight)
+{
+    SurfaceModel model;
+    if (resolution < 2 || !prepare(inField, c, model))
+        return false;
+
+    getOutputSize(inField.width(), inField.height(), resolution, outWidth, outHeight);
+    int n = outWidth * outHeight;
+    outPoints.resize(n);
+    outDerivatives.dx.resize(n);
+    outDerivatives.dz.resize(n);
+    outDerivatives.dxx.resize(n);
+    outDerivatives.dxz.resize(n);
+    outDerivatives.dzz.resize(n);
+    double *derivatives[DERIVATIVES] =
+    {
+        outDerivatives.dx.data(), outDerivatives.dz.data(),
+        outDerivatives.dxx.data(), outDerivatives.dxz.data(), outDerivatives.dzz.data()
+    };
+    evaluate(model, resolution, 0, 0, outWidth, outHeight, outPoints.data(), outWidth, 0, derivatives);
+
+    return true;
+}
+
+bool SurfaceBuilder::prepare(const HeightField &inField, double c, SurfaceModel &model)
+{
+    return prepare(inField, vector<HeightField>(), 0, c, model);
+}
+
+bool SurfaceBuilder::prepare(const HeightField &inField, const vector<HeightField> &inChannels, double c, SurfaceModel &model)
+{
+    return prepare(inField, inChannels, 0, c, model);
+}
+
+bool SurfaceBuilder::prepare(const HeightField &inField, const vector<HeightField> &inChannels, const unsigned char *mask,
+                             double c, SurfaceModel &model)
+{
+    if (inField.width() < 2 || inField.height() < 2)
+        return false;
+
+    int n = inChannels.size() + 1;
+    model.field = inField;
+    model.mask = mask;
+    model.c = c;
+    model.values.assign(1, inField);
+    model.values.insert(model.values.end(), inChannels.begin(), inChannels.end());
+    model.rowSegments.resize(n);
+    model.colSegments.resize(n);
+    for (int i = 0; i < n; ++i)
+    {
+        const HeightField &values = model.values[i];
+        if (values.width() != inField.width() || values.height() != inField.height())
+            return false;
+        getRowSegments(inField, values, mask, c, model.rowSegments[i]);
+        getColSegments(inField, values, mask, c, model.colSegments[i]);
+        if (i > 0)
+        {
+            shareParameterization(model.rowSegments[0], model.rowSegments[i], 0, model.rowSegments[i].size());
+            shareParameterization(model.colSegments[0], model.colSegments[i], 0, model.colSegments[i].size());
+        }
+    }
+    return true;
+}
+
+bool SurfaceBuilder::refresh(SurfaceModel &model, int x0, int z0, int w, int h)
+{
+    int inWidth = model.field.width();
+    int inHeight = model.field.height();
+    if (w < 1 || h < 1 || x0 < 0 || z0 < 0 || x0 + w > inWidth || z0 + h > inHeight)
+        return false;
+
+    // Segment i depends on the points from i - 1 to i + 2.
+    int sx0 = max(x0 - 2, 0), sx1 = min(x0 + w, inWidth - 2);
+    int sz0 = max(z0 - 2, 0), sz1 = min(z0 + h, inHeight - 2);
+    for (int i = 0, n = model.values.size(); i < n; ++i)
+    {
+        const HeightField &values = model.values[i];
+        updateRowSegments(model.field, values, model.mask, model.c, sx0, sx1, z0, z0 + h - 1, model.rowSegments[i]);
+        updateColSegments(model.field, values, model.mask, model.c, x0, x0 + w - 1, sz0, sz1, model.colSegments[i]);
+        if (i > 0)
+        {
+            for (int z = z0; z < z0 + h; ++z)
+                shareParameterization(model.rowSegments[0], model.rowSegments[i], index(inWidth, sx0, z), index(inWidth, sx1, z) + 1);
+            for (int x = x0; x < x0 + w; ++x)
+                shareParameterization(model.colSegments[0], model.colSegments[i], index(inHeight, sz0, x), index(inHeight, sz1, x) + 1);
+        }
+    }
+    return true;
+}
+
+void SurfaceBuilder::getOutputSize(int inWidth, int inHeight, int resolution, int &outWidth, int &outHeight)
+{
+    outWidth = (resolution - 1) * (inWidth - 1) + 1;
+    outHeight = (resolution - 1) * (inHeight - 1) + 1;
+}
+
+void SurfaceBuilder::evaluate(const SurfaceModel &model, int resolution, int x0, int z0, int w, int h,
+                              Vertex *outPoints, int outStride, double *const *outChannels, double *const *outDerivatives)
+{
+    int inWidth = model.field.width();
+    int inHeight = model.field.height();
+    int channels = model.values.size() - 1;
+
+    --resolution;
+    int outWidth = resolution * (inWidth - 1) + 1;
+    int outHeight = resolution * (inHeight - 1) + 1;
+    if (x0 < 0 || z0 < 0 || w <= 0 || h <= 0 || x0 + w > outWidth || z0 + h > outHeight)
+        return;
+
+    // Per-cell curve values: 4 row and 4 column curves for each channel, their shared parameters,
+    // bicubic matrices of each channel and first and second derivatives of the height curves.
+    vector<double> scratch((channels + 2) * 8 * resolution + (channels + 1) * 16 + 16 * resolution);
+    vector<double *> cellChannels(channels);
+    double *cellDerivatives[DERIVATIVES];
+
+    // Outer loops walk the input cells overlapping the region, inner loops walk the samples of each cell
+    // falling into the region. Sample (dx, dz) of cell (x, z) has global position (x * r + dx, z * r + dz).
+    int x1 = x0 + w;
+    int z1 = z0 + h;
+    for (int z = z0 / resolution; z <= (z1 - 1) / resolution; ++z)
+    {
+        int dz0 = max(z0 - z * resolution, 0);
+        int dz1 = min(z1 - z * resolution, resolution);
+        for (int x = x0 / resolution; x <= (x1 - 1) / resolution; ++x)
+        {
+            int dx0 = max(x0 - x * resolution, 0);
+            int dx1 = min(x1 - x * resolution, resolution);
+            int offset = (z * resolution - z0) * outStride + (x * resolution - x0);
+            for (int i = 0; i < channels; ++i)
+                cellChannels[i] = outChannels && outChannels[i] ? outChannels[i] + offset : 0;
+            for (int i = 0; i < DERIVATIVES; ++i)
+                cellDerivatives[i] = outDerivatives ? outDerivatives[i] + offset : 0;
+            evaluateCell(model, resolution, x, z, dx0, dx1, dz0, dz1, 1, false, outPoints + offset, cellChannels.data(),
+                         outDerivatives ? cellDerivatives : 0, outStride, scratch.data());
+        }
+    }
+}
+
+void SurfaceBuilder::evaluateLevel(const SurfaceModel &model, int resolution, int step, bool refine, Vertex *outPoints, int outStride)
+{
+    int inWidth = model.field.width();
+    int inHeight = model.field.height();
+    int channels = model.values.size() - 1;
+
+    --resolution;
+    if (step < 1 || resolution % step != 0)
+        return;
+
+    // Each cell evaluates its own samples, and the last row and column of the grid are
+    // evaluated by the edge cells, so the cells do not overlap and can run in parallel.
+    #pragma omp parallel
+    {
+        vector<double> scratch((channels + 2) * 8 * resolution + (channels + 1) * 16 + 16 * resolution);
+        vector<double *> cellChannels(channels, (double *)0);
+        #pragma omp for schedule(dynamic)
+        for (int z = 0; z < inHeight; ++z)
+        {
+            for (int x = 0; x < inWidth; ++x)
+            {
+                evaluateCell(model, resolution, x, z, 0, resolution, 0, resolution, step, refine,
+                             outPoints + z * resolution * outStride + x * resolution, cellChannels.data(), 0, outStride,
+                             scratch.data());
+            }
+        }
+    }
+}
+
+SLEEKSURFACE_DISPATCH void SurfaceBuilder::evaluateCurves(const vector<vector<Segment> > &segments, const int *segIndices, int d0, int d1,
+                                                          int step, int resolution, double *params, double *values, double *derivatives)
+{
+    // Regular parameters depend on x-coordinates of control points only, which the channel curves mostly share
+    // with the height ones, so they are found once for the first channel and reused by the others where possible.
+    // Finding them branches on the roots of the cubic equation, so only the curves with shared ones run in SIMD lanes.
+    int n = (d1 - d0 + step - 1) / step;
+    int channels = segments.size();
+    for (int slot = 0; slot < 4; ++slot)
+    {
+        const Segment &base = segments[0][segIndices[slot]];
+        double *slotParams = params + slot * n;
+        for (int d = d0, i = 0; d < d1; d += step, ++i)
+        {
+            double t = (double)d / (double)resolution;
+            double s = t;
+            bool regular = base.regularParam(t, s);
+            slotParams[i] = s;
+            if (derivatives)
+                base.calcDerivativesY(s, regular, derivatives[slot * n + i], derivatives[(slot + 4) * n + i]);
+        }
+        for (int k = 0; k < channels; ++k)
+        {
+            const Segment &segment = segments[k][segIndices[slot]];
+            double *slotValues = values + (k * 4 + slot) * n;
+            if (segment.sameX(base))
+            {
+                #pragma omp simd
+                for (int i = 0; i < n; ++i)
+                    slotValues[i] = segment.calcY(slotParams[i]);
+            }
+            else
+            {
+                for (int d = d0, i = 0; d < d1; d += step, ++i)
+                    slotValues[i] = segment.calc((double)d / (double)resolution, true).y;
+            }
+        }
+    }
+}
+
+SLEEKSURFACE_DISPATCH void SurfaceBuilder::evaluateCell(const SurfaceModel &model, int resolution, int x, int z, int dx0, int dx1,
+                                                        int dz0, int dz1, int step, bool refine, Vertex *cellPoints,
+                                                        double *const *cellChannels, double *const *cellDerivatives, int outStride,
+                                                        double *scratch)
+{
+    const HeightField &inField = model.field;
+    const vector<vector<Segment> > &rowSegments = model.rowSegments;
+    const vector<vector<Segment> > &colSegments = model.colSegments;
+    int inHeight = inField.height();
+    int channels = model.values.size();
+
+    // What we have is Coons patch:
+    //
+    //  +-----> X (row)
+    //  |                               pseg1
+    //  |                 p00-------p01-------p02-------p03
+    //  V                  |         |         |         |
+    //  Z (col)            |         |         |         |
+    //                     |         |   seg1  |         |
+    //                    p10-------p11-------p12-------p13
+    //                     |         |         |         |
+    //               pseg2 |    seg2 |  COONS  | seg4    | pseg4
+    //                     |         |         |         |
+    //                    p20-------p21-------p22-------p23
+    //                     |         |   seg3  |         |
+    //                     |         |         |         |
+    //                     |         |         |         |
+    //                    p30-------p31-------p32-------p33
+    //                                  pseg3
+    //
+    // p00..p33 are points from the input array.
+    // p11, p12, p21, p22 are the points around the interpolation zone.
+    // The surrounding points are needed for bicubic blending.
+    // seg1..seg4 and pseg1..pseg4 are curve segments calculated above.
+    // seg1, seg3, pseg1 and pseg3 are in rowSegments array and their indices correspond to the indices of
+    // p11, p21, p01 and p31 respectively.
+    // seg2, seg4, pseg2 and pseg4 are in colSegments array and their indices correspond to the transposed
+    // indices of p11, p12, p10 and p13 respectively.
+    //
+    // Each channel has its own set of curves and its own values in p00..p33.
+    // Row curves depend on dx only and column curves depend on dz only, so they are evaluated once per cell
+    // column and row respectively.
+    //
+    int p11 = validIndex(model, x, z);
+    int p12 = validIndex(model, x + 1, z);
+    int p21 = validIndex(model, x, z + 1);
+    int p22 = validIndex(model, x + 1, z + 1);
+    if (p11 >= 0 && p12 >= 0 && p21 >= 0 && p22 >= 0)
+    {
+        int rowIndices[4], colIndices[4];
+        int nx = (dx1 - dx0 + step - 1) / step;
+        int nz = (dz1 - dz0 + step - 1) / step;
+        double *rowValues = scratch;
+        double *colValues = rowValues + channels * 4 * nx;
+        double *params = colValues + channels * 4 * nz;
+        double *aValues = params + 4 * max(nx, nz);
+        double *rowDerivatives = cellDerivatives ? aValues + channels * 16 : 0;
+        double *colDerivatives = cellDerivatives ? rowDerivatives + 8 * nx : 0;
+        getPatch(model, x, z, channels, rowIndices, colIndices, aValues);
+        evaluateCurves(rowSegments, rowIndices, dx0, dx1, step, resolution, params, rowValues, rowDerivatives);
+        evaluateCurves(colSegments, colIndices, dz0, dz1, step, resolution, params, colValues, colDerivatives);
+
+        Vec3 v11 = inField.point(x, z);
+        double x12 = inField.x(x + 1, z);
+        double z21 = inField.z(x, z + 1);
+        double sx = 1.0 / (x12 - v11.x);
+        double sz = 1.0 / (z21 - v11.z);
+
+        for (int dx = dx0, i = 0; dx < dx1; dx += step, ++i)
+        {
+            double t = (double)dx / (double)resolution;
+            if (!cellDerivatives && !refine)
+            {
+                // The column of samples is evaluated in SIMD lanes, a lane per sample, into the scratch left for
+                // derivatives, and then scattered to the output with the same values as the loop below.
+                double *lane = aValues + channels * 16;
+                for (int k = 0; k < channels; ++k)
+                {
+                    if (k > 0 && !cellChannels[k - 1])
+                        continue;
+
+                    const double *r = rowValues + k * 4 * nx + i;
+                    const double *c = colValues + k * 4 * nz;
+                    double *a = aValues + k * 16;
+                    double r0 = r[0], r1 = r[nx], r2 = r[2 * nx], r3 = r[3 * nx];
+                    #pragma omp simd
+                    for (int j = 0; j < nz; ++j)
+                    {
+                        double q = (double)(dz0 + j * step) / (double)resolution;
+                        double ruledSurface1 = Math::cubicInterpolate(r0, r1, r2, r3, q);
+                        double ruledSurface2 = Math::cubicInterpolate(c[j], c[nz + j], c[2 * nz + j], c[3 * nz + j], t);
+                        lane[j] = ruledSurface1 + ruledSurface2 - Math::bicubicInterpolate(a, q, t);
+                    }
+                    for (int dz = dz0, j = 0; dz < dz1; dz += step, ++j)
                     {
-                        if (dx == 0 && dz == 0)
-                            outPoints[outIndex(outWidth, resolution, x, z, dx, dz)] = Vertex(inPoints[p11]);
+                        int out = dz * outStride + dx;
+                        if (k > 0)
+                            cellChannels[k - 1][out] = dx == 0 && dz == 0 ? model.values[k].y(x, z) : lane[j];
+                        else if (dx == 0 && dz == 0)
+                            cellPoints[out] = Vertex(v11);
                         else
                         {
                             double q = (double)dz / (double)resolution;
-                            Vec2 c3 = colSegments[seg2].calc(q, true);
-                            Vec2 c4 = colSegments[seg4].calc(q, true);
+                            cellPoints[out] = Vertex(Vec3(v11.x + t * (x12 - v11.x), lane[j], v11.z + q * (z21 - v11.z)));
+                        }
+                    }
+                }
+                continue;
+            }
 
-                            Vec2 r1 = rowSegments[pseg1].calc(t, true);
-                            Vec2 r2 = rowSegments[pseg3].calc(t, true);
-                            double ruledSurface1 = Math::cubicInterpolate(r1.y, c1.y, c2.y, r2.y, q);
+            for (int dz = dz0, j = 0; dz < dz1; dz += step, ++j)
+            {
+                if (refine && dx % (2 * step) == 0 && dz % (2 * step) == 0)
+                    continue;
 
-                            r1 = colSegments[pseg2].calc(q, true);
-                            r2 = colSegments[pseg4].calc(q, true);
-                            double ruledSurface2 = Math::cubicInterpolate(r1.y, c3.y, c4.y, r2.y, t);
+                int out = dz * outStride + dx;
+                if (cellDerivatives)
+                {
+                    // Derivatives of the Coons patch, t is along x and q is along z.
+                    double q = (double)dz / (double)resolution;
+                    const double *r = rowValues + i;
+                    const double *dr = rowDerivatives + i;
+                    const double *ddr = dr + 4 * nx;
+                    const double *c = colValues + j;
+                    const double *dc = colDerivatives + j;
+                    const double *ddc = dc + 4 * nz;
+                    double b[5];
+                    Math::bicubicDerivatives(aValues, q, t, b);
 
-                            double biSurface = Math::bicubicInterpolate(aValues, q, t);
+                    double ht = Math::cubicInterpolate(dr[0], dr[nx], dr[2 * nx], dr[3 * nx], q) +
+                                Math::cubicDerivative(c[0], c[nz], c[2 * nz], c[3 * nz], t) - b[1];
+                    double hq = Math::cubicDerivative(r[0], r[nx], r[2 * nx], r[3 * nx], q) +
+                                Math::cubicInterpolate(dc[0], dc[nz], dc[2 * nz], dc[3 * nz], t) - b[0];
+                    double htt = Math::cubicInterpolate(ddr[0], ddr[nx], ddr[2 * nx], ddr[3 * nx], q) +
+                                 Math::cubicSecondDerivative(c[0], c[nz], c[2 * nz], c[3 * nz], t) - b[4];
+                    double htq = Math::cubicDerivative(dr[0], dr[nx], dr[2 * nx], dr[3 * nx], q) +
+                                 Math::cubicDerivative(dc[0], dc[nz], dc[2 * nz], dc[3 * nz], t) - b[3];
+                    double hqq = Math::cubicSecondDerivative(r[0], r[nx], r[2 * nx], r[3 * nx], q) +
+                                 Math::cubicInterpolate(ddc[0], ddc[nz], ddc[2 * nz], ddc[3 * nz], t) - b[2];
 
-                            outPoints[outIndex(outWidth, resolution, x, z, dx, dz)] =
-                                Vertex(Vec3(inPoints[p11].x + t * (inPoints[p12].x - inPoints[p11].x),
-                                            ruledSurface1 + ruledSurface2 - biSurface,
-                                            inPoints[p11].z + q * (inPoints[p21].z - inPoints[p11].z)));
-                        }
+                    cellDerivatives[0][out] = ht * sx;
+                    cellDerivatives[1][out] = hq * sz;
+                    cellDerivatives[2][out] = htt * sx * sx;
+                    cellDerivatives[3][out] = htq * sx * sz;
+                    cellDerivatives[4][out] = hqq * sz * sz;
+                }
+                if (dx == 0 && dz == 0)
+                {
+                    cellPoints[out] = Vertex(v11);
+                    for (int k = 1; k < channels; ++k)
+                    {
+                        if (cellChannels[k - 1])
+                            cellChannels[k - 1][out] = model.values[k].y(x, z);
                     }
+                    continue;
+                }
+
+                double q = (double)dz / (double)resolution;
+                for (int k = 0; k < channels; ++k)
+                {
+                    if (k > 0 && !cellChannels[k - 1])
+                        continue;
+
+                    const double *r = rowValues + k * 4 * nx + i;
+                    double ruledSurface1 = Math::cubicInterpolate(r[0], r[nx], r[2 * nx], r[3 * nx], q);
+
+                    const double *c = colValues + k * 4 * nz + j;
+                    double ruledSurface2 = Math::cubicInterpolate(c[0], c[nz], c[2 * nz], c[3 * nz], t);
+
+                    double biSurface = Math::bicubicInterpolate(aValues + k * 16, q, t);
+
+                    double y = ruledSurface1 + ruledSurface2 - biSurface;
+                    if (k == 0)
+                        cellPoints[out] = Vertex(Vec3(v11.x + t * (x12 - v11.x), y, v11.z + q * (z21 - v11.z)));
+                    else
+                        cellChannels[k - 1][out] = y;
                 }
             }
-            else if (p11 >= 0 && p12 >= 0 && p21 < 0 && p22 < 0)
-            {
-                int seg1 = p11;
+        }
+    }
+    else if (p11 >= 0)
+    {
+        // The cell is incomplete: it lies at the grid border or next to missing points. Only its top and left
+        // edges with both end points valid are evaluated, along the row and column curves respectively.
+        bool row = p12 >= 0 && dz0 == 0;
+        bool col = p21 >= 0 && dx0 == 0;
+        Vec3 v11 = inField.point(x, z);
+        if (row)
+        {
+            int seg1 = p11;
+            Vec3 v12 = inField.point(x + 1, z);
 
-                outPoints[outIndex(outWidth, resolution, x, z, 0, 0)] = Vertex(inPoints[p11]);
-                for (int dx = 1; dx < resolution; ++dx)
+            for (int dx = dx0; dx < dx1; dx += step)
+            {
+                if (refine && dx % (2 * step) == 0)
+                    continue;
+                if (dx == 0)
+                    cellPoints[0] = Vertex(v11);
+                else
                 {
                     double t = (double)dx / (double)resolution;
-                    Vec2 c1 = rowSegments[seg1].calc(t, true);
-                    outPoints[outIndex(outWidth, resolution, x, z, dx, 0)] =
-                        Vertex(Vec3(inPoints[p11].x + t * (inPoints[p12].x - inPoints[p11].x),
+                    Vec2 c1 = rowSegments[0][seg1].calc(t, true);
+                    cellPoints[dx] =
+                        Vertex(Vec3(v11.x + t * (v12.x - v11.x),
                                     c1.y,
-                                    inPoints[p11].z + t * (inPoints[p12].z - inPoints[p11].z)));
+                                    v11.z + t * (v12.z - v11.z)));
+                }
+                for (int k = 1; k < channels; ++k)
+                {
+                    if (cellChannels[k - 1])
+                        cellChannels[k - 1][dx] = dx == 0 ? model.values[k].y(x, z) :
+                                                  rowSegments[k][seg1].calc((double)dx / (double)resolution, true).y;
                 }
             }
-            else if (p11 >= 0 && p21 >= 0 && p12 < 0 && p22 < 0)
-            {
-                int seg2 = gridIndexClamped(inHeight, inWidth, z, x); // Transposed p11.
+            if (cellDerivatives)
+                evaluateEdgeDerivatives(model, resolution, x, z, dx0, dx1, 0, 1, cellDerivatives, outStride, scratch);
+        }
+        if (col)
+        {
+            int seg2 = index(inHeight, z, x); // Transposed p11.
+            Vec3 v21 = inField.point(x, z + 1);
+            int cz0 = row ? dz0 + step : dz0;
 
-                outPoints[outIndex(outWidth, resolution, x, z, 0, 0)] = Vertex(inPoints[p11]);
-                for (int dz = 1; dz < resolution; ++dz)
+            for (int dz = cz0; dz < dz1; dz += step)
+            {
+                if (refine && dz % (2 * step) == 0)
+                    continue;
+                if (dz == 0)
+                    cellPoints[0] = Vertex(v11);
+                else
                 {
                     double t = (double)dz / (double)resolution;
-                    Vec2 c1 = colSegments[seg2].calc(t, true);
-                    outPoints[outIndex(outWidth, resolution, x, z, 0, dz)] =
-                        Vertex(Vec3(inPoints[p11].x + t * (inPoints[p21].x - inPoints[p11].x),
+                    Vec2 c1 = colSegments[0][seg2].calc(t, true);
+                    cellPoints[dz * outStride] =
+                        Vertex(Vec3(v11.x + t * (v21.x - v11.x),
                                     c1.y,
-                                    inPoints[p11].z + t * (inPoints[p21].z - inPoints[p11].z)));
+                                    v11.z + t * (v21.z - v11.z)));
+                }
+                for (int k = 1; k < channels; ++k)
+                {
+                    if (cellChannels[k - 1])
+                        cellChannels[k - 1][dz * outStride] = dz == 0 ? model.values[k].y(x, z) :
+                                                              colSegments[k][seg2].calc((double)dz / (double)resolution, true).y;
                 }
             }
-            else if (p11 >= 0 && p12 < 0 && p21 < 0 && p22 < 0)
+            if (cellDerivatives && cz0 < dz1)
+                evaluateEdgeDerivatives(model, resolution, x, z, 0, 1, cz0, dz1, cellDerivatives, outStride, scratch);
+        }
+        if (!row && !col && dx0 == 0 && dz0 == 0 && !refine)
+        {
+            cellPoints[0] = Vertex(v11);
+            for (int k = 1; k < channels; ++k)
             {
-                outPoints[outIndex(outWidth, resolution, x, z, 0, 0)] = Vertex(inPoints[p11]);
+                if (cellChannels[k - 1])
+                    cellChannels[k - 1][0] = model.values[k].y(x, z);
             }
+            if (cellDerivatives)
+                evaluateEdgeDerivatives(model, resolution, x, z, 0, 1, 0, 1, cellDerivatives, outStride, scratch);
         }
     }
+}
 
+bool SurfaceBuilder::evaluateHeight(const SurfaceModel &model, int x, int z, double t, double q, double &y)
+{
+    int p11 = validIndex(model, x, z);
+    int p12 = validIndex(model, x + 1, z);
+    int p21 = validIndex(model, x, z + 1);
+    int p22 = validIndex(model, x + 1, z + 1);
+    if (p11 >= 0 && p12 >= 0 && p21 >= 0 && p22 >= 0)
+        return evaluateHeights(model, x, z, &t, 1, &q, 1, &y);
+    if (p11 >= 0 && p12 >= 0 && q == 0.0)
+    {
+        y = model.rowSegments[0][p11].calc(t, true).y;
+        return true;
+    }
+    if (p11 >= 0 && p21 >= 0 && t == 0.0)
+    {
+        y = model.colSegments[0][index(model.field.height(), z, x)].calc(q, true).y;
+        return true;
+    }
+    if (p11 >= 0 && t == 0.0 && q == 0.0)
+    {
+        y = model.field.y(x, z);
+        return true;
+    }
+    return false;
+}
+
+bool SurfaceBuilder::evaluateHeights(const SurfaceModel &model, int x, int z, const double *t, int nt, const double *q, int nq,
+                                     double *y)
+{
+    if (validIndex(model, x, z) < 0 || validIndex(model, x + 1, z) < 0 ||
+        validIndex(model, x, z + 1) < 0 || validIndex(model, x + 1, z + 1) < 0)
+        return false;
+
+    int rowIndices[4], colIndices[4];
+    double aValues[16];
+    getPatch(model, x, z, 1, rowIndices, colIndices, aValues);
+    // Row curves depend on t only and column curves on q only, so each of them is evaluated once per parameter.
+    vector<double> r(nt * 4), c(nq * 4);
+    for (int slot = 0; slot < 4; ++slot)
+    {
+        const Segment &row = model.rowSegments[0][rowIndices[slot]];
+        const Segment &col = model.colSegments[0][colIndices[slot]];
+        for (int i = 0; i < nt; ++i)
+        {
+            double s = t[i];
+            row.regularParam(t[i], s);
+            r[i * 4 + slot] = row.calcY(s);
+        }
+        for (int j = 0; j < nq; ++j)
+        {
+            double s = q[j];
+            col.regularParam(q[j], s);
+            c[j * 4 + slot] = col.calcY(s);
+        }
+    }
+    for (int j = 0; j < nq; ++j)
+    {
+        for (int i = 0; i < nt; ++i)
+        {
+            const double *ri = &r[i * 4], *cj = &c[j * 4];
+            y[j * nt + i] = Math::cubicInterpolate(ri[0], ri[1], ri[2], ri[3], q[j]) +
+                            Math::cubicInterpolate(cj[0], cj[1], cj[2], cj[3], t[i]) -
+                            Math::bicubicInterpolate(aValues, q[j], t[i]);
+        }
+    }
+    return true;
+}
+
+bool SurfaceBuilder::getPatchBounds(const SurfaceModel &model, int x, int z, double &minY, double &maxY)
+{
+    if (validIndex(model, x, z) < 0 || validIndex(model, x + 1, z) < 0 ||
+        validIndex(model, x, z + 1) < 0 || validIndex(model, x + 1, z + 1) < 0)
+        return false;
+
+    int rowIndices[4], colIndices[4];
+    double aValues[16];
+    getPatch(model, x, z, 1, rowIndices, colIndices, aValues);
+
+    // Bezier curves lie within the convex hulls of their control points. Catmull-Rom weights of the ruled surfaces
+    // are w0, w3 in [-2/27; 0] and w1, w2 in [0; 1]. Powers of the bicubic parameters are in [0; 1].
+    const double weights[4][2] = {{-2.0 / 27.0, 0.0}, {0.0, 1.0}, {0.0, 1.0}, {-2.0 / 27.0, 0.0}};
+    double lo = 0.0, hi = 0.0;
+    double curveMin = model.field.y(x, z), curveMax = curveMin;
+    for (int slot = 0; slot < 4; ++slot)
+    {
+        const Segment *segments[2] = {&model.rowSegments[0][rowIndices[slot]], &model.colSegments[0][colIndices[slot]]};
+        for (int k = 0; k < 2; ++k)
+        {
+            double segMin = segments[k]->points[0].y, segMax = segMin;
+            for (int i = 1; i < 4; ++i)
+            {
+                segMin = min(segMin, segments[k]->points[i].y);
+                segMax = max(segMax, segments[k]->points[i].y);
+            }
+            double products[4] =
+            {
+                weights[slot][0] * segMin, weights[slot][0] * segMax, weights[slot][1] * segMin, weights[slot][1] * segMax
+            };
+            lo += *min_element(products, products + 4);
+            hi += *max_element(products, products + 4);
+            curveMin = min(curveMin, segMin);
+            curveMax = max(curveMax, segMax);
+        }
+    }
+    double magnitude = abs(lo) + abs(hi) + abs(aValues[0]);
+    lo -= aValues[0];
+    hi -= aValues[0];
+    for (int i = 1; i < 16; ++i)
+    {
+        lo -= max(aValues[i], 0.0);
+        hi -= min(aValues[i], 0.0);
+        magnitude += abs(aValues[i]);
+    }
+
+    // The patch coincides with the curves at its borders, which are taken into account for the rounding errors.
+    double slack = magnitude * 1.0e-12;
+    minY = min(lo, curveMin) - slack;
+    maxY = max(hi, curveMax) + slack;
     return true;
 }
+
+void SurfaceBuilder::getPatch(const SurfaceModel &model, int x, int z, int channels, int *rowIndices, int *colIndices, double *aValues)
+{
+    int inWidth = model.field.width();
+    int inHeight = model.field.height();
+
+    // Clamped coordinates of the surrounding points. Missing points are clamped the same way as the grid
+    // borders, so the surrounding curves always exist. Of the diagonal points only the corners can be missing,
+    // they are replaced by the neighbouring points of the same row.
+    int x0 = validIndex(model, x - 1, z) >= 0 && validIndex(model, x - 1, z + 1) >= 0 ? x - 1 : x;
+    int x3 = validIndex(model, x + 2, z) >= 0 && validIndex(model, x + 2, z + 1) >= 0 ? x + 2 : x + 1;
+    int z0 = validIndex(model, x, z - 1) >= 0 && validIndex(model, x + 1, z - 1) >= 0 ? z - 1 : z;
+    int z3 = validIndex(model, x, z + 2) >= 0 && validIndex(model, x + 1, z + 2) >= 0 ? z + 2 : z + 1;
+    int x00 = validIndex(model, x0, z0) >= 0 ? x0 : x;
+    int x03 = validIndex(model, x3, z0) >= 0 ? x3 : x + 1;
+    int x30 = validIndex(model, x0, z3) >= 0 ? x0 : x;
+    int x33 = validIndex(model, x3, z3) >= 0 ? x3 : x + 1;
+
+    // Row curves in order pseg1, seg1, seg3, pseg3 and column curves in order pseg2, seg2, seg4, pseg4,
+    // the order of Catmull-Rom control points.
+    rowIndices[0] = index(inWidth, x, z0);     // p01.
+    rowIndices[1] = index(inWidth, x, z);      // p11.
+    rowIndices[2] = index(inWidth, x, z + 1);  // p21.
+    rowIndices[3] = index(inWidth, x, z3);     // p31.
+    colIndices[0] = index(inHeight, z, x0);    // Transposed p10.
+    colIndices[1] = index(inHeight, z, x);     // Transposed p11.
+    colIndices[2] = index(inHeight, z, x + 1); // Transposed p12.
+    colIndices[3] = index(inHeight, z, x3);    // Transposed p13.
+
+    for (int k = 0; k < channels; ++k)
+    {
+        const HeightField &inValues = model.values[k];
+        double pValues[16] =
+        {
+            inValues.y(x00, z0), inValues.y(x, z0), inValues.y(x + 1, z0), inValues.y(x03, z0),
+            inValues.y(x0, z), inValues.y(x, z), inValues.y(x + 1, z), inValues.y(x3, z),
+            inValues.y(x0, z + 1), inValues.y(x, z + 1), inValues.y(x + 1, z + 1), inValues.y(x3, z + 1),
+            inValues.y(x30, z3), inValues.y(x, z3), inValues.y(x + 1, z3), inValues.y(x33, z3)
+        };
+        Math::bicubicMatrix(pValues, aValues + k * 16);
+    }
+}
+
+void SurfaceBuilder::evaluateEdgeDerivatives(const SurfaceModel &model, int resolution, int x, int z, int dx0, int dx1, int dz0, int dz1,
+                                             double *const *cellDerivatives, int outStride, double *scratch)
+{
+    // Samples of the last grid row and column have no patch of their own,
+    // so their derivatives are taken from the neighbouring patch at its far edge.
+    // Incomplete patches of masked models have no derivatives.
+    int nx = x == model.field.width() - 1 ? x - 1 : x;
+    int nz = z == model.field.height() - 1 ? z - 1 : z;
+    if (validIndex(model, nx, nz) < 0 || validIndex(model, nx + 1, nz) < 0 ||
+        validIndex(model, nx, nz + 1) < 0 || validIndex(model, nx + 1, nz + 1) < 0)
+        return;
+    int ex0 = nx == x ? dx0 : resolution;
+    int ex1 = nx == x ? dx1 : resolution + 1;
+    int ez0 = nz == z ? dz0 : resolution;
+    int ez1 = nz == z ? dz1 : resolution + 1;
+
+    vector<Vertex> points(ez1 * ex1);
+    vector<double> values(DERIVATIVES * ez1 * ex1);
+    vector<double *> channels(model.values.size() - 1, (double *)0);
+    double *derivatives[DERIVATIVES];
+    for (int i = 0; i < DERIVATIVES; ++i)
+        derivatives[i] = values.data() + i * ez1 * ex1;
+    evaluateCell(model, resolution, nx, nz, ex0, ex1, ez0, ez1, 1, false, points.data(), channels.data(), derivatives, ex1, scratch);
+
+    for (int dz = dz0; dz < dz1; ++dz)
+    {
+        for (int dx = dx0; dx < dx1; ++dx)
+        {
+            int src = (nz == z ? dz : resolution) * ex1 + (nx == x ? dx : resolution);
+            for (int i = 0; i < DERIVATIVES; ++i)
+                cellDerivatives[i][dz * outStride + dx] = derivatives[i][src];
+        }
+    }
+}
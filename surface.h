@@ -30,23 +30,176 @@
 #define __SLEEKSURFACE_SURFACE_H__
 
 #include "curve.h"
+#include <functional>
 
 
 namespace SleekSurface
 {
     using namespace std;
 
+    /**
+     * The SurfaceModel class stores the input grid together with the row and column curves built according to it.
+     * Besides heights of the grid, the model can interpolate any number of additional value channels defined in the
+     * same grid points. Each channel has its own curves built over x and z coordinates of the input grid. Their
+     * handles are moved along the channel tangents to the x-coordinates of the height curve ones wherever they stay
+     * in the range of the segment and are not shortened more than twice, so the curves mostly share the
+     * parameterization of the height curves.
+     * It is created by <code>SurfaceBuilder::prepare</code> once and then can be evaluated at any resolution and
+     * in any part of the output grid by <code>SurfaceBuilder::evaluate</code>, possibly from many threads at once.
+     * The input grid is not copied and has to stay alive and unchanged while the model is used.
+     * The same holds for the optional validity mask of the input grid points. Curves of the masked model break at
+     * the missing points, and only the cells with all the four corners valid are evaluated as Coons patches.
+     */
+    class SurfaceModel
+    {
+        friend class SurfaceBuilder;
+
+        HeightField field;
+        vector<HeightField> values;
+        const unsigned char *mask;
+        double c;
+        vector<vector<Segment> > rowSegments;
+        vector<vector<Segment> > colSegments;
+
+    public:
+        /**
+         * SurfaceModel constructor.
+         */
+        SurfaceModel() : mask(0), c(2.0) {};
+
+        /**
+         * Get input grid of the model.
+         *
+         * @return input grid.
+         */
+        const HeightField &grid() const { return field; };
+        /**
+         * Get curvature parameter the model was built with.
+         *
+         * @return curvature parameter.
+         */
+        double curvature() const { return c; };
+        /**
+         * Get number of additional value channels.
+         *
+         * @return number of channels.
+         */
+        int channelCount() const { return values.size() - 1; };
+    };
+
+    /**
+     * The SurfaceDerivatives class stores analytic derivatives of the surface height in the output grid points.
+     * Each component is a separate array of the same resolution as the output grid.
+     */
+    class SurfaceDerivatives
+    {
+    public:
+        /**
+         * First derivatives of height by x and z.
+         */
+        vector<double> dx, dz;
+        /**
+         * Second derivatives of height by x twice, by x and z, and by z twice.
+         */
+        vector<double> dxx, dxz, dzz;
+
+        /**
+         * Get slope angle.
+         *
+         * @param i - index of the grid point.
+         * @return angle between the tangent plane and horizontal plane in radians.
+         */
+        double slope(int i) const { return atan(sqrt(dx[i] * dx[i] + dz[i] * dz[i])); };
+        /**
+         * Get aspect angle.
+         *
+         * @param i - index of the grid point.
+         * @return angle in radians from x axis towards z axis of the steepest descent direction.
+         */
+        double aspect(int i) const { return atan2(-dz[i], -dx[i]); };
+        /**
+         * Get mean curvature of the surface.
+         *
+         * @param i - index of the grid point.
+         * @return mean curvature, positive for concave surface.
+         */
+        double meanCurvature(int i) const
+        {
+            double g = 1.0 + dx[i] * dx[i] + dz[i] * dz[i];
+            return ((1.0 + dz[i] * dz[i]) * dxx[i] - 2.0 * dx[i] * dz[i] * dxz[i] + (1.0 + dx[i] * dx[i]) * dzz[i]) /
+                   (2.0 * g * sqrt(g));
+        };
+        /**
+         * Get Gaussian curvature of the surface.
+         *
+         * @param i - index of the grid point.
+         * @return Gaussian curvature.
+         */
+        double gaussianCurvature(int i) const
+        {
+            double g = 1.0 + dx[i] * dx[i] + dz[i] * dz[i];
+            return (dxx[i] * dzz[i] - dxz[i] * dxz[i]) / (g * g);
+        };
+    };
+
     /**
      * The SurfaceBuilder class provides methods to create sleek surfaces.
      */
     class SurfaceBuilder
     {
-        static bool getRowSegments(vector<Vec3> &inPoints, int inWidth, int inHeight, double c, vector<Segment> &segments);
-        static bool getColSegments(vector<Vec3> &inPoints, int inWidth, int inHeight, double c, vector<Segment> &segments);
+    public:
+        /**
+         * Band handler of <code>buildBanded</code>, called with the first output row of the band, the number of
+         * its rows and their vertices, in the order of bands. Vertices are valid only during the call.
+         * Returning false stops the build.
+         */
+        typedef function<bool(int z, int rows, const Vertex *points)> BandHandler;
+        /**
+         * Input handler of <code>buildBanded</code>, called with the range [z0; z1) of the input rows the next band
+         * reads. The rows before z0 are not read anymore.
+         */
+        typedef function<void(int z0, int z1)> InputHandler;
+
+    private:
+        static const int DERIVATIVES = 5;
+        static const int FUSED_TILE_BYTES = 512 * 1024;
+        constexpr static const double MIN_HANDLE_RATIO = 0.5;
+
+        static void getRowSegments(const HeightField &inField, const HeightField &inValues, const unsigned char *mask, double c,
+                                   vector<Segment> &segments);
+        static void getColSegments(const HeightField &inField, const HeightField &inValues, const unsigned char *mask, double c,
+                                   vector<Segment> &segments);
         inline static int index(int w, int x, int z);
         inline static int gridIndex(int w, int h, int x, int z);
         inline static int gridIndexClamped(int w, int h, int x, int z);
+        inline static int validIndex(const SurfaceModel &model, int x, int z);
+        inline static bool isQuadValid(const unsigned char *cells, int width, int step, int qx, int qz);
+        inline static void addNormal(double ax, double ay, double az, double bx, double by, double bz,
+                                     double cx, double cy, double cz, double &nx, double &ny, double &nz);
         inline static int outIndex(int w, int r, int x, int z, int dx, int dz);
+        static void getPatch(const SurfaceModel &model, int x, int z, int channels, int *rowIndices, int *colIndices, double *aValues);
+        static void evaluateCurves(const vector<vector<Segment> > &segments, const int *segIndices, int d0, int d1, int step,
+                                   int resolution, double *params, double *values, double *derivatives);
+        static void evaluateCell(const SurfaceModel &model, int resolution, int x, int z, int dx0, int dx1, int dz0, int dz1,
+                                 int step, bool refine, Vertex *cellPoints, double *const *cellChannels, double *const *cellDerivatives, int outStride,
+                                 double *scratch);
+        static void computeGridNormalRows(Vertex *vertices, int width, int height, const unsigned char *cells, int step,
+                                          int z0, int z1);
+        static void smoothNormalRows(const Vertex *inVertices, int width, int height, const unsigned char *cells, int step,
+                                     const vector<float> &kernel, int radius, Vertex *outVertices, int outStride,
+                                     int x0, int x1, int z0, int z1);
+        static void updateRowSegments(const HeightField &inField, const HeightField &inValues, const unsigned char *mask, double c,
+                                      int s0, int s1, int z0, int z1, vector<Segment> &segments);
+        static void updateColSegments(const HeightField &inField, const HeightField &inValues, const unsigned char *mask, double c,
+                                      int x0, int x1, int s0, int s1, vector<Segment> &segments);
+        static void shareParameterization(const vector<Segment> &base, vector<Segment> &segments, int begin, int end);
+        static void getValidCells(int inWidth, int inHeight, const unsigned char *mask, vector<unsigned char> &cells);
+        static bool buildGrid(const SurfaceModel &model, int resolution, int kernelRadius, const unsigned char *cells,
+                              GridBuffer &outPoints);
+        static bool buildTiled(const HeightField &inField, int resolution, double c, int kernelRadius, int tileSize,
+                               GridBuffer *outPoints, double *outPositions, double *outNormals);
+        static void evaluateEdgeDerivatives(const SurfaceModel &model, int resolution, int x, int z, int dx0, int dx1, int dz0, int dz1,
+                                            double *const *cellDerivatives, int outStride, double *scratch);
 
     public:
         /**
@@ -63,6 +216,258 @@ namespace SleekSurface
          */
         static bool build(vector<Vec3> &inPoints, int inWidth, int inHeight, int resolution, double c,
                           vector<Vertex> &outPoints, int &outWidth, int &outHeight);
+        /**
+         * Build a surface directly from the grid view without copying it.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param resolution - resolution of each coons patch.
+         * For each 4 points of input grid, r^2 - 4 new points are emitted.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param outPoints - regular grid of 3D points representing the sleek surface.
+         * @param outWidth, outHeight - resolution of output grid.
+         * @return true if surface building successful, false if not.
+         */
+        static bool build(const HeightField &inField, int resolution, double c,
+                          vector<Vertex> &outPoints, int &outWidth, int &outHeight);
+        /**
+         * Build a surface together with additional value channels defined in the input grid points.
+         * Channels are interpolated in the same pass. Their curves have the same values and tangents in the grid
+         * points as if the channel was built alone as heights, and no extremes between them, but the handles are
+         * moved along the tangents to the x-coordinates of the height curve ones wherever they stay in the range of
+         * the segment and are not shortened more than twice. There the curve parameters giving regular grid are found once for all the channels,
+         * and only the remaining segments find them separately.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param inChannels - value channels, their resolution has to be equal to the input grid one.
+         * Only y-coordinates (heights) of channel grids are used.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param outPoints - regular grid of 3D points representing the sleek surface.
+         * @param outChannels - output value channels, each one is regular grid of the same resolution as outPoints.
+         * @param outWidth, outHeight - resolution of output grid.
+         * @return true if surface building successful, false if not.
+         */
+        static bool buildChannels(const HeightField &inField, const vector<HeightField> &inChannels, int resolution, double c,
+                                  vector<Vertex> &outPoints, vector<vector<double> > &outChannels, int &outWidth, int &outHeight);
+        /**
+         * Build a surface with normals computed and smoothed into the memory allocated without initialization.
+         * Each thread builds a band of patch rows, computes and smooths normals of the same band, so on NUMA systems
+         * the band stays in the memory of the node running the thread. The result is the same as built by
+         * <code>build</code>, <code>computeGridNormals</code> and <code>smoothNormalsWithKernel</code>.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @param outPoints - output regular grid of 3D points with normals, allocated with its type of pages.
+         * @return true if surface building successful, false if not.
+         */
+        static bool build(const HeightField &inField, int resolution, double c, int kernelRadius, GridBuffer &outPoints);
+        /**
+         * Build a surface with normals computed by <code>computeGridNormals</code> and smoothed by
+         * <code>smoothNormalsWithKernel</code>, fusing all the three passes. The output grid is processed by square tiles
+         * small enough to stay in L2 cache together with the halo the normals and smoothing need around them.
+         * Each tile is evaluated, gets its normals computed and smoothed in a scratch buffer of its thread, and only
+         * the final vertices are written to the output, so no second full-size grid is allocated and each output
+         * page is written once. Halo vertices are evaluated by both neighbouring tiles. The result is exactly the same
+         * as of the separate passes.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @param tileSize - number of vertices along the tile side, 0 chooses it to fit the tile into L2 cache.
+         * @param outPoints - output regular grid of 3D points with normals, allocated with its type of pages.
+         * @return true if surface building successful, false if not.
+         */
+        static bool buildFused(const HeightField &inField, int resolution, double c, int kernelRadius, int tileSize,
+                               GridBuffer &outPoints);
+        /**
+         * Build a surface the same way as <code>buildFused</code>, writing each finished tile directly to the caller's
+         * arrays of positions and normals instead of the grid of vertices.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @param tileSize - number of vertices along the tile side, 0 chooses it to fit the tile into L2 cache.
+         * @param outPositions, outNormals - output arrays of 3 values per vertex of the output grid, row by row,
+         * their size is given by <code>getOutputSize</code>.
+         * @return true if surface building successful, false if not.
+         */
+        static bool buildFused(const HeightField &inField, int resolution, double c, int kernelRadius, int tileSize,
+                               double *outPositions, double *outNormals);
+        /**
+         * Build a surface band by band, reading the input once from top to bottom and keeping only the curves
+         * of the current band in memory, so the input and the output grids can be larger than RAM.
+         * Row curves are built for the input rows of the band and its neighbours, column curves are built by streaming
+         * builders, one per column, which finalize each segment two rows after its end. The vertices are exactly
+         * the same as built by <code>build</code>, but have no normals.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param bandRows - number of patch rows in each band.
+         * @param onBand - handler of the built bands.
+         * @param onInput - optional handler of the input rows read by each band, called before the band is built.
+         * @return true if surface building successful, false if not or if the band handler stopped it.
+         */
+        static bool buildBanded(const HeightField &inField, int resolution, double c, int bandRows,
+                                const BandHandler &onBand, const InputHandler &onInput = InputHandler());
+        /**
+         * Build a surface of the grid with missing points, e.g. NoData areas of a survey. Curves break at the missing
+         * points, and only the cells with all the four corners valid are evaluated, triangulated, and get normals
+         * computed and smoothed. The output grid has the full resolution, but its samples outside the valid cells
+         * are not touched and stay zero, so the pages of large invalid areas are never allocated, and the work and the number
+         * of triangles are proportional to the valid area.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param mask - validity mask of the input grid points, densely packed row by row, non-zero for the valid points.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * Normals are smoothed over the valid cells only.
+         * @param outPoints - output regular grid of 3D points with normals, allocated with its type of pages.
+         * @param outIndices - output triangles of the valid cells, indices of the output grid.
+         * @return true if surface building successful, false if not.
+         */
+        static bool build(const HeightField &inField, const unsigned char *mask, int resolution, double c, int kernelRadius,
+                          GridBuffer &outPoints, vector<int> &outIndices);
+        /**
+         * Build a surface together with analytic derivatives of its height computed in the same pass.
+         * Derivatives are analytic derivatives of the Coons patch containing the point. Points on the edges between
+         * patches belong to the patch to the right and below, except the last row and column of the grid.
+         * In the end points of curves with zero-length handles the height grows as a power 3/2 of the distance,
+         * so the second derivatives are unbounded there, and only their finite part is returned.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param resolution - resolution of each coons patch.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param outPoints - regular grid of 3D points representing the sleek surface.
+         * @param outDerivatives - output derivatives of the height in the points of the output grid.
+         * @param outWidth, outHeight - resolution of output grid.
+         * @return true if surface building successful, false if not.
+         */
+        static bool buildWithDerivatives(const HeightField &inField, int resolution, double c, vector<Vertex> &outPoints,
+                                         SurfaceDerivatives &outDerivatives, int &outWidth, int &outHeight);
+        /**
+         * Prepare surface model: build row and column curves of the input grid.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param model - output surface model.
+         * @return true if model is successfully prepared, false if not.
+         */
+        static bool prepare(const HeightField &inField, double c, SurfaceModel &model);
+        /**
+         * Prepare surface model with additional value channels.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param inChannels - value channels, their resolution has to be equal to the input grid one.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param model - output surface model.
+         * @return true if model is successfully prepared, false if not.
+         */
+        static bool prepare(const HeightField &inField, const vector<HeightField> &inChannels, double c, SurfaceModel &model);
+        /**
+         * Prepare surface model of the grid with missing points.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * @param inChannels - value channels, their resolution has to be equal to the input grid one.
+         * @param mask - validity mask of the input grid points, densely packed row by row, non-zero for the valid points.
+         * Null mask means all the points are valid. It is not copied and has to stay alive while the model is used.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param model - output surface model.
+         * @return true if model is successfully prepared, false if not.
+         */
+        static bool prepare(const HeightField &inField, const vector<HeightField> &inChannels, const unsigned char *mask,
+                            double c, SurfaceModel &model);
+        /**
+         * Update surface model after the heights of rectangular region of its input grid have been changed in place.
+         * A grid point affects the curve segments from 2 points before it to 1 point after it, so only these
+         * segments are rebuilt, and the model is exactly the same as the one prepared anew.
+         *
+         * @param model - surface model created by <code>prepare</code>.
+         * @param x0, z0 - position of the region in the input grid.
+         * @param w, h - resolution of the region, it has to lie within the input grid.
+         * @return true if model is successfully updated, false if the region is invalid.
+         */
+        static bool refresh(SurfaceModel &model, int x0, int z0, int w, int h);
+        /**
+         * Compute resolution of the output grid.
+         *
+         * @param inWidth, inHeight - resolution of input grid.
+         * @param resolution - resolution of each coons patch.
+         * @param outWidth, outHeight - resolution of output grid.
+         */
+        static void getOutputSize(int inWidth, int inHeight, int resolution, int &outWidth, int &outHeight);
+        /**
+         * Evaluate rectangular region of the output grid. Each sample is exactly the same as the one produced
+         * by <code>build</code> with the same resolution, so regions evaluated separately join seamlessly.
+         *
+         * @param model - surface model created by <code>prepare</code>.
+         * @param resolution - resolution of each coons patch.
+         * @param x0, z0 - position of the region in the output grid.
+         * @param w, h - resolution of the region, it has to lie within the output grid.
+         * @param outPoints - pointer to the output sample (x0, z0).
+         * @param outStride - distance between rows of the output in vertices.
+         * @param outChannels - pointers to the output sample (x0, z0) of each model channel, with the same stride
+         * as outPoints. Either the array or its items can be null to skip the channels.
+         * @param outDerivatives - null or pointers to the output sample (x0, z0) of height derivatives by x, z, xx, xz
+         * and zz, with the same stride as outPoints.
+         */
+        static void evaluate(const SurfaceModel &model, int resolution, int x0, int z0, int w, int h,
+                             Vertex *outPoints, int outStride, double *const *outChannels = 0,
+                             double *const *outDerivatives = 0);
+        /**
+         * Evaluate height of the surface in the arbitrary point of the cell. The cell is evaluated the same way as by
+         * <code>evaluate</code>: complete cells as Coons patches, incomplete ones along their top and left edges.
+         *
+         * @param model - surface model created by <code>prepare</code>.
+         * @param x, z - cell position in the input grid.
+         * @param t, q - position within the cell along x and z in [0; 1].
+         * @param y - output height.
+         * @return true if the point belongs to the surface, false if not.
+         */
+        static bool evaluateHeight(const SurfaceModel &model, int x, int z, double t, double q, double &y);
+        /**
+         * Evaluate height of the Coons patch of the cell in the points of the tensor grid of parameters, evaluating
+         * each row and column curve once per parameter.
+         *
+         * @param model - surface model created by <code>prepare</code>.
+         * @param x, z - cell position in the input grid.
+         * @param t, nt - positions within the cell along x in [0; 1] and their number.
+         * @param q, nq - positions within the cell along z in [0; 1] and their number.
+         * @param y - output heights, nq rows of nt values.
+         * @return true if the cell is complete and evaluated as Coons patch, false if not.
+         */
+        static bool evaluateHeights(const SurfaceModel &model, int x, int z, const double *t, int nt, const double *q, int nq,
+                                    double *y);
+        /**
+         * Get bounds of the surface height within the cell, found from the control polygons of the cell curves and
+         * the bicubic coefficients without evaluating the patch.
+         *
+         * @param model - surface model created by <code>prepare</code>.
+         * @param x, z - cell position in the input grid.
+         * @param minY, maxY - output bounds.
+         * @return true if the cell is complete and evaluated as Coons patch, false if not.
+         */
+        static bool getPatchBounds(const SurfaceModel &model, int x, int z, double &minY, double &maxY);
+        /**
+         * Evaluate the samples of the output grid lying on a coarser nested grid. The samples are exactly the same
+         * as the ones produced by <code>build</code> with the same resolution. A patch of resolution r contains
+         * the patches of resolution (r - 1) / 2 + 1 at even samples, so the coarser grid can be refined in place
+         * by evaluating only the samples missing in it.
+         *
+         * @param model - surface model created by <code>prepare</code>.
+         * @param resolution - resolution of each coons patch of the output grid.
+         * @param step - distance between the samples of the coarser grid, resolution - 1 has to be divisible by it.
+         * @param refine - false to evaluate all the samples of the coarser grid, true to skip the ones lying on
+         * the grid with the double step, which are supposed to be evaluated already.
+         * @param outPoints - output grid of the full resolution.
+         * @param outStride - distance between rows of the output in vertices.
+         */
+        static void evaluateLevel(const SurfaceModel &model, int resolution, int step, bool refine, Vertex *outPoints, int outStride);
         /**
          * Build a triangle mesh from regular grid.
          * 
@@ -70,6 +475,23 @@ namespace SleekSurface
          * @param indices - result vector of indices.
          */
         static void triangulateGrid(int w, int h, vector<int> &indices);
+        /**
+         * Build a triangle mesh from regular grid into the preallocated array.
+         *
+         * @param w, h - resolution of input grid.
+         * @param indices - output array of (w - 1) * (h - 1) * 6 indices.
+         */
+        static void triangulateGrid(int w, int h, int *indices);
+        /**
+         * Build a triangle mesh from the output grid of the input grid with missing points.
+         * Only the cells with all the four corners valid are triangulated.
+         *
+         * @param inWidth, inHeight - resolution of input grid.
+         * @param mask - validity mask of the input grid points, non-zero for the valid points, null if all are valid.
+         * @param resolution - resolution of each coons patch.
+         * @param indices - result vector of indices of the output grid.
+         */
+        static void triangulateGrid(int inWidth, int inHeight, const unsigned char *mask, int resolution, vector<int> &indices);
         /**
          * Compute vertex normals using algorithm of smoothing groups.
          * 
@@ -78,7 +500,17 @@ namespace SleekSurface
          */
         static void computeNormals(vector<Vertex> &vertices, const vector<int> &indices);
         /**
-         * Smooth vertex normals using gaussian kernel.
+         * Compute vertex normals of the regular grid triangulated by <code>triangulateGrid</code>.
+         * Normals of the triangles incident to each vertex are gathered directly from the grid neighbours
+         * and summed, and the sum is normalized once, so the result does not depend on the processing order.
+         * Rows are processed in parallel.
+         * 
+         * @param vertices - regular grid of 3D points.
+         * @param width, height - resolution of input grid.
+         */
+        static void computeGridNormals(vector<Vertex> &vertices, int width, int height);
+        /**
+         * Smooth vertex normals using gaussian kernel. Rows are processed in parallel.
          * 
          * @param inVertices - regular grid of 3D points.
          * @param width, height - resolution of input grid.
@@ -86,7 +518,7 @@ namespace SleekSurface
          * @param radius - radius of applying kernel.
          * @param outVertices - updated vertices with smoothed normals.
          */
-        static void smoothNormalsWithKernel(const vector<Vertex> &inVertices, int width, int height, vector<float> kernel, int radius, vector<Vertex> &outVertices);
+        static void smoothNormalsWithKernel(const vector<Vertex> &inVertices, int width, int height, const vector<float> &kernel, int radius, vector<Vertex> &outVertices);
     };
 
     int SurfaceBuilder::index(int w, int x, int z)
@@ -96,7 +528,7 @@ namespace SleekSurface
 
     int SurfaceBuilder::gridIndex(int w, int h, int x, int z)
     {
-        return x < w && z < h ? index(w, x, z) : -1;
+        return x >= 0 && z >= 0 && x < w && z < h ? index(w, x, z) : -1;
     }
 
     int SurfaceBuilder::gridIndexClamped(int w, int h, int x, int z)
@@ -112,6 +544,29 @@ namespace SleekSurface
         return index(w, x, z);
     }
 
+    int SurfaceBuilder::validIndex(const SurfaceModel &model, int x, int z)
+    {
+        int i = gridIndex(model.field.width(), model.field.height(), x, z);
+        return i >= 0 && model.mask && !model.mask[i] ? -1 : i;
+    }
+
+    bool SurfaceBuilder::isQuadValid(const unsigned char *cells, int width, int step, int qx, int qz)
+    {
+        // Quads of the output grid are mapped to the input cells, the cells are (width - 1) / step wide.
+        return !cells || cells[qz / step * ((width - 1) / step) + qx / step];
+    }
+
+    void SurfaceBuilder::addNormal(double ax, double ay, double az, double bx, double by, double bz,
+                                   double cx, double cy, double cz, double &nx, double &ny, double &nz)
+    {
+        // The same operations as adding Math::normal(a, b, c) to the normal.
+        double ux = bx - ax, uy = by - ay, uz = bz - az;
+        double vx = cx - ax, vy = cy - ay, vz = cz - az;
+        nx = nx + (uy * vz - uz * vy);
+        ny = ny + (uz * vx - ux * vz);
+        nz = nz + (ux * vy - uy * vx);
+    }
+
     int SurfaceBuilder::outIndex(int w, int r, int x, int z, int dx, int dz)
     {
         return (z * r + dz) * w + (x * r + dx);
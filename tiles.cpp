@@ -0,0 +1,169 @@
+/**
+ * tiles.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides data structures and functions to serve sleek surfaces as multi-resolution tiles.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tiles.h"
+#include <limits>
+
+
+using namespace SleekSurface;
+
+const int TileProvider::MAX_ZOOM;
+
+bool TileProvider::init(const HeightField &inField, double c, int _tileSize, int _kernelRadius, size_t _cacheLimit)
+{
+    if (_tileSize < 1 || _kernelRadius < 0 || !SurfaceBuilder::prepare(inField, c, model))
+        return false;
+
+    tileSize = _tileSize;
+    kernelRadius = _kernelRadius;
+    if (kernelRadius > 0)
+        Math::calcGaussianKernel(kernelRadius, false, kernel);
+    cacheLimit = _cacheLimit;
+    clearCache();
+    return true;
+}
+
+bool TileProvider::getOutputSize(int inWidth, int inHeight, int zoom, int &w, int &h)
+{
+    if (zoom < 0 || zoom > MAX_ZOOM || inWidth < 2 || inHeight < 2 ||
+        (((long long)max(inWidth, inHeight) - 1) << zoom) >= numeric_limits<int>::max())
+        return false;
+
+    SurfaceBuilder::getOutputSize(inWidth, inHeight, (1 << zoom) + 1, w, h);
+    return true;
+}
+
+bool TileProvider::getTileCount(int zoom, int &nx, int &nz) const
+{
+    int w, h;
+    if (tileSize < 1 || !getOutputSize(model.grid().width(), model.grid().height(), zoom, w, h))
+        return false;
+
+    nx = (w - 1 + tileSize - 1) / tileSize;
+    nz = (h - 1 + tileSize - 1) / tileSize;
+    return true;
+}
+
+shared_ptr<const SurfaceTile> TileProvider::getTile(int zoom, int tx, int tz)
+{
+    int nx, nz;
+    if (!getTileCount(zoom, nx, nz) || tx < 0 || tz < 0 || tx >= nx || tz >= nz)
+        return shared_ptr<const SurfaceTile>();
+
+    TileKey key(zoom, make_pair(tx, tz));
+    {
+        lock_guard<mutex> lock(cacheMutex);
+        map<TileKey, TileList::iterator>::iterator it = tileMap.find(key);
+        if (it != tileMap.end())
+        {
+            tiles.splice(tiles.begin(), tiles, it->second);
+            return it->second->second;
+        }
+    }
+
+    // Tile is evaluated without the lock, so other tiles can be served meanwhile.
+    shared_ptr<const SurfaceTile> tile = createTile(zoom, tx, tz);
+
+    lock_guard<mutex> lock(cacheMutex);
+    map<TileKey, TileList::iterator>::iterator it = tileMap.find(key);
+    if (it != tileMap.end())
+    {
+        // Another thread has created the same tile.
+        tiles.splice(tiles.begin(), tiles, it->second);
+        return it->second->second;
+    }
+    tiles.push_front(make_pair(key, tile));
+    tileMap[key] = tiles.begin();
+    cacheSize += tileBytes(*tile);
+    while (cacheSize > cacheLimit && !tiles.empty())
+    {
+        cacheSize -= tileBytes(*tiles.back().second);
+        tileMap.erase(tiles.back().first);
+        tiles.pop_back();
+    }
+    return tile;
+}
+
+shared_ptr<const SurfaceTile> TileProvider::createTile(int zoom, int tx, int tz) const
+{
+    shared_ptr<SurfaceTile> tile = make_shared<SurfaceTile>();
+    buildTile(model, zoom, tx, tz, tileSize, kernelRadius, kernel, *tile);
+    return tile;
+}
+
+void TileProvider::buildTile(const SurfaceModel &model, int zoom, int tx, int tz, int tileSize, int kernelRadius,
+                             const vector<float> &kernel, SurfaceTile &tile)
+{
+    int resolution = (1 << zoom) + 1;
+    int w, h;
+    SurfaceBuilder::getOutputSize(model.grid().width(), model.grid().height(), resolution, w, h);
+
+    tile.zoom = zoom;
+    tile.tx = tx;
+    tile.tz = tz;
+    tile.x0 = tx * tileSize;
+    tile.z0 = tz * tileSize;
+    tile.width = min(tileSize, w - 1 - tile.x0) + 1;
+    tile.height = min(tileSize, h - 1 - tile.z0) + 1;
+
+    // Normals need one more vertex around, smoothing needs kernel radius more normals around.
+    int halo = kernelRadius + 1;
+    int rx0 = max(tile.x0 - halo, 0);
+    int rz0 = max(tile.z0 - halo, 0);
+    int rw = min(tile.x0 + tile.width + halo, w) - rx0;
+    int rh = min(tile.z0 + tile.height + halo, h) - rz0;
+
+    vector<Vertex> region(rw * rh);
+    SurfaceBuilder::evaluate(model, resolution, rx0, rz0, rw, rh, region.data(), rw);
+    SurfaceBuilder::computeGridNormals(region, rw, rh);
+    vector<Vertex> smoothed;
+    if (kernelRadius > 0)
+        SurfaceBuilder::smoothNormalsWithKernel(region, rw, rh, kernel, kernelRadius, smoothed);
+    else
+        smoothed.swap(region);
+
+    tile.vertices.resize(tile.width * tile.height);
+    for (int z = 0; z < tile.height; ++z)
+    {
+        const Vertex *src = &smoothed[(tile.z0 - rz0 + z) * rw + (tile.x0 - rx0)];
+        copy(src, src + tile.width, tile.vertices.begin() + z * tile.width);
+    }
+}
+
+size_t TileProvider::getCacheSize() const
+{
+    lock_guard<mutex> lock(cacheMutex);
+    return cacheSize;
+}
+
+void TileProvider::clearCache()
+{
+    lock_guard<mutex> lock(cacheMutex);
+    tiles.clear();
+    tileMap.clear();
+    cacheSize = 0;
+}
@@ -0,0 +1,172 @@
+/**
+ * tiles.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides data structures and functions to serve sleek surfaces as multi-resolution tiles.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_TILES_H__
+#define __SLEEKSURFACE_TILES_H__
+
+#include "surface.h"
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The SurfaceTile class stores square part of the sleek surface built at some zoom level.
+     */
+    class SurfaceTile
+    {
+    public:
+        /**
+         * Tile address.
+         */
+        int zoom, tx, tz;
+        /**
+         * Position of the first tile vertex in the output grid of the zoom level.
+         */
+        int x0, z0;
+        /**
+         * Resolution of the tile in vertices.
+         */
+        int width, height;
+        /**
+         * Regular grid of tile vertices with smoothed normals.
+         */
+        vector<Vertex> vertices;
+    };
+
+    /**
+     * The TileProvider class provides methods to get the sleek surface as tiles at several zoom levels.
+     * At zoom level L each input grid cell is subdivided into 2^L steps, and the output grid of the level is cut
+     * into tiles of <code>tileSize</code> cells. Neighbouring tiles share their border vertices.
+     * Tiles are evaluated lazily from the single surface model, so the row and column curves are built once,
+     * and are kept in the cache limited by memory size, where the least recently used tiles are dropped first.
+     * Vertices and normals of each tile are exactly the same as of the full output grid of its zoom level,
+     * built by <code>SurfaceBuilder::build</code> with normals computed by
+     * <code>SurfaceBuilder::computeGridNormals</code> and smoothed by <code>SurfaceBuilder::smoothNormalsWithKernel</code>,
+     * so tile edges always match.
+     * All the methods are thread-safe.
+     */
+    class TileProvider
+    {
+        typedef pair<int, pair<int, int> > TileKey;
+        typedef list<pair<TileKey, shared_ptr<const SurfaceTile> > > TileList;
+
+        SurfaceModel model;
+        int tileSize;
+        int kernelRadius;
+        vector<float> kernel;
+
+        mutable mutex cacheMutex;
+        TileList tiles;
+        map<TileKey, TileList::iterator> tileMap;
+        size_t cacheLimit, cacheSize;
+
+        static size_t tileBytes(const SurfaceTile &tile) { return sizeof(SurfaceTile) + tile.vertices.size() * sizeof(Vertex); };
+        shared_ptr<const SurfaceTile> createTile(int zoom, int tx, int tz) const;
+
+    public:
+        /**
+         * Maximum zoom level.
+         */
+        static const int MAX_ZOOM = 16;
+
+        /**
+         * TileProvider constructor.
+         */
+        TileProvider() : tileSize(0), kernelRadius(0), cacheLimit(0), cacheSize(0) {};
+
+        /**
+         * Get resolution of the output grid of zoom level.
+         *
+         * @param inWidth, inHeight - resolution of input grid.
+         * @param zoom - zoom level in [0; MAX_ZOOM].
+         * @param w, h - output resolution of the output grid.
+         * @return true if zoom level is valid and the output grid can be addressed by int, false if not.
+         */
+        static bool getOutputSize(int inWidth, int inHeight, int zoom, int &w, int &h);
+
+        /**
+         * Evaluate the tile of the surface model the same way as the provider does.
+         *
+         * @param model - surface model created by <code>SurfaceBuilder::prepare</code>.
+         * @param zoom - zoom level in [0; MAX_ZOOM].
+         * @param tx, tz - tile position.
+         * @param tileSize - number of cells along the tile side.
+         * @param kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @param kernel - Gaussian kernel created by <code>Math::calcGaussianKernel</code> for the radius.
+         * @param tile - output tile.
+         */
+        static void buildTile(const SurfaceModel &model, int zoom, int tx, int tz, int tileSize, int kernelRadius,
+                              const vector<float> &kernel, SurfaceTile &tile);
+        /**
+         * Prepare the provider.
+         *
+         * @param inField - regular grid of 3D points or heights to create surface according.
+         * It is not copied and has to stay alive and unchanged while the provider is used.
+         * @param c - paramenet affecting curvature, should be in [2; +inf).
+         * @param _tileSize - number of cells along the tile side.
+         * @param _kernelRadius - radius of Gaussian kernel to smooth normals with, 0 disables smoothing.
+         * @param _cacheLimit - maximum size of cached tiles in bytes.
+         * @return true if provider is successfully prepared, false if not.
+         */
+        bool init(const HeightField &inField, double c, int _tileSize, int _kernelRadius, size_t _cacheLimit);
+
+        /**
+         * Get number of tiles at zoom level.
+         *
+         * @param zoom - zoom level in [0; MAX_ZOOM].
+         * @param nx, nz - number of tiles along x and z axes.
+         * @return true if zoom level is valid and its output grid can be addressed by int, false if not.
+         */
+        bool getTileCount(int zoom, int &nx, int &nz) const;
+        /**
+         * Get the tile, evaluating it if it is not cached.
+         *
+         * @param zoom - zoom level in [0; MAX_ZOOM].
+         * @param tx, tz - tile position.
+         * @return tile or empty pointer if address is invalid.
+         */
+        shared_ptr<const SurfaceTile> getTile(int zoom, int tx, int tz);
+        /**
+         * Get size of cached tiles.
+         *
+         * @return size of cached tiles in bytes.
+         */
+        size_t getCacheSize() const;
+        /**
+         * Drop all cached tiles.
+         */
+        void clearCache();
+    };
+}
+
+#endif // __SLEEKSURFACE_TILES_H__
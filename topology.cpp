@@ -0,0 +1,195 @@
+/**
+ * topology.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides functions to build compact mesh topologies for regular grids.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "topology.h"
+
+
+using namespace SleekSurface;
+
+const int GridTopology::RESTART_INDEX;
+
+void GridTopology::triangulateTiles(int w, int h, vector<GridTile> &tiles, int maxVertices)
+{
+    tiles.clear();
+    if (w < 2 || h < 2)
+        return;
+
+    if (maxVertices > 65536)
+        maxVertices = 65536;
+    else if (maxVertices < 4)
+        maxVertices = 4;
+
+    // Whole rows are preferred, because they keep tile vertices contiguous in the grid.
+    int tw, th;
+    if (w * 2 <= maxVertices)
+        tw = w;
+    else
+        tw = (int)sqrt((double)maxVertices);
+    th = maxVertices / tw;
+
+    for (int z0 = 0; z0 < h - 1; z0 += th - 1)
+    {
+        for (int x0 = 0; x0 < w - 1; x0 += tw - 1)
+        {
+            tiles.push_back(GridTile());
+            GridTile &tile = tiles.back();
+            tile.x0 = x0;
+            tile.z0 = z0;
+            tile.width = min(tw, w - x0);
+            tile.height = min(th, h - z0);
+            tile.indices.resize((tile.width - 1) * (tile.height - 1) * 6);
+            int i = 0;
+            for (int z = 0; z < tile.height - 1; ++z)
+            {
+                for (int x = 0; x < tile.width - 1; ++x)
+                {
+                    unsigned short tl = z * tile.width + x;
+                    unsigned short tr = tl + 1;
+                    unsigned short bl = tl + tile.width;
+                    unsigned short br = bl + 1;
+                    tile.indices[i++] = tr;
+                    tile.indices[i++] = tl;
+                    tile.indices[i++] = bl;
+                    tile.indices[i++] = bl;
+                    tile.indices[i++] = br;
+                    tile.indices[i++] = tr;
+                }
+            }
+        }
+    }
+}
+
+void GridTopology::triangulateStrip(int w, int h, bool primitiveRestart, vector<int> &indices)
+{
+    indices.clear();
+    if (w < 2 || h < 2)
+        return;
+
+    // Each row is the strip TL, BL, TR, BR, ... giving the same diagonals and winding as triangulateGrid.
+    // Rows have even length, so the degenerate join of two indices keeps the winding parity.
+    indices.reserve((h - 1) * (w * 2 + 2));
+    for (int z = 0; z < h - 1; ++z)
+    {
+        if (z > 0)
+        {
+            if (primitiveRestart)
+                indices.push_back(RESTART_INDEX);
+            else
+            {
+                indices.push_back(indices.back());
+                indices.push_back(z * w);
+            }
+        }
+        for (int x = 0; x < w; ++x)
+        {
+            indices.push_back(z * w + x);
+            indices.push_back((z + 1) * w + x);
+        }
+    }
+}
+
+void GridTopology::buildMeshlets(const vector<Vertex> &vertices, int w, int h, int maxVertices, int maxTriangles,
+                                 vector<Meshlet> &meshlets, vector<int> &meshletVertices,
+                                 vector<unsigned char> &meshletTriangles)
+{
+    meshlets.clear();
+    meshletVertices.clear();
+    meshletTriangles.clear();
+    if (w < 2 || h < 2)
+        return;
+
+    if (maxVertices > 256)
+        maxVertices = 256;
+    else if (maxVertices < 4)
+        maxVertices = 4;
+    if (maxTriangles < 2)
+        maxTriangles = 2;
+
+    // Find the block of cells covering most area within limits, preferring square blocks.
+    int bw = 1, bh = 1;
+    for (int cw = 1; (cw + 1) * 2 <= maxVertices && cw * 2 <= maxTriangles; ++cw)
+    {
+        int ch = min(maxVertices / (cw + 1) - 1, maxTriangles / (cw * 2));
+        if (cw * ch > bw * bh || (cw * ch == bw * bh && abs(cw - ch) < abs(bw - bh)))
+        {
+            bw = cw;
+            bh = ch;
+        }
+    }
+
+    for (int z0 = 0; z0 < h - 1; z0 += bh)
+    {
+        for (int x0 = 0; x0 < w - 1; x0 += bw)
+        {
+            int cw = min(bw, w - 1 - x0);
+            int ch = min(bh, h - 1 - z0);
+
+            Meshlet meshlet;
+            meshlet.vertexOffset = meshletVertices.size();
+            meshlet.vertexCount = (cw + 1) * (ch + 1);
+            meshlet.triangleOffset = meshletTriangles.size() / 3;
+            meshlet.triangleCount = cw * ch * 2;
+            meshlet.boundsMin = meshlet.boundsMax = vertices[z0 * w + x0].position;
+            for (int z = 0; z <= ch; ++z)
+            {
+                for (int x = 0; x <= cw; ++x)
+                {
+                    int idx = (z0 + z) * w + x0 + x;
+                    const Vec3 &p = vertices[idx].position;
+                    meshletVertices.push_back(idx);
+                    meshlet.boundsMin = Vec3(min(meshlet.boundsMin.x, p.x), min(meshlet.boundsMin.y, p.y), min(meshlet.boundsMin.z, p.z));
+                    meshlet.boundsMax = Vec3(max(meshlet.boundsMax.x, p.x), max(meshlet.boundsMax.y, p.y), max(meshlet.boundsMax.z, p.z));
+                }
+            }
+            meshlet.center = (meshlet.boundsMin + meshlet.boundsMax) * 0.5;
+            meshlet.radius = 0.0;
+            for (int i = meshlet.vertexOffset; i < meshlet.vertexOffset + meshlet.vertexCount; ++i)
+            {
+                Vec3 d = vertices[meshletVertices[i]].position - meshlet.center;
+                meshlet.radius = max(meshlet.radius, sqrt(d.x * d.x + d.y * d.y + d.z * d.z));
+            }
+
+            for (int z = 0; z < ch; ++z)
+            {
+                for (int x = 0; x < cw; ++x)
+                {
+                    unsigned char tl = z * (cw + 1) + x;
+                    unsigned char tr = tl + 1;
+                    unsigned char bl = tl + cw + 1;
+                    unsigned char br = bl + 1;
+                    meshletTriangles.push_back(tr);
+                    meshletTriangles.push_back(tl);
+                    meshletTriangles.push_back(bl);
+                    meshletTriangles.push_back(bl);
+                    meshletTriangles.push_back(br);
+                    meshletTriangles.push_back(tr);
+                }
+            }
+            meshlets.push_back(meshlet);
+        }
+    }
+}
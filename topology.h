@@ -0,0 +1,135 @@
+/**
+ * topology.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides functions to build compact mesh topologies for regular grids.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_TOPOLOGY_H__
+#define __SLEEKSURFACE_TOPOLOGY_H__
+
+#include "common.h"
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The GridTile class stores triangles of the rectangular part of the regular grid with 16-bit indices.
+     * Indices are local to the tile: vertex (x, z) of the grid has index (z - z0) * width + (x - x0).
+     * If tile width equals to grid width, tile vertices are contiguous in the grid starting from z0 * width.
+     */
+    class GridTile
+    {
+    public:
+        /**
+         * Position of the first tile vertex in the grid.
+         */
+        int x0, z0;
+        /**
+         * Resolution of the tile in vertices.
+         */
+        int width, height;
+        /**
+         * Triangle indices.
+         */
+        vector<unsigned short> indices;
+    };
+
+    /**
+     * The Meshlet class describes the small part of the mesh to be processed by the GPU at once.
+     */
+    class Meshlet
+    {
+    public:
+        /**
+         * Range of meshlet vertices in the vertex index array.
+         */
+        int vertexOffset, vertexCount;
+        /**
+         * Range of meshlet triangles in the triangle array, each triangle has 3 local indices.
+         */
+        int triangleOffset, triangleCount;
+        /**
+         * Axis-aligned bounding box of the meshlet.
+         */
+        Vec3 boundsMin, boundsMax;
+        /**
+         * Bounding sphere of the meshlet.
+         */
+        Vec3 center;
+        double radius;
+    };
+
+    /**
+     * The GridTopology static class provides methods to triangulate regular grids into compact index buffers.
+     * All the methods produce triangles of the same winding as <code>SurfaceBuilder::triangulateGrid</code>
+     * and work directly with the grid structure.
+     */
+    class GridTopology
+    {
+    public:
+        /**
+         * Index marking the primitive restart in triangle strips.
+         */
+        static const int RESTART_INDEX = -1;
+
+        /**
+         * Split the grid into tiles addressable by 16-bit indices and triangulate them.
+         * Neighbouring tiles share their border vertices.
+         *
+         * @param w, h - resolution of input grid.
+         * @param tiles - result vector of tiles.
+         * @param maxVertices - maximum number of vertices in tile, should be in [4; 65536].
+         */
+        static void triangulateTiles(int w, int h, vector<GridTile> &tiles, int maxVertices = 65536);
+        /**
+         * Build single triangle strip from the grid. Rows are joined either by primitive restart
+         * or by degenerate triangles.
+         *
+         * @param w, h - resolution of input grid.
+         * @param primitiveRestart - flag determining if rows should be separated by <code>RESTART_INDEX</code> (true)
+         * or joined by degenerate triangles (false).
+         * @param indices - result vector of strip indices.
+         */
+        static void triangulateStrip(int w, int h, bool primitiveRestart, vector<int> &indices);
+        /**
+         * Split the grid into meshlets. Each meshlet covers rectangular block of grid cells and its triangles
+         * are emitted row by row, so they reuse the vertices recently transformed.
+         *
+         * @param vertices - regular grid of 3D points.
+         * @param w, h - resolution of input grid.
+         * @param maxVertices - maximum number of vertices in meshlet, should be in [4; 256].
+         * @param maxTriangles - maximum number of triangles in meshlet, should be at least 2.
+         * @param meshlets - result vector of meshlets.
+         * @param meshletVertices - result vector of grid vertex indices referenced by meshlets.
+         * @param meshletTriangles - result vector of triangle indices local to meshlets.
+         */
+        static void buildMeshlets(const vector<Vertex> &vertices, int w, int h, int maxVertices, int maxTriangles,
+                                  vector<Meshlet> &meshlets, vector<int> &meshletVertices,
+                                  vector<unsigned char> &meshletTriangles);
+    };
+}
+
+#endif // __SLEEKSURFACE_TOPOLOGY_H__
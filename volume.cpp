@@ -0,0 +1,324 @@
+/**
+ * volume.cpp
+ *
+ * This is a part of sleek-surface project.
+ * This file provides functions to compute volumes under sleek surfaces.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "volume.h"
+#include <algorithm>
+
+
+using namespace SleekSurface;
+
+bool VolumeCalculator::locate(const HeightField &field, double px, double pz, int &x, int &z, double &t, double &q)
+{
+    // The grid is rectilinear, so the column is found along the first row and the row along the first column.
+    int w = field.width();
+    int h = field.height();
+    double xFirst = field.x(0, 0), xLast = field.x(w - 1, 0);
+    double zFirst = field.z(0, 0), zLast = field.z(0, h - 1);
+    if (px < min(xFirst, xLast) || px > max(xFirst, xLast) || pz < min(zFirst, zLast) || pz > max(zFirst, zLast))
+        return false;
+
+    bool ascending = xLast >= xFirst;
+    int lo = 0, hi = w - 1;
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if ((field.x(mid, 0) <= px) == ascending)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    x = lo;
+    t = min(max((px - field.x(lo, 0)) / (field.x(lo + 1, 0) - field.x(lo, 0)), 0.0), 1.0);
+
+    ascending = zLast >= zFirst;
+    lo = 0, hi = h - 1;
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if ((field.z(0, mid) <= pz) == ascending)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    z = lo;
+    q = min(max((pz - field.z(0, lo)) / (field.z(0, lo + 1) - field.z(0, lo)), 0.0), 1.0);
+    return true;
+}
+
+bool VolumeCalculator::isInside(const vector<Vec3> &polygon, double px, double pz)
+{
+    bool inside = false;
+    for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++)
+    {
+        const Vec3 &a = polygon[i];
+        const Vec3 &b = polygon[j];
+        if ((a.z > pz) != (b.z > pz) && px < a.x + (pz - a.z) * (b.x - a.x) / (b.z - a.z))
+            inside = !inside;
+    }
+    return inside;
+}
+
+bool VolumeCalculator::crossesRect(const vector<Vec3> &polygon, double x0, double z0, double x1, double z1)
+{
+    // Liang-Barsky clipping of each polygon edge by the rectangle.
+    for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++)
+    {
+        const Vec3 &a = polygon[j];
+        double dx = polygon[i].x - a.x;
+        double dz = polygon[i].z - a.z;
+        double p[4] = {-dx, dx, -dz, dz};
+        double d[4] = {a.x - x0, x1 - a.x, a.z - z0, z1 - a.z};
+        double u0 = 0.0, u1 = 1.0;
+        bool crosses = true;
+        for (int k = 0; k < 4 && crosses; ++k)
+        {
+            if (p[k] == 0.0)
+                crosses = d[k] >= 0.0;
+            else if (p[k] < 0.0)
+                u0 = max(u0, d[k] / p[k]);
+            else
+                u1 = min(u1, d[k] / p[k]);
+            crosses = crosses && u0 <= u1;
+        }
+        if (crosses)
+            return true;
+    }
+    return false;
+}
+
+void VolumeCalculator::clipRect(const vector<Vec3> &polygon, double x0, double z0, double x1, double z1,
+                                vector<Vec3> &clipped)
+{
+    // Sutherland-Hodgman clipping by each side of the rectangle. A concave polygon may get degenerate edges along
+    // the sides, they enclose no area.
+    clipped = polygon;
+    vector<Vec3> input;
+    for (int side = 0; side < 4 && !clipped.empty(); ++side)
+    {
+        input.swap(clipped);
+        clipped.clear();
+        bool alongX = side < 2;
+        double bound = side == 0 ? x0 : (side == 1 ? x1 : (side == 2 ? z0 : z1));
+        double sign = side % 2 == 0 ? 1.0 : -1.0;
+        for (size_t i = 0, j = input.size() - 1; i < input.size(); j = i++)
+        {
+            const Vec3 &a = input[j];
+            const Vec3 &b = input[i];
+            double da = sign * ((alongX ? a.x : a.z) - bound);
+            double db = sign * ((alongX ? b.x : b.z) - bound);
+            if ((da >= 0.0) != (db >= 0.0))
+            {
+                double u = da / (da - db);
+                Vec3 p(a.x + u * (b.x - a.x), 0.0, a.z + u * (b.z - a.z));
+                if (alongX)
+                    p.x = bound;
+                else
+                    p.z = bound;
+                clipped.push_back(p);
+            }
+            if (db >= 0.0)
+                clipped.push_back(b);
+        }
+    }
+}
+
+void VolumeCalculator::integratePolygon(const SurfaceModel &model, const SurfaceModel *reference, double plane, int x, int z,
+                                        const vector<Vec3> &polygon, const vector<double> &nodes, const vector<double> &weights,
+                                        double &cut, double &fill, double &area)
+{
+    // The cell parameters are affine in x and z, so the polygon is split into a fan of triangles, and each triangle
+    // is integrated by Gauss-Legendre quadrature of the square collapsed into it. Triangles of a concave polygon
+    // overlap with opposite orientations, so their signed areas sum up to the polygon one.
+    const HeightField &field = model.grid();
+    double x11 = field.x(x, z), x12 = field.x(x + 1, z);
+    double z11 = field.z(x, z), z21 = field.z(x, z + 1);
+    double orientation = 0.0;
+    for (size_t i = 1; i + 1 < polygon.size(); ++i)
+    {
+        orientation += (polygon[i].x - polygon[0].x) * (polygon[i + 1].z - polygon[0].z) -
+                       (polygon[i + 1].x - polygon[0].x) * (polygon[i].z - polygon[0].z);
+    }
+    double sign = orientation < 0.0 ? -1.0 : 1.0;
+
+    int order = nodes.size();
+    const Vec3 &a = polygon[0];
+    for (size_t k = 1; k + 1 < polygon.size(); ++k)
+    {
+        const Vec3 &b = polygon[k];
+        const Vec3 &c = polygon[k + 1];
+        double doubleArea = sign * ((b.x - a.x) * (c.z - a.z) - (c.x - a.x) * (b.z - a.z));
+        if (doubleArea == 0.0)
+            continue;
+        for (int i = 0; i < order; ++i)
+        {
+            double u = nodes[i];
+            for (int j = 0; j < order; ++j)
+            {
+                // p = a + u (b - a) + u v (c - b), the Jacobian is u times the doubled area.
+                double v = nodes[j];
+                double px = a.x + u * (b.x - a.x) + u * v * (c.x - b.x);
+                double pz = a.z + u * (b.z - a.z) + u * v * (c.z - b.z);
+                double t = min(max((px - x11) / (x12 - x11), 0.0), 1.0);
+                double q = min(max((pz - z11) / (z21 - z11), 0.0), 1.0);
+                double y, level = plane;
+                int rx, rz;
+                double rt, rq;
+                if (!SurfaceBuilder::evaluateHeight(model, x, z, t, q, y) ||
+                    (reference && (!locate(reference->grid(), px, pz, rx, rz, rt, rq) ||
+                                   !SurfaceBuilder::evaluateHeight(*reference, rx, rz, rt, rq, level))))
+                    continue;
+                double weight = weights[i] * weights[j] * u * doubleArea;
+                double d = y - level;
+                if (d > 0.0)
+                    cut += d * weight;
+                else
+                    fill -= d * weight;
+                area += weight;
+            }
+        }
+    }
+}
+
+bool VolumeCalculator::integrate(const SurfaceModel &model, const SurfaceModel *reference, double plane,
+                                 const vector<Vec3> &polygon, int order, int subdivisions, CutFill &result)
+{
+    if (order < 1 || order > MAX_ORDER || subdivisions < 1 || (!polygon.empty() && polygon.size() < 3))
+        return false;
+
+    const HeightField &field = model.grid();
+    int cellsX = field.width() - 1;
+    int cellsZ = field.height() - 1;
+    vector<double> nodes, weights;
+    Math::calcGaussLegendre(order, nodes, weights);
+    double cut = 0.0, fill = 0.0, area = 0.0;
+    #pragma omp parallel
+    {
+        int maxNodes = subdivisions * order;
+        vector<double> t(maxNodes), q(maxNodes), w(maxNodes), y(maxNodes * maxNodes);
+        vector<Vec3> clipped;
+        #pragma omp for schedule(dynamic) reduction(+:cut, fill, area)
+        for (int z = 0; z < cellsZ; ++z)
+        {
+            for (int x = 0; x < cellsX; ++x)
+            {
+                double minY, maxY;
+                if (!SurfaceBuilder::getPatchBounds(model, x, z, minY, maxY))
+                    continue;
+
+                double x11 = field.x(x, z), x12 = field.x(x + 1, z);
+                double z11 = field.z(x, z), z21 = field.z(x, z + 1);
+                bool border = false;
+                if (!polygon.empty())
+                {
+                    double rx0 = min(x11, x12), rx1 = max(x11, x12);
+                    double rz0 = min(z11, z21), rz1 = max(z11, z21);
+                    border = crossesRect(polygon, rx0, rz0, rx1, rz1);
+                    if (!border && !isInside(polygon, 0.5 * (x11 + x12), 0.5 * (z11 + z21)))
+                        continue;
+                }
+                // The integrand is smooth within the cell unless the reference crosses it.
+                bool kink = reference || (plane > minY && plane < maxY);
+                int n = kink ? subdivisions : 1;
+                if (border)
+                {
+                    for (int sz = 0; sz < n; ++sz)
+                    {
+                        double za = z11 + (z21 - z11) * sz / n, zb = z11 + (z21 - z11) * (sz + 1) / n;
+                        for (int sx = 0; sx < n; ++sx)
+                        {
+                            double xa = x11 + (x12 - x11) * sx / n, xb = x11 + (x12 - x11) * (sx + 1) / n;
+                            clipRect(polygon, min(xa, xb), min(za, zb), max(xa, xb), max(za, zb), clipped);
+                            if (clipped.size() >= 3)
+                                integratePolygon(model, reference, plane, x, z, clipped, nodes, weights, cut, fill, area);
+                        }
+                    }
+                    continue;
+                }
+                int count = n * order;
+                for (int s = 0; s < n; ++s)
+                {
+                    for (int i = 0; i < order; ++i)
+                    {
+                        t[s * order + i] = (s + nodes[i]) / n;
+                        w[s * order + i] = weights[i] / n;
+                    }
+                }
+                copy(t.begin(), t.begin() + count, q.begin());
+                SurfaceBuilder::evaluateHeights(model, x, z, t.data(), count, q.data(), count, y.data());
+
+                double cellArea = abs((x12 - x11) * (z21 - z11));
+                for (int j = 0; j < count; ++j)
+                {
+                    double pz = z11 + q[j] * (z21 - z11);
+                    for (int i = 0; i < count; ++i)
+                    {
+                        double px = x11 + t[i] * (x12 - x11);
+                        double level = plane;
+                        int rx, rz;
+                        double rt, rq;
+                        if (reference && (!locate(reference->grid(), px, pz, rx, rz, rt, rq) ||
+                                          !SurfaceBuilder::evaluateHeight(*reference, rx, rz, rt, rq, level)))
+                            continue;
+                        double weight = w[i] * w[j] * cellArea;
+                        double d = y[j * count + i] - level;
+                        if (d > 0.0)
+                            cut += d * weight;
+                        else
+                            fill -= d * weight;
+                        area += weight;
+                    }
+                }
+            }
+        }
+    }
+    result.cut = cut;
+    result.fill = fill;
+    result.area = area;
+    return true;
+}
+
+bool VolumeCalculator::computeVolume(const SurfaceModel &model, double base, int order, double &volume)
+{
+    // The net volume does not depend on where cut turns to fill, so the cells are not split.
+    CutFill result;
+    if (!integrate(model, 0, base, vector<Vec3>(), order, 1, result))
+        return false;
+    volume = result.cut - result.fill;
+    return true;
+}
+
+bool VolumeCalculator::computeCutFill(const SurfaceModel &model, double plane, const vector<Vec3> &polygon, int order,
+                                      int subdivisions, CutFill &result)
+{
+    return integrate(model, 0, plane, polygon, order, subdivisions, result);
+}
+
+bool VolumeCalculator::computeCutFill(const SurfaceModel &model, const SurfaceModel &reference, const vector<Vec3> &polygon,
+                                      int order, int subdivisions, CutFill &result)
+{
+    return integrate(model, &reference, 0.0, polygon, order, subdivisions, result);
+}
@@ -0,0 +1,134 @@
+/**
+ * volume.h
+ *
+ * This is a part of sleek-surface project.
+ * This file provides functions to compute volumes under sleek surfaces.
+ *
+ * Written by Konstantin Ryabinin under terms of MIT license.
+ *
+ * The MIT License (MIT)
+ * Copyright (c) 2018 Konstantin Ryabinin
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software 
+ * and associated documentation files (the "Software"), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial 
+ * portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT 
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. 
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __SLEEKSURFACE_VOLUME_H__
+#define __SLEEKSURFACE_VOLUME_H__
+
+#include "surface.h"
+
+
+namespace SleekSurface
+{
+    using namespace std;
+
+    /**
+     * The CutFill class stores volumes between the surface and the reference: a plane or another surface.
+     */
+    class CutFill
+    {
+    public:
+        /**
+         * Volume where the surface is above the reference, i.e. the material to remove to reach the reference.
+         */
+        double cut;
+        /**
+         * Volume where the surface is below the reference, i.e. the material to add to reach the reference.
+         */
+        double fill;
+        /**
+         * Horizontal area the volumes are computed over.
+         */
+        double area;
+
+        /**
+         * CutFill constructor.
+         */
+        CutFill() : cut(0.0), fill(0.0), area(0.0) {};
+    };
+
+    /**
+     * The VolumeCalculator static class integrates sleek surfaces without building any mesh. The height of each cell
+     * is the Coons patch given in the closed form, so it is integrated over the cell by Gauss-Legendre quadrature
+     * of the patch itself. Where the integrand has a kink, i.e. where cut turns to fill, the cell is split into
+     * sub-cells, each integrated the same way. Cells crossed by the border of the region are clipped by the polygon,
+     * sub-cell by sub-cell, and the clipped polygons are integrated by the collapsed Gauss-Legendre quadrature of
+     * triangles, so the area of the region is exact. Only complete cells of the surface are integrated, and only
+     * the points where the reference is defined are taken. Cells are processed in parallel.
+     */
+    class VolumeCalculator
+    {
+        static bool locate(const HeightField &field, double px, double pz, int &x, int &z, double &t, double &q);
+        static bool isInside(const vector<Vec3> &polygon, double px, double pz);
+        static bool crossesRect(const vector<Vec3> &polygon, double x0, double z0, double x1, double z1);
+        static void clipRect(const vector<Vec3> &polygon, double x0, double z0, double x1, double z1, vector<Vec3> &clipped);
+        static void integratePolygon(const SurfaceModel &model, const SurfaceModel *reference, double plane, int x, int z,
+                                     const vector<Vec3> &polygon, const vector<double> &nodes, const vector<double> &weights,
+                                     double &cut, double &fill, double &area);
+        static bool integrate(const SurfaceModel &model, const SurfaceModel *reference, double plane,
+                              const vector<Vec3> &polygon, int order, int subdivisions, CutFill &result);
+
+    public:
+        /**
+         * Maximum number of quadrature nodes along each axis.
+         */
+        static const int MAX_ORDER = 32;
+
+        /**
+         * Compute the volume between the surface and the horizontal plane.
+         *
+         * @param model - surface model created by <code>SurfaceBuilder::prepare</code>.
+         * @param base - height of the plane.
+         * @param order - number of quadrature nodes along each axis of the cell in [1; MAX_ORDER].
+         * @param volume - output volume, negative where the surface is below the plane.
+         * @return true if the volume is computed, false if parameters are invalid.
+         */
+        static bool computeVolume(const SurfaceModel &model, double base, int order, double &volume);
+        /**
+         * Compute cut and fill between the surface and the horizontal plane within the polygon.
+         *
+         * @param model - surface model created by <code>SurfaceBuilder::prepare</code>.
+         * @param plane - height of the plane.
+         * @param polygon - vertices of the region polygon, only x and z coordinates are used. Empty polygon stands
+         * for the whole surface.
+         * @param order - number of quadrature nodes along each axis of the sub-cell in [1; MAX_ORDER].
+         * @param subdivisions - number of sub-cells along each cell side, where the cell is crossed by the plane.
+         * @param result - output volumes.
+         * @return true if the volumes are computed, false if parameters are invalid.
+         */
+        static bool computeCutFill(const SurfaceModel &model, double plane, const vector<Vec3> &polygon, int order,
+                                   int subdivisions, CutFill &result);
+        /**
+         * Compute cut and fill between two surfaces within the polygon, e.g. between the survey and the design.
+         * The surfaces may be built on different grids, the cells of the first one are integrated, and the second
+         * one is evaluated in the quadrature nodes. As the kinks of the second surface are not known, each cell
+         * is split into sub-cells.
+         *
+         * @param model - surface model created by <code>SurfaceBuilder::prepare</code>, e.g. the survey.
+         * @param reference - reference surface model, e.g. the design.
+         * @param polygon - vertices of the region polygon, only x and z coordinates are used. Empty polygon stands
+         * for the whole surface.
+         * @param order - number of quadrature nodes along each axis of the sub-cell in [1; MAX_ORDER].
+         * @param subdivisions - number of sub-cells along each cell side.
+         * @param result - output volumes.
+         * @return true if the volumes are computed, false if parameters are invalid.
+         */
+        static bool computeCutFill(const SurfaceModel &model, const SurfaceModel &reference, const vector<Vec3> &polygon,
+                                   int order, int subdivisions, CutFill &result);
+    };
+}
+
+#endif // __SLEEKSURFACE_VOLUME_H__